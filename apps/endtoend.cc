@@ -87,12 +87,15 @@ private:
   NetworkInterface _interface;
   Address _next_hop;
   pair<FileDescriptor, FileDescriptor> _data_socket_pair = socket_pair_helper( SOCK_DGRAM );
+  vector<EthernetFrame> _frames_out {};
 
   void send_pending()
   {
-    while ( auto frame = _interface.maybe_send() ) {
-      _data_socket_pair.first.write( serialize( frame.value() ) );
+    _interface.drain_frames( _frames_out );
+    for ( const auto& frame : _frames_out ) {
+      _data_socket_pair.first.write( serialize( frame ) );
     }
+    _frames_out.clear();
   }
 
 public:
@@ -217,6 +220,14 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
 
   queue<EthernetFrame> router_to_host;
   queue<EthernetFrame> router_to_internet;
+  vector<EthernetFrame> frames_out; // drained from the router's interfaces
+  const auto drain_router_interface = [&]( const size_t interface, queue<EthernetFrame>& to ) {
+    router.interface( interface ).drain_frames( frames_out );
+    for ( auto& frame : frames_out ) {
+      to.push( move( frame ) );
+    }
+    frames_out.clear();
+  };
 
   /* set up the network */
   thread network_thread( [&]() {
@@ -232,7 +243,7 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
         if ( debug ) {
           cerr << "     Host->router:     " << summary( frame ) << "\n";
         }
-        router.interface( host_side ).recv_frame( frame );
+        router.interface( host_side ).recv_frame( move( frame ) );
         router.route();
       } );
 
@@ -276,7 +287,7 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
         if ( debug ) {
           cerr << "     Internet->router: " << summary( frame ) << "\n";
         }
-        router.interface( internet_side ).recv_frame( frame );
+        router.interface( internet_side ).recv_frame( move( frame ) );
         router.route();
       } );
 
@@ -287,12 +298,8 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
         }
         router.interface( host_side ).tick( 10 );
         router.interface( internet_side ).tick( 10 );
-        while ( auto frame = router.interface( host_side ).maybe_send() ) {
-          router_to_host.push( move( frame.value() ) );
-        }
-        while ( auto frame = router.interface( internet_side ).maybe_send() ) {
-          router_to_internet.push( move( frame.value() ) );
-        }
+        drain_router_interface( host_side, router_to_host );
+        drain_router_interface( internet_side, router_to_internet );
 
         if ( exit_flag ) {
           return;
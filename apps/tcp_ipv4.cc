@@ -34,7 +34,9 @@ static void show_usage( const char* argv0, const char* msg )
 
        << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
 
-       << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n\n"
+       << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n"
+       << "   -m <mtu>        MTU of the tun device                           " << TCPOverIPv4Adapter::DEFAULT_MTU
+       << "\n\n"
 
        << "   -Lu <loss>      Set uplink loss to <rate> (float in 0..1)       (no loss)\n"
        << "   -Ld <loss>      Set downlink loss to <rate> (float in 0..1)     (no loss)\n\n"
@@ -55,11 +57,12 @@ static void check_argc( const span<char*>& args, size_t curr, const char* err )
   }
 }
 
-static tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char*>& args )
+static tuple<TCPConfig, FdAdapterConfig, bool, const char*, size_t> get_config( const span<char*>& args )
 {
   TCPConfig c_fsm {};
   FdAdapterConfig c_filt {};
   const char* tundev = nullptr;
+  size_t mtu = TCPOverIPv4Adapter::DEFAULT_MTU;
 
   size_t curr = 1;
   bool listen = false;
@@ -98,6 +101,11 @@ static tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const sp
       tundev = args[curr + 1];
       curr += 2;
 
+    } else if ( strncmp( "-m", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -m requires one argument." );
+      mtu = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
     } else if ( strncmp( "-Lu", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -Lu requires one argument." );
       const float lossrate = strtof( args[curr + 1], nullptr );
@@ -136,7 +144,7 @@ static tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const sp
     c_filt.source = { source_address, source_port };
   }
 
-  return make_tuple( c_fsm, c_filt, listen, tundev );
+  return make_tuple( c_fsm, c_filt, listen, tundev, mtu );
 }
 
 int main( int argc, char** argv )
@@ -153,9 +161,10 @@ int main( int argc, char** argv )
       return EXIT_FAILURE;
     }
 
-    auto [c_fsm, c_filt, listen, tun_dev_name] = get_config( args );
-    LossyTCPOverIPv4MinnowSocket tcp_socket( LossyTCPOverIPv4OverTunFdAdapter(
-      TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) ) ) );
+    auto [c_fsm, c_filt, listen, tun_dev_name, mtu] = get_config( args );
+    TCPOverIPv4OverTunFdAdapter tun_adapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) );
+    tun_adapter.set_link_mtu( mtu );
+    LossyTCPOverIPv4MinnowSocket tcp_socket( LossyTCPOverIPv4OverTunFdAdapter( std::move( tun_adapter ) ) );
 
     if ( listen ) {
       tcp_socket.listen_and_accept( c_fsm, c_filt );
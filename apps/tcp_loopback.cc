@@ -0,0 +1,150 @@
+#include "loopback_adapter.hh"
+#include "tcp_config.hh"
+#include "tcp_minnow_socket.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+static constexpr const char* CLIENT_ADDRESS = "10.144.0.1";
+static constexpr const char* SERVER_ADDRESS = "10.144.0.2";
+static constexpr uint16_t SERVER_PORT = 1234;
+
+static void show_usage( const char* argv0 )
+{
+  cerr << "Usage: " << argv0 << " [options]\n\n"
+       << "  Transfers bytes from a client to a server TCPMinnowSocket over an in-memory link, and reports the\n"
+       << "  goodput. Link impairments apply in both directions.\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+       << "   -n <bytes>      Transfer <bytes> bytes                          100000000\n"
+       << "   -w <winsz>      Use a window of <winsz> bytes                   " << TCPConfig::DEFAULT_CAPACITY
+       << "\n"
+       << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
+       << "   -d <ms>         One-way propagation delay                       0\n"
+       << "   -j <ms>         Jitter (uniform extra delay)                    0\n"
+       << "   -b <Mbit/s>     Bottleneck bandwidth                            (unlimited)\n"
+       << "   -q <bytes>      Bottleneck queue limit                          64000\n"
+       << "   -l <rate>       Loss rate (float in 0..1)                       (no loss)\n"
+       << "   -r <rate>       Reordering rate (float in 0..1)                 (no reordering)\n"
+       << "   -u <rate>       Duplication rate (float in 0..1)                (no duplication)\n";
+}
+
+static void send_all( EmulatedTCPOverIPv4OverLoopbackMinnowSocket& sock, size_t len )
+{
+  const string chunk( 65536, 'x' );
+  while ( len > 0 ) {
+    const string_view to_write = string_view { chunk }.substr( 0, len );
+    len -= sock.write( to_write );
+  }
+  sock.shutdown( SHUT_WR );
+}
+
+static size_t receive_all( EmulatedTCPOverIPv4OverLoopbackMinnowSocket& sock )
+{
+  size_t received = 0;
+  string buf;
+  while ( not sock.eof() ) {
+    buf.clear();
+    sock.read( buf );
+    received += buf.size();
+  }
+  return received;
+}
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+
+    size_t len = 100'000'000;
+    TCPConfig c_fsm {};
+    NetworkEmulatorConfig c_emu {};
+    for ( size_t curr = 1; curr < args.size(); curr += 2 ) {
+      if ( curr + 1 >= args.size() ) {
+        show_usage( args[0] );
+        return EXIT_FAILURE;
+      }
+      const char* value = args[curr + 1];
+      if ( strncmp( "-n", args[curr], 3 ) == 0 ) {
+        len = strtoull( value, nullptr, 0 );
+      } else if ( strncmp( "-w", args[curr], 3 ) == 0 ) {
+        c_fsm.recv_capacity = strtoull( value, nullptr, 0 );
+        c_fsm.send_capacity = c_fsm.recv_capacity;
+      } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
+        c_fsm.rt_timeout = strtol( value, nullptr, 0 );
+      } else if ( strncmp( "-d", args[curr], 3 ) == 0 ) {
+        c_emu.delay_ms = strtoul( value, nullptr, 0 );
+      } else if ( strncmp( "-j", args[curr], 3 ) == 0 ) {
+        c_emu.jitter_ms = strtoul( value, nullptr, 0 );
+      } else if ( strncmp( "-b", args[curr], 3 ) == 0 ) {
+        c_emu.bandwidth_bps = static_cast<uint64_t>( strtod( value, nullptr ) * 1e6 );
+      } else if ( strncmp( "-q", args[curr], 3 ) == 0 ) {
+        c_emu.queue_limit_bytes = strtoull( value, nullptr, 0 );
+      } else if ( strncmp( "-l", args[curr], 3 ) == 0 ) {
+        c_emu.loss_good = strtod( value, nullptr );
+      } else if ( strncmp( "-r", args[curr], 3 ) == 0 ) {
+        c_emu.reorder_prob = strtod( value, nullptr );
+      } else if ( strncmp( "-u", args[curr], 3 ) == 0 ) {
+        c_emu.duplicate_prob = strtod( value, nullptr );
+      } else {
+        show_usage( args[0] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    auto [client_adapter, server_adapter] = TCPOverIPv4OverLoopbackAdapter::make_link();
+    EmulatedTCPOverIPv4OverLoopbackMinnowSocket client {
+      EmulatedTCPOverIPv4OverLoopbackAdapter { move( client_adapter ), c_emu } };
+    EmulatedTCPOverIPv4OverLoopbackMinnowSocket server {
+      EmulatedTCPOverIPv4OverLoopbackAdapter { move( server_adapter ), c_emu } };
+    client.set_blocking( true );
+    server.set_blocking( true );
+
+    size_t received = 0;
+    thread server_thread( [&] {
+      FdAdapterConfig c_server {};
+      c_server.source = Address { SERVER_ADDRESS, SERVER_PORT };
+      server.listen_and_accept( c_fsm, c_server );
+      received = receive_all( server );
+      server.wait_until_closed();
+    } );
+
+    FdAdapterConfig c_client {};
+    c_client.source = { CLIENT_ADDRESS, to_string( uint16_t( random_device()() ) ) };
+    c_client.destination = Address { SERVER_ADDRESS, SERVER_PORT };
+
+    client.connect( c_fsm, c_client );
+    const auto start_time = steady_clock::now();
+    send_all( client, len );
+    server_thread.join();
+    const auto stop_time = steady_clock::now();
+    client.wait_until_closed();
+
+    if ( received != len ) {
+      throw runtime_error( "received " + to_string( received ) + " bytes, expected " + to_string( len ) );
+    }
+
+    const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+    cout << "Transferred " << len << " bytes over loopback link in " << fixed << setprecision( 3 )
+         << test_duration.count() << " s: " << setprecision( 2 )
+         << 8 * static_cast<double>( len ) / test_duration.count() / 1e6 << " Mbit/s.\n";
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -3,8 +3,40 @@
 #include "arp_message.hh"
 #include "ethernet_frame.hh"
 
+#include <stdexcept>
+#include <utility>
+
 using namespace std;
 
+namespace {
+
+size_t total_size( const vector<Buffer>& buffers )
+{
+  size_t ret = 0;
+  for ( const auto& b : buffers ) {
+    ret += b.size();
+  }
+  return ret;
+}
+
+// Whether a frame's payload begins with a whole IPv4 header (to read its flow from)
+bool has_contiguous_header( const RawIPv4Datagram& dgram )
+{
+  return not dgram.buffers.empty() and dgram.buffers.front().size() >= IPv4Header::LENGTH
+         and dgram.buffers.front().size() >= dgram.header_length();
+}
+
+// Mark the datagram in a frame Congestion Experienced, for FQ-CoDel; false if it is not ECN-capable
+bool mark_congestion( EthernetFrame& frame )
+{
+  RawIPv4Datagram dgram { std::move( frame.payload ) };
+  const bool marked = has_contiguous_header( dgram ) and dgram.mark_congestion_experienced();
+  frame.payload = std::move( dgram.buffers );
+  return marked;
+}
+
+} // namespace
+
 // ethernet_address: Ethernet (what ARP calls "hardware") address of the interface
 // ip_address: IP (what ARP calls "protocol") address of the interface
 NetworkInterface::NetworkInterface( const EthernetAddress& ethernet_address, const Address& ip_address )
@@ -14,6 +46,15 @@ NetworkInterface::NetworkInterface( const EthernetAddress& ethernet_address, con
        << ip_address.ip() << "\n";
 }
 
+void NetworkInterface::set_mtu( const size_t mtu )
+{
+  if ( mtu < MIN_MTU or mtu > JUMBO_MTU ) {
+    throw runtime_error( "NetworkInterface: MTU must be from " + to_string( MIN_MTU ) + " to "
+                         + to_string( JUMBO_MTU ) );
+  }
+  mtu_ = mtu;
+}
+
 ARPMessage NetworkInterface::make_arp( const uint16_t opcode,
                                        const EthernetAddress sender_ethernet_address,
                                        const uint32_t& sender_ip_address,
@@ -50,66 +91,328 @@ EthernetFrame NetworkInterface::make_frame( const EthernetAddress& src,
 // Address::ipv4_numeric() method.
 void NetworkInterface::send_datagram( const InternetDatagram& dgram, const Address& next_hop )
 {
-  auto cache_it = arp_cache_.find( next_hop.ipv4_numeric() );
-  auto waitlist_it = arp_waitlist_.find( next_hop.ipv4_numeric() );
-
-  if ( cache_it == arp_cache_.end() ) {
-    // If the host doesn't know target MAC address, send ARP message.
-    if ( waitlist_it == arp_waitlist_.end() ) {
-      // No waitlist item indicates that no ARP request recently.
-      // Create item, push dgram and send ARP message.
-      arp_waitlist_[next_hop.ipv4_numeric()] = {};
-      arp_waitlist_[next_hop.ipv4_numeric()].waitings.push( dgram );
-
-      ARPMessage arp = make_arp(
-        ARPMessage::OPCODE_REQUEST, ethernet_address_, ip_address_.ipv4_numeric(), {}, next_hop.ipv4_numeric() );
-      EthernetFrame frame
-        = make_frame( ethernet_address_, ETHERNET_BROADCAST, EthernetHeader::TYPE_ARP, serialize( arp ) );
-
-      frames_out_.push( frame );
-    } else {
-      // If there is ARP request recently, push dgram into 'waitings'.
-      waitlist_it->second.waitings.push( dgram );
-      if ( waitlist_it->second.timer > NetworkInterface::ARP_INTERVAL ) {
-        // If ARP request is more than 5s ago, retx it.
-        ARPMessage arp = make_arp(
-          ARPMessage::OPCODE_REQUEST, ethernet_address_, ip_address_.ipv4_numeric(), {}, waitlist_it->first );
-        EthernetFrame frame
-          = make_frame( ethernet_address_, ETHERNET_BROADCAST, EthernetHeader::TYPE_ARP, serialize( arp ) );
-
-        frames_out_.push( frame );
-      }
+  send_serialized( serialize( dgram ), next_hop.ipv4_numeric() );
+}
+
+void NetworkInterface::send_datagram( RawIPv4Datagram dgram, const uint32_t next_hop )
+{
+  send_serialized( std::move( dgram.buffers ), next_hop );
+}
+
+void NetworkInterface::send_datagrams( span<OutboundDatagram> dgrams )
+{
+  // The last next hop looked up, if it was resolved (a pointer into neighbours_ stays valid only until the
+  // next lookup, which may insert or erase)
+  const Neighbour* resolved = nullptr;
+  uint32_t resolved_ip = 0;
+
+  for ( auto& [dgram, next_hop] : dgrams ) {
+    if ( resolved != nullptr and next_hop == resolved_ip and resolved->state == NeighbourState::REACHABLE
+         and dgram.size() <= mtu_ ) {
+      send_ipv4_frame( make_frame(
+        ethernet_address_, resolved->ethernet_address, EthernetHeader::TYPE_IPv4, std::move( dgram.buffers ) ) );
+      continue;
     }
+
+    send_serialized( std::move( dgram.buffers ), next_hop );
+    resolved = neighbours_.find( next_hop );
+    resolved_ip = next_hop;
+  }
+}
+
+void NetworkInterface::send_serialized( vector<Buffer> dgram, const uint32_t next_hop )
+{
+  if ( total_size( dgram ) > mtu_ ) {
+    send_fragmented( std::move( dgram ), next_hop );
   } else {
-    // If the host knows target MAC address, send dgram.
-    EthernetAddress dst = cache_it->second.ethernet_address;
-    EthernetFrame frame = make_frame( ethernet_address_, dst, EthernetHeader::TYPE_IPv4, serialize( dgram ) );
+    send_fitting( std::move( dgram ), next_hop );
+  }
+}
+
+void NetworkInterface::send_fragmented( vector<Buffer> dgram, const uint32_t next_hop )
+{
+  auto raw = RawIPv4Datagram::from( std::move( dgram ) );
+  scratch_fragments_.clear();
+  if ( not raw.has_value() or not fragment_ipv4( std::move( *raw ), mtu_, scratch_fragments_ ) ) {
+    fragment_stats_.dropped_too_big++;
+    return;
+  }
+
+  // (A datagram padded beyond its total length may turn out to fit after all.)
+  if ( scratch_fragments_.size() > 1 ) {
+    fragment_stats_.fragmented++;
+    fragment_stats_.fragments += scratch_fragments_.size();
+  }
+  for ( auto& fragment : scratch_fragments_ ) {
+    send_fitting( std::move( fragment.buffers ), next_hop );
+  }
+}
 
-    frames_out_.push( frame );
+void NetworkInterface::send_ipv4_frame( EthernetFrame frame )
+{
+  if ( not output_queue_.has_value() ) {
+    frames_out_.push_back( std::move( frame ) );
+    return;
+  }
+
+  RawIPv4Datagram dgram { std::move( frame.payload ) };
+  const uint32_t flow_hash = has_contiguous_header( dgram ) ? dgram.flow_hash() : 0;
+  const size_t size = EthernetHeader::LENGTH + dgram.size();
+  frame.payload = std::move( dgram.buffers );
+  output_queue_->enqueue( std::move( frame ), flow_hash, size, neighbour_timers_.now() );
+}
+
+void NetworkInterface::enable_fq_codel( const OutputQueue::Config& config )
+{
+  // Frames already queued keep their place ahead of any new ones.
+  if ( output_queue_.has_value() ) {
+    while ( auto frame = output_queue_->dequeue( neighbour_timers_.now(), mark_congestion ) ) {
+      frames_out_.push_back( std::move( *frame ) );
+    }
+  }
+  output_queue_.emplace( config );
+}
+
+void NetworkInterface::send_fitting( vector<Buffer> dgram, const uint32_t next_hop )
+{
+  auto& neighbour = neighbours_.try_emplace( next_hop ).first;
+
+  if ( neighbour.state != NeighbourState::INCOMPLETE ) {
+    // If the host knows target MAC address, send dgram (and refresh the mapping if it is getting old).
+    send_ipv4_frame(
+      make_frame( ethernet_address_, neighbour.ethernet_address, EthernetHeader::TYPE_IPv4, std::move( dgram ) ) );
+    if ( neighbour.state != NeighbourState::REACHABLE ) {
+      probe( next_hop, neighbour );
+    }
+    return;
+  }
+
+  // Otherwise the dgram waits for an ARP reply. A new neighbour is sent an ARP request, if the rate limit
+  // allows; if not, it is forgotten again and the dgram is dropped.
+  traffic_stats_.arp_misses++;
+  if ( not neighbour.timer_armed ) {
+    if ( arp_request_credit_ < 1000 ) {
+      pending_stats_.requests_suppressed++;
+      drop_pending( dgram );
+      neighbours_.erase( next_hop );
+      return;
+    }
+    arp_request_credit_ -= 1000;
+    pending_stats_.requests_sent++;
+    traffic_stats_.arp_requests_sent++;
+
+    ARPMessage arp
+      = make_arp( ARPMessage::OPCODE_REQUEST, ethernet_address_, ip_address_.ipv4_numeric(), {}, next_hop );
+    frames_out_.push_back(
+      make_frame( ethernet_address_, ETHERNET_BROADCAST, EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+    arm( next_hop, neighbour, NetworkInterface::ARP_INTERVAL );
+  }
+  enqueue_pending( neighbour, std::move( dgram ) );
+}
+
+void NetworkInterface::enqueue_pending( Neighbour& neighbour, vector<Buffer> dgram )
+{
+  const size_t size = total_size( dgram );
+  if ( size > NetworkInterface::MAX_PENDING_BYTES_PER_NEIGHBOUR ) {
+    drop_pending( dgram );
+    return;
+  }
+
+  // Make room in this neighbour's queue by dropping its oldest datagrams.
+  while ( neighbour.waiting_bytes + size > NetworkInterface::MAX_PENDING_BYTES_PER_NEIGHBOUR ) {
+    drop_pending( dequeue_pending( neighbour ) );
+  }
+
+  if ( pending_stats_.queued_bytes + size > NetworkInterface::MAX_PENDING_BYTES ) {
+    drop_pending( dgram );
+    return;
+  }
+
+  neighbour.waitings.push( std::move( dgram ) );
+  neighbour.waiting_bytes += size;
+  pending_stats_.queued_datagrams++;
+  pending_stats_.queued_bytes += size;
+}
+
+vector<Buffer> NetworkInterface::dequeue_pending( Neighbour& neighbour )
+{
+  vector<Buffer> dgram = std::move( neighbour.waitings.front() );
+  neighbour.waitings.pop();
+  const size_t size = total_size( dgram );
+  neighbour.waiting_bytes -= size;
+  pending_stats_.queued_datagrams--;
+  pending_stats_.queued_bytes -= size;
+  return dgram;
+}
+
+void NetworkInterface::drop_pending( const vector<Buffer>& dgram )
+{
+  pending_stats_.dropped_datagrams++;
+  pending_stats_.dropped_bytes += total_size( dgram );
+}
+
+void NetworkInterface::probe( const uint32_t ip_address, Neighbour& neighbour )
+{
+  if ( neighbour.state == NeighbourState::PROBE and neighbour_timers_.now() < neighbour.next_probe ) {
+    return;
+  }
+
+  // Unicast, like a reply, so that only the neighbour itself is asked.
+  ARPMessage arp = make_arp( ARPMessage::OPCODE_REQUEST,
+                             ethernet_address_,
+                             ip_address_.ipv4_numeric(),
+                             neighbour.ethernet_address,
+                             ip_address );
+  frames_out_.push_back(
+    make_frame( ethernet_address_, neighbour.ethernet_address, EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+  traffic_stats_.arp_requests_sent++;
+  neighbour.state = NeighbourState::PROBE;
+  neighbour.next_probe = neighbour_timers_.now() + NetworkInterface::PROBE_INTERVAL;
+}
+
+void NetworkInterface::arm( const uint32_t ip_address, Neighbour& neighbour, const uint32_t lifetime )
+{
+  // Lifetimes are inclusive: the deadline passes once more than `lifetime` ms have passed
+  neighbour.deadline = neighbour_timers_.now() + lifetime + 1;
+  if ( not neighbour.timer_armed ) {
+    neighbour.timer_armed = true;
+    neighbour_timers_.schedule( neighbour.deadline, ip_address );
+  }
+}
+
+void NetworkInterface::expire( const uint32_t ip_address )
+{
+  Neighbour* neighbour = neighbours_.find( ip_address );
+  if ( neighbour == nullptr ) {
+    return;
+  }
+
+  if ( neighbour->deadline > neighbour_timers_.now() ) {
+    // Refreshed since the timer was set.
+    neighbour_timers_.schedule( neighbour->deadline, ip_address );
+    return;
+  }
+
+  switch ( neighbour->state ) {
+    case NeighbourState::INCOMPLETE:
+      // No reply to the ARP request: drop the waiting datagrams. The next datagram to this neighbour asks again.
+      while ( not neighbour->waitings.empty() ) {
+        drop_pending( dequeue_pending( *neighbour ) );
+      }
+      neighbours_.erase( ip_address );
+      break;
+
+    case NeighbourState::REACHABLE:
+      // Still usable until CACHE_ITEM_TTL, but the next use asks the neighbour to confirm.
+      neighbour->state = NeighbourState::STALE;
+      neighbour->deadline = neighbour->confirmed + NetworkInterface::CACHE_ITEM_TTL + 1;
+      neighbour_timers_.schedule( neighbour->deadline, ip_address );
+      break;
+
+    case NeighbourState::STALE:
+    case NeighbourState::PROBE:
+      // Mapping timed out (unconfirmed), remove it.
+      neighbours_.erase( ip_address );
+      break;
   }
 }
 
 // frame: the incoming Ethernet frame
 optional<InternetDatagram> NetworkInterface::recv_frame( const EthernetFrame& frame )
+{
+  if ( accept_frame( frame ) ) {
+    return parse_datagram( frame.payload );
+  }
+  return nullopt;
+}
+
+optional<RawIPv4Datagram> NetworkInterface::recv_raw_frame( EthernetFrame frame )
+{
+  if ( accept_frame( frame ) ) {
+    if ( auto dgram = RawIPv4Datagram::from( std::move( frame.payload ) ) ) {
+      return reassemble( std::move( *dgram ) );
+    }
+    traffic_stats_.rx_malformed++;
+  }
+  return nullopt;
+}
+
+void NetworkInterface::recv_frames( span<EthernetFrame> frames, vector<InternetDatagram>& out )
+{
+  for ( auto& frame : frames ) {
+    if ( accept_frame( frame ) ) {
+      if ( auto dgram = parse_datagram( std::exchange( frame.payload, {} ) ) ) {
+        out.push_back( std::move( *dgram ) );
+      }
+    }
+  }
+}
+
+void NetworkInterface::recv_raw_frames( span<EthernetFrame> frames, vector<RawIPv4Datagram>& out )
+{
+  for ( auto& frame : frames ) {
+    if ( auto dgram = recv_raw_frame( std::move( frame ) ) ) {
+      out.push_back( std::move( *dgram ) );
+    }
+  }
+}
+
+optional<InternetDatagram> NetworkInterface::parse_datagram( const vector<Buffer>& payload )
+{
+  InternetDatagram dgram;
+  if ( not parse( dgram, payload ) ) {
+    traffic_stats_.rx_malformed++;
+    return nullopt;
+  }
+  if ( not( dgram.header.mf or dgram.header.offset != 0 ) or dgram.header.dst != ip_address_.ipv4_numeric() ) {
+    return dgram;
+  }
+
+  // A fragment: parse the whole datagram once it has been reassembled.
+  auto raw = RawIPv4Datagram::from( payload );
+  if ( not raw.has_value() ) {
+    traffic_stats_.rx_malformed++;
+    return nullopt;
+  }
+  auto whole = reassembler_.add( *raw );
+  if ( not whole.has_value() or not parse( dgram, whole->buffers ) ) {
+    return nullopt;
+  }
+  return dgram;
+}
+
+optional<RawIPv4Datagram> NetworkInterface::reassemble( RawIPv4Datagram dgram )
+{
+  if ( not dgram.is_fragment() or dgram.dst() != ip_address_.ipv4_numeric() ) {
+    return dgram;
+  }
+  return reassembler_.add( dgram );
+}
+
+bool NetworkInterface::accept_frame( const EthernetFrame& frame )
 {
   if ( !( frame.header.dst == ethernet_address_ || frame.header.dst == ETHERNET_BROADCAST ) ) {
     // Destination of frame is not this host, ignore it.
-    return nullopt;
+    traffic_stats_.rx_ignored++;
+    return false;
   }
+  traffic_stats_.rx_frames++;
+  traffic_stats_.rx_bytes += EthernetHeader::LENGTH + total_size( frame.payload );
 
   if ( frame.header.type == EthernetHeader::TYPE_IPv4 ) {
     // Payload is IPv4.
-    InternetDatagram dgram;
-    if ( parse( dgram, frame.payload ) ) {
-      // If no error, return dgram.
-      return dgram;
-    }
-  } else if ( frame.header.type == EthernetHeader::TYPE_ARP ) {
+    return true;
+  }
+
+  if ( frame.header.type == EthernetHeader::TYPE_ARP ) {
     // Payload is ARP.
     ARPMessage arp;
     if ( parse( arp, frame.payload ) ) {
-      auto cache_it = arp_cache_.find( arp.sender_ip_address );
-      auto waitlist_it = arp_waitlist_.find( arp.sender_ip_address );
+      if ( arp.opcode == ARPMessage::OPCODE_REQUEST ) {
+        traffic_stats_.arp_requests_received++;
+      } else if ( arp.opcode == ARPMessage::OPCODE_REPLY ) {
+        traffic_stats_.arp_replies_received++;
+      }
 
       if ( arp.opcode == ARPMessage::OPCODE_REQUEST && arp.target_ip_address == ip_address_.ipv4_numeric() ) {
         // Send ARP reply.
@@ -121,70 +424,100 @@ optional<InternetDatagram> NetworkInterface::recv_frame( const EthernetFrame& fr
         EthernetFrame frame_ = make_frame(
           ethernet_address_, arp.sender_ethernet_address, EthernetHeader::TYPE_ARP, serialize( arp_reply ) );
 
-        frames_out_.push( frame_ );
-      }
-
-      if ( cache_it == arp_cache_.end() ) {
-        // Insert cache item.
-        CacheItem item;
-        item.ethernet_address = arp.sender_ethernet_address;
-        arp_cache_[arp.sender_ip_address] = item;
-      } else {
-        // Update cache item.
-        cache_it->second.ethernet_address = arp.sender_ethernet_address;
-        cache_it->second.ttl = NetworkInterface::CACHE_ITEM_TTL;
+        frames_out_.push_back( frame_ );
+        traffic_stats_.arp_replies_sent++;
       }
 
-      // Clean waitlist and erase waitlist item.
-      if ( waitlist_it != arp_waitlist_.end() ) {
-        while ( !waitlist_it->second.waitings.empty() ) {
-          InternetDatagram dgram = waitlist_it->second.waitings.front();
-          waitlist_it->second.waitings.pop();
+      // Learn (or refresh) the mapping.
+      auto& neighbour = neighbours_.try_emplace( arp.sender_ip_address ).first;
+      neighbour.state = NeighbourState::REACHABLE;
+      neighbour.ethernet_address = arp.sender_ethernet_address;
+      neighbour.confirmed = neighbour_timers_.now();
+      arm( arp.sender_ip_address, neighbour, NetworkInterface::REFRESH_TIME );
 
-          EthernetFrame frame_
-            = make_frame( ethernet_address_, frame.header.src, EthernetHeader::TYPE_IPv4, serialize( dgram ) );
+      // Send the datagrams that were waiting for it.
+      while ( !neighbour.waitings.empty() ) {
+        vector<Buffer> dgram = dequeue_pending( neighbour );
 
-          frames_out_.push( frame_ );
-        }
+        send_ipv4_frame(
+          make_frame( ethernet_address_, frame.header.src, EthernetHeader::TYPE_IPv4, std::move( dgram ) ) );
       }
-
-      arp_waitlist_.erase( waitlist_it->first );
+      return false;
     }
   }
 
-  return nullopt;
+  traffic_stats_.rx_malformed++;
+  return false;
 }
 
 // ms_since_last_tick: the number of milliseconds since the last call to this method
 void NetworkInterface::tick( const size_t ms_since_last_tick )
 {
-  for ( auto cache_it = arp_cache_.begin(); cache_it != arp_cache_.end(); ) {
-    // Iterately decrease ttl.
-    if ( cache_it->second.ttl < ms_since_last_tick ) {
-      // If ttl timeout, remove item.
-      auto tmp = cache_it;
-      cache_it++;
-      arp_cache_.erase( tmp );
-    } else {
-      // If not timeout, decrease ttl.
-      cache_it->second.ttl -= ms_since_last_tick;
-      cache_it++;
+  arp_request_credit_ = min( arp_request_credit_ + ms_since_last_tick * NetworkInterface::ARP_REQUESTS_PER_SECOND,
+                             uint64_t { NetworkInterface::ARP_REQUEST_BURST } * 1000 );
+
+  neighbour_timers_.advance( neighbour_timers_.now() + ms_since_last_tick,
+                             [this]( const uint32_t ip_address ) { expire( ip_address ); } );
+
+  reassembler_.tick( ms_since_last_tick );
+}
+
+optional<EthernetFrame> NetworkInterface::maybe_send()
+{
+  if ( frames_out_head_ == frames_out_.size() ) {
+    if ( output_queue_.has_value() ) {
+      auto eframe = output_queue_->dequeue( neighbour_timers_.now(), mark_congestion );
+      if ( eframe.has_value() ) {
+        count_sent( { &*eframe, 1 } );
+      }
+      return eframe;
     }
+    return nullopt;
   }
 
-  for ( auto waitlist_it = arp_waitlist_.begin(); waitlist_it != arp_waitlist_.end(); waitlist_it++ ) {
-    // Iterately increase timer.
-    waitlist_it->second.timer += ms_since_last_tick;
+  EthernetFrame eframe = std::move( frames_out_[frames_out_head_++] );
+  count_sent( { &eframe, 1 } );
+  if ( frames_out_head_ == frames_out_.size() ) {
+    frames_out_.clear();
+    frames_out_head_ = 0;
+  } else if ( frames_out_head_ >= 64 and frames_out_head_ * 2 >= frames_out_.size() ) {
+    // Not drained for a while: discard the frames already taken.
+    frames_out_.erase( frames_out_.begin(), frames_out_.begin() + static_cast<ptrdiff_t>( frames_out_head_ ) );
+    frames_out_head_ = 0;
   }
+  return eframe;
 }
 
-optional<EthernetFrame> NetworkInterface::maybe_send()
+void NetworkInterface::count_sent( span<const EthernetFrame> frames )
 {
-  if ( frames_out_.empty() ) {
-    return nullopt;
+  traffic_stats_.tx_frames += frames.size();
+  for ( const auto& frame : frames ) {
+    traffic_stats_.tx_bytes += EthernetHeader::LENGTH + total_size( frame.payload );
+  }
+}
+
+size_t NetworkInterface::drain_frames( vector<EthernetFrame>& out )
+{
+  const size_t first = out.size();
+  size_t count = frames_out_.size() - frames_out_head_;
+  if ( out.empty() and frames_out_head_ == 0 ) {
+    // Hand over the whole vector (and take the caller's, for its capacity).
+    swap( out, frames_out_ );
   } else {
-    EthernetFrame eframe = frames_out_.front();
-    frames_out_.pop();
-    return eframe;
+    out.insert( out.end(),
+                make_move_iterator( frames_out_.begin() + static_cast<ptrdiff_t>( frames_out_head_ ) ),
+                make_move_iterator( frames_out_.end() ) );
+    frames_out_.clear();
   }
+  frames_out_head_ = 0;
+
+  if ( output_queue_.has_value() ) {
+    while ( auto frame = output_queue_->dequeue( neighbour_timers_.now(), mark_congestion ) ) {
+      out.push_back( std::move( *frame ) );
+      count++;
+    }
+  }
+
+  count_sent( span { out }.subspan( first ) );
+  return count;
 }
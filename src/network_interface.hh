@@ -3,13 +3,18 @@
 #include "address.hh"
 #include "arp_message.hh"
 #include "ethernet_frame.hh"
+#include "flat_hash_map.hh"
+#include "fq_codel.hh"
 #include "ipv4_datagram.hh"
+#include "ipv4_fragments.hh"
+#include "timer_wheel.hh"
 
 #include <iostream>
 #include <list>
 #include <map>
 #include <optional>
 #include <queue>
+#include <span>
 #include <unordered_map>
 #include <utility>
 using namespace std;
@@ -37,6 +42,57 @@ using namespace std;
 // and learns or replies as necessary.
 class NetworkInterface
 {
+public:
+  // MTUs: the least that every IPv4 link must carry, Ethernet's, and the most (jumbo frames)
+  static constexpr size_t MIN_MTU = 68;
+  static constexpr size_t DEFAULT_MTU = 1500;
+  static constexpr size_t JUMBO_MTU = 9000;
+
+  // Datagrams waiting for ARP, and what was done to keep them (and ARP requests) bounded
+  struct PendingStats
+  {
+    size_t queued_datagrams {};      // waiting now
+    size_t queued_bytes {};          // waiting now
+    uint64_t dropped_datagrams {};   // dropped for lack of room, or because the neighbour never answered
+    uint64_t dropped_bytes {};
+    uint64_t requests_sent {};       // broadcast ARP requests
+    uint64_t requests_suppressed {}; // not sent for the rate limit (the datagram was dropped instead)
+  };
+
+  // Frames received and sent, and ARP traffic
+  struct TrafficStats
+  {
+    uint64_t rx_frames {};             // addressed to this interface (or broadcast)
+    uint64_t rx_bytes {};              // Ethernet headers included
+    uint64_t rx_ignored {};            // addressed to other hosts
+    uint64_t rx_malformed {};          // an unknown type, or a bad ARP message or IPv4 header
+    uint64_t tx_frames {};             // handed out by maybe_send() or drain_frames()
+    uint64_t tx_bytes {};              // Ethernet headers included
+    uint64_t arp_requests_sent {};     // broadcast, and unicast probes
+    uint64_t arp_replies_sent {};
+    uint64_t arp_requests_received {};
+    uint64_t arp_replies_received {};
+    uint64_t arp_misses {};            // datagrams whose next hop was not resolved (they waited for ARP)
+  };
+
+  // Datagrams larger than the MTU
+  struct FragmentStats
+  {
+    uint64_t fragmented {};      // datagrams split to fit
+    uint64_t fragments {};       // fragments they were split into
+    uint64_t dropped_too_big {}; // datagrams that could not be split (don't-fragment set, or malformed)
+  };
+
+  // Optional active queue management of the IPv4 frames awaiting transmission (ARP frames go ahead of them)
+  using OutputQueue = FQCoDel<EthernetFrame>;
+
+  // A datagram to send as the buffers it arrived in, and its next hop (a raw 32-bit IP address)
+  struct OutboundDatagram
+  {
+    RawIPv4Datagram dgram;
+    uint32_t next_hop;
+  };
+
 private:
   // Ethernet (known as hardware, network-access, or link-layer) address of the interface
   EthernetAddress ethernet_address_;
@@ -48,23 +104,93 @@ private:
 
   static const uint32_t CACHE_ITEM_TTL = 30000;
 
-  queue<EthernetFrame> frames_out_ {};
+  // A mapping older than this is refreshed (by unicast ARP requests, at most one per PROBE_INTERVAL) when
+  // it is used, while it is still used to send
+  static const uint32_t REFRESH_TIME = 27000;
+
+  static const uint32_t PROBE_INTERVAL = 1000;
+
+  // Limits on the datagrams waiting for ARP replies: when a neighbour's queue is full its oldest datagrams are
+  // dropped, and when all the queues together are full new datagrams are dropped
+  static const size_t MAX_PENDING_BYTES_PER_NEIGHBOUR = 64 * 1024;
+  static const size_t MAX_PENDING_BYTES = 1024 * 1024;
+
+  // Broadcast ARP requests to new neighbours are limited by a token bucket
+  static const uint32_t ARP_REQUESTS_PER_SECOND = 1000;
+  static const uint32_t ARP_REQUEST_BURST = 1000;
 
-  struct CacheItem
+  // Frames awaiting transmission: those from frames_out_head_ on (the vector is reused once drained)
+  vector<EthernetFrame> frames_out_ {};
+  size_t frames_out_head_ {};
+
+  // States of a neighbour, after Linux's neighbour table:
+  //   INCOMPLETE: not resolved; datagrams wait for an ARP reply
+  //   REACHABLE: resolved within the last REFRESH_TIME ms
+  //   STALE: resolved within the last CACHE_ITEM_TTL ms; the next use sends a probe
+  //   PROBE: like STALE, and a unicast ARP request has been sent
+  enum class NeighbourState : uint8_t
   {
-    EthernetAddress ethernet_address {};
-    uint32_t ttl { NetworkInterface::CACHE_ITEM_TTL };
+    INCOMPLETE,
+    REACHABLE,
+    STALE,
+    PROBE
   };
 
-  map<uint32_t, CacheItem> arp_cache_ {};
-
-  struct WaitlistItem
+  // What the interface knows about one next hop
+  struct Neighbour
   {
-    queue<InternetDatagram> waitings {};
-    uint32_t timer { 0 };
+    NeighbourState state { NeighbourState::INCOMPLETE };
+    EthernetAddress ethernet_address {}; // unless INCOMPLETE
+    queue<vector<Buffer>> waitings {};   // serialized datagrams (while INCOMPLETE)
+    size_t waiting_bytes {};
+    uint64_t confirmed {};               // when the mapping was last learned
+    uint64_t next_probe {};              // earliest time for another unicast ARP request (while PROBE)
+    uint64_t deadline {};                // next state change: to STALE, expiry, or expiry of the ARP request
+    bool timer_armed {};                 // false only for a neighbour just created
   };
 
-  map<uint32_t, WaitlistItem> arp_waitlist_ {};
+  FlatHashMap<Neighbour> neighbours_ {};
+
+  // State changes of neighbours, by IP address; the clock advances in tick()
+  TimerWheel<uint32_t> neighbour_timers_ {};
+
+  PendingStats pending_stats_ {};
+  TrafficStats traffic_stats_ {};
+
+  // Largest datagram sent whole (headers included); larger ones are fragmented
+  size_t mtu_ { DEFAULT_MTU };
+
+  FragmentStats fragment_stats_ {};
+  std::vector<RawIPv4Datagram> scratch_fragments_ {};
+
+  // Fragments of datagrams addressed to this interface (fragments passing through a router are forwarded as
+  // they are)
+  IPv4Reassembler reassembler_ {};
+
+  // IPv4 frames awaiting transmission, if FQ-CoDel is enabled (they are sent once frames_out_ is empty)
+  std::optional<OutputQueue> output_queue_ {};
+
+  // Tokens for ARP requests, in thousandths of a request
+  uint64_t arp_request_credit_ { uint64_t { ARP_REQUEST_BURST } * 1000 };
+
+  // Queue `dgram` for an unresolved neighbour, within the limits
+  void enqueue_pending( Neighbour& neighbour, vector<Buffer> dgram );
+
+  // Take the oldest datagram waiting for `neighbour`
+  vector<Buffer> dequeue_pending( Neighbour& neighbour );
+
+  // Count a datagram that will never be sent
+  void drop_pending( const vector<Buffer>& dgram );
+
+  // Set `neighbour`'s deadline to `lifetime` ms from now (timers are only re-armed when they fire, so that
+  // each neighbour has at most one pending timer)
+  void arm( uint32_t ip_address, Neighbour& neighbour, uint32_t lifetime );
+
+  // A neighbour's deadline may have passed
+  void expire( uint32_t ip_address );
+
+  // Ask a STALE or PROBE neighbour to confirm its address (unless it was just asked)
+  void probe( uint32_t ip_address, Neighbour& neighbour );
 
   ARPMessage make_arp( const uint16_t opcode,
                        const EthernetAddress sender_ethernet_address,
@@ -77,6 +203,31 @@ private:
                             const uint16_t type,
                             vector<Buffer> payload );
 
+  // Queue a frame carrying an IPv4 datagram for transmission
+  void send_ipv4_frame( EthernetFrame frame );
+
+  // Count frames handed to the link
+  void count_sent( std::span<const EthernetFrame> frames );
+
+  // Send a serialized datagram (shared by both send_datagram overloads), fragmenting it if it is too big
+  void send_serialized( vector<Buffer> dgram, uint32_t next_hop );
+
+  // Send a serialized datagram that fits the MTU
+  void send_fitting( vector<Buffer> dgram, uint32_t next_hop );
+
+  // Split a datagram larger than the MTU, and send the fragments
+  void send_fragmented( vector<Buffer> dgram, uint32_t next_hop );
+
+  // Pass a fragment addressed to this interface to the reassembler, returning the whole datagram once it is
+  // complete; any other datagram is returned as it is
+  std::optional<RawIPv4Datagram> reassemble( RawIPv4Datagram dgram );
+
+  // Parse the IPv4 datagram in an accepted frame (reassembling it first if it is a fragment)
+  std::optional<InternetDatagram> parse_datagram( const vector<Buffer>& payload );
+
+  // Handle an incoming frame's ARP or destination filtering; true if it is an IPv4 datagram for this interface
+  bool accept_frame( const EthernetFrame& frame );
+
 public:
   // Construct a network interface with given Ethernet (network-access-layer) and IP (internet-layer)
   // addresses
@@ -85,6 +236,9 @@ public:
   // Access queue of Ethernet frames awaiting transmission
   std::optional<EthernetFrame> maybe_send();
 
+  // Move every frame awaiting transmission to the end of `out` (in order); returns how many
+  size_t drain_frames( std::vector<EthernetFrame>& out );
+
   // Sends an IPv4 datagram, encapsulated in an Ethernet frame (if it knows the Ethernet destination
   // address). Will need to use [ARP](\ref rfc::rfc826) to look up the Ethernet destination address
   // for the next hop.
@@ -92,12 +246,55 @@ public:
   // but please consider the frame sent as soon as it is generated.)
   void send_datagram( const InternetDatagram& dgram, const Address& next_hop );
 
+  // Sends a datagram as the buffers it arrived in, without re-serializing it (for forwarding).
+  // next_hop is a raw 32-bit IP address, as from Address::ipv4_numeric().
+  void send_datagram( RawIPv4Datagram dgram, uint32_t next_hop );
+
+  // Sends many datagrams, taking their buffers. Consecutive datagrams to the same next hop share one lookup.
+  void send_datagrams( std::span<OutboundDatagram> dgrams );
+
   // Receives an Ethernet frame and responds appropriately.
   // If type is IPv4, returns the datagram.
   // If type is ARP request, learn a mapping from the "sender" fields, and send an ARP reply.
   // If type is ARP reply, learn a mapping from the "sender" fields.
   std::optional<InternetDatagram> recv_frame( const EthernetFrame& frame );
 
+  // Like recv_frame, but returns an IPv4 datagram unparsed (after checking its header), in the frame's buffers.
+  // A frame passed by rvalue hands its buffers over, so that the datagram's header may be rewritten in place.
+  std::optional<RawIPv4Datagram> recv_raw_frame( EthernetFrame frame );
+
+  // Receives many frames, as recv_frame and recv_raw_frame do, appending the datagrams for this interface
+  // to `out`. The frames' buffers are handed over (as to recv_raw_frame by rvalue), leaving the frames empty.
+  void recv_frames( std::span<EthernetFrame> frames, std::vector<InternetDatagram>& out );
+  void recv_raw_frames( std::span<EthernetFrame> frames, std::vector<RawIPv4Datagram>& out );
+
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
+
+  const PendingStats& pending_stats() const { return pending_stats_; }
+  const TrafficStats& traffic_stats() const { return traffic_stats_; }
+
+  // The largest datagram (headers included) sent without fragmenting it. A datagram with the don't-fragment
+  // flag that is larger is dropped (a router reports it to the sender, for path MTU discovery).
+  size_t mtu() const { return mtu_; }
+
+  // Set the MTU, from MIN_MTU to JUMBO_MTU
+  void set_mtu( size_t mtu );
+
+  const Address& ip_address() const { return ip_address_; }
+
+  // Manage the output queue with FQ-CoDel (RFC 8290): frames are queued per flow (by 5-tuple hash), flows take
+  // turns, and a flow whose frames wait longer than config.target ms for config.interval ms has frames dropped,
+  // or marked Congestion Experienced if config.ecn is set and the datagram is ECN-capable. Without it, the output
+  // queue is an unbounded FIFO.
+  void enable_fq_codel( const OutputQueue::Config& config = {} );
+
+  // Counters of the FQ-CoDel output queue (all zero if it is not enabled)
+  OutputQueue::Stats output_queue_stats() const
+  {
+    return output_queue_.has_value() ? output_queue_->stats() : OutputQueue::Stats {};
+  }
+
+  const FragmentStats& fragment_stats() const { return fragment_stats_; }
+  const IPv4Reassembler::Stats& reassembly_stats() const { return reassembler_.stats(); }
 };
@@ -1,10 +1,23 @@
 #include "router.hh"
+#include "icmp_message.hh"
 
+#include <algorithm>
 #include <iostream>
-#include <limits>
+#include <stdexcept>
 
 using namespace std;
 
+namespace {
+
+void check_multipath( const vector<NextHop>& next_hops )
+{
+  if ( ranges::none_of( next_hops, []( const NextHop& hop ) { return hop.weight_ > 0; } ) ) {
+    throw runtime_error( "multipath route needs a next hop with nonzero weight" );
+  }
+}
+
+} // namespace
+
 // route_prefix: The "up-to-32-bit" IPv4 address prefix to match the datagram's destination address against
 // prefix_length: For this route to be applicable, how many high-order (most-significant) bits of
 //    the route_prefix will need to match the corresponding bits of the datagram's destination address?
@@ -25,55 +38,475 @@ void Router::add_route( uint32_t route_prefix,
   entry.prefix_length_ = prefix_length;
   entry.next_hop_ = next_hop;
   entry.interface_num_ = interface_num;
-  routing_table_.push_back( entry );
+
+  const lock_guard lock { staged_mutex_ };
+  staged_.push_back( entry );
+  has_staged_ = true;
 }
 
-void Router::route_one_datagram( InternetDatagram& dgram )
+// next_hops: The equal-cost paths of the route, with their weights.
+void Router::add_route( uint32_t route_prefix, uint8_t prefix_length, vector<NextHop> next_hops )
 {
-  // Check TTL.
-  if ( dgram.header.ttl <= 1 )
-    return;
+  check_multipath( next_hops );
+
+  cerr << "DEBUG: adding multipath route " << Address::from_ipv4_numeric( route_prefix ).ip() << "/"
+       << static_cast<int>( prefix_length ) << " =>";
+  for ( const auto& hop : next_hops ) {
+    cerr << " " << ( hop.next_hop_.has_value() ? hop.next_hop_->ip() : "(direct)" ) << " on interface "
+         << hop.interface_num_ << " (weight " << hop.weight_ << ")";
+  }
+  cerr << "\n";
+
+  TableEntry entry;
+  entry.route_prefix_ = route_prefix;
+  entry.prefix_length_ = prefix_length;
+  entry.multipath_ = std::move( next_hops );
+
+  const lock_guard lock { staged_mutex_ };
+  staged_.push_back( std::move( entry ) );
+  has_staged_ = true;
+}
 
-  // Longest prefix match.
-  uint32_t destination = dgram.header.dst;
-  int match_idx = -1;
-  int max_matched_len = -1;
-  for ( size_t i = 0; i < routing_table_.size(); i++ ) {
-    auto mask = routing_table_[i].prefix_length_ == 0
-                  ? 0
-                  : numeric_limits<int>::min() >> ( routing_table_[i].prefix_length_ - 1 );
-    if ( ( destination & mask ) == routing_table_[i].route_prefix_
-         && max_matched_len < routing_table_[i].prefix_length_ ) {
-      match_idx = i;
-      max_matched_len = routing_table_[i].prefix_length_;
+void Router::add_routes( const vector<TableEntry>& entries )
+{
+  for ( const auto& entry : entries ) {
+    if ( not entry.multipath_.empty() ) {
+      check_multipath( entry.multipath_ );
     }
   }
 
-  // If no match, drop the datagram.
-  if ( match_idx == -1 )
+  {
+    const lock_guard lock { staged_mutex_ };
+    staged_.insert( staged_.end(), entries.begin(), entries.end() );
+    has_staged_ = true;
+  }
+  publish_staged();
+}
+
+void Router::publish_staged()
+{
+  const lock_guard lock { staged_mutex_ };
+  if ( staged_.empty() ) {
     return;
+  }
 
-  // Decrement TTL and update checksum.
-  dgram.header.ttl -= 1;
-  dgram.header.compute_checksum();
+  routing_table_.update( [&]( const RouteTable& current ) {
+    auto next = make_unique<RouteTable>( current );
+    next->generation = current.generation + 1;
+    for ( const auto& entry : staged_ ) {
+      const auto first_path = static_cast<uint32_t>( next->paths.size() );
+      const uint32_t mask = entry.prefix_length_ == 0 ? 0 : UINT32_MAX << ( 32 - entry.prefix_length_ );
+      const uint64_t key = uint64_t { entry.route_prefix_ & mask } << 8 | entry.prefix_length_;
+      auto [it, added] = route_positions_.try_emplace( key, next->entries.size() );
 
-  // send the datagram
-  auto next_hop = routing_table_[match_idx].next_hop_;
-  auto interface_num = routing_table_[match_idx].interface_num_;
-  if ( next_hop.has_value() ) {
-    interfaces_[interface_num].send_datagram( dgram, next_hop.value() );
-  } else {
-    interfaces_[interface_num].send_datagram( dgram, Address::from_ipv4_numeric( destination ) );
+      if ( entry.multipath_.empty() ) {
+        // (A route for a prefix that already has one is kept, but the first one is used.)
+        const uint32_t next_hop = entry.next_hop_.has_value() ? entry.next_hop_->ipv4_numeric() : 0;
+        const Path path { next_hop, static_cast<uint32_t>( entry.interface_num_ ) };
+        if ( free_paths_.empty() ) {
+          next->routes.push_back( { first_path, 1, entry.traffic_class_ } );
+          next->paths.push_back( path );
+        } else {
+          next->routes.push_back( { free_paths_.back(), 1, entry.traffic_class_ } );
+          next->paths.mutable_at( free_paths_.back() ) = path;
+          free_paths_.pop_back();
+        }
+        next->lpm.insert( entry.route_prefix_, entry.prefix_length_, next->entries.size() );
+        next->entries.push_back( entry );
+        continue;
+      }
+
+      // A multipath route: add a new one, or change the next hops of the route for its prefix (giving it
+      // buckets, if it had a single path)
+      if ( added ) {
+        next->routes.push_back( {} );
+        next->lpm.insert( entry.route_prefix_, entry.prefix_length_, next->entries.size() );
+        next->entries.push_back( entry );
+      } else {
+        next->entries.mutable_at( it->second ) = entry;
+      }
+      Route& route = next->routes.mutable_at( it->second );
+      route.traffic_class = entry.traffic_class_;
+      if ( route.path_count != MULTIPATH_BUCKETS ) {
+        if ( route.path_count == 1 ) {
+          free_paths_.push_back( route.first_path ); // (older versions of the table still have their own copy)
+        }
+        route.first_path = first_path;
+        route.path_count = MULTIPATH_BUCKETS;
+        for ( size_t b = 0; b < MULTIPATH_BUCKETS; b++ ) {
+          next->paths.push_back( { 0, UINT32_MAX } );
+        }
+      }
+
+      // (The buckets are reassigned in a copy, and only those that change are written back.)
+      vector<Path> buckets;
+      for ( size_t b = 0; b < route.path_count; b++ ) {
+        buckets.push_back( next->paths[route.first_path + b] );
+      }
+      assign_buckets( buckets, entry.multipath_ );
+      for ( size_t b = 0; b < route.path_count; b++ ) {
+        if ( buckets[b] != next->paths[route.first_path + b] ) {
+          next->paths.mutable_at( route.first_path + b ) = buckets[b];
+        }
+      }
+    }
+    return next;
+  } );
+  staged_.clear();
+  has_staged_ = false;
+}
+
+void Router::assign_buckets( span<Path> buckets, const vector<NextHop>& next_hops )
+{
+  // Each next hop's share of the buckets; the remainder goes to the first next hops
+  vector<Path> paths;
+  vector<size_t> shares;
+  uint64_t total_weight = 0;
+  for ( const auto& hop : next_hops ) {
+    paths.push_back( { hop.next_hop_.has_value() ? hop.next_hop_->ipv4_numeric() : 0,
+                       static_cast<uint32_t>( hop.interface_num_ ) } );
+    total_weight += hop.weight_;
+  }
+  size_t unassigned = buckets.size();
+  for ( const auto& hop : next_hops ) {
+    shares.push_back( buckets.size() * hop.weight_ / total_weight );
+    unassigned -= shares.back();
+  }
+  for ( size_t i = 0; unassigned > 0; i = ( i + 1 ) % shares.size() ) {
+    if ( next_hops[i].weight_ > 0 ) {
+      shares[i]++;
+      unassigned--;
+    }
+  }
+
+  // Keep the buckets whose path is still a next hop with share to spare, then fill the others
+  vector<size_t> free_buckets;
+  for ( size_t b = 0; b < buckets.size(); b++ ) {
+    bool kept = false;
+    for ( size_t i = 0; i < paths.size() and not kept; i++ ) {
+      if ( buckets[b] == paths[i] and shares[i] > 0 ) {
+        shares[i]--;
+        kept = true;
+      }
+    }
+    if ( not kept ) {
+      free_buckets.push_back( b );
+    }
+  }
+  size_t i = 0;
+  for ( const size_t b : free_buckets ) {
+    while ( shares[i] == 0 ) {
+      i++;
+    }
+    buckets[b] = paths[i];
+    shares[i]--;
+  }
+}
+
+void Router::forward_batch( const RouteTable& table,
+                            FlowCache& cache,
+                            ThreadCounters& counters,
+                            vector<RawIPv4Datagram>& batch,
+                            vector<Forwarded>& out )
+{
+  if ( counters.route_hits.size() < table.entries.size() ) {
+    counters.route_hits.resize( table.entries.size() );
+  }
+
+  for ( auto& dgram : batch ) {
+    // Check TTL.
+    if ( dgram.ttl() <= 1 ) {
+      counters.counters.dropped_ttl++;
+      continue;
+    }
+
+    // Flow cache, then longest prefix match (if no match, drop the datagram).
+    const uint32_t destination = dgram.dst();
+    auto route = cache.find( destination, table.generation );
+    if ( !route.has_value() ) {
+      route = table.lpm.lookup( destination );
+      if ( !route.has_value() ) {
+        counters.counters.dropped_no_route++;
+        continue;
+      }
+      cache.insert( destination, table.generation, *route );
+    }
+
+    // Pick the path (by flow hash, if the route has several).
+    const Path& path = table.path( *route, dgram );
+
+    // Decrement TTL and update checksum (incrementally, on the raw header).
+    dgram.decrement_ttl();
+    counters.counters.routed++;
+    counters.route_hits[*route]++;
+
+    out.push_back( { std::move( dgram ),
+                     path.next_hop ? path.next_hop : destination,
+                     path.interface_num,
+                     table.routes[*route].traffic_class } );
+  }
+  batch.clear();
+}
+
+void Router::enqueue( Egress& egress, ThreadCounters& counters, vector<Forwarded>& forwarded ) const
+{
+  if ( egress.queues.size() < interfaces_.size() ) {
+    egress.queues.resize( interfaces_.size() );
+  }
+  for ( auto& f : forwarded ) {
+    const auto& interface = interfaces_.at( f.interface_num );
+    if ( f.dgram.total_length() > interface.mtu() and f.dgram.dont_fragment() ) {
+      counters.counters.dropped_too_big++;
+      if ( may_report_icmp_error( f.dgram ) ) {
+        counters.counters.icmp_errors++;
+        egress.errors.push_back( make_fragmentation_needed(
+          f.dgram, interface.ip_address().ipv4_numeric(), static_cast<uint16_t>( interface.mtu() ) ) );
+      }
+      continue;
+    }
+    egress.queues[f.interface_num].push_back( std::move( f ) );
+  }
+  forwarded.clear();
+}
+
+void Router::send_errors( const RouteTable& table, Egress& egress, ThreadCounters& counters ) const
+{
+  // (Errors may be fragmented, so routing them makes no further errors.)
+  vector<Forwarded> forwarded;
+  for ( auto& error : egress.errors ) {
+    const uint32_t destination = error.dst();
+    const auto route = table.lpm.lookup( destination );
+    if ( not route.has_value() ) {
+      continue;
+    }
+    const Path& path = table.path( *route, error );
+    counters.counters.icmp_errors_sent++;
+    forwarded.push_back( { std::move( error ),
+                           path.next_hop ? path.next_hop : destination,
+                           path.interface_num,
+                           table.routes[*route].traffic_class } );
+  }
+  egress.errors.clear();
+  enqueue( egress, counters, forwarded );
+}
+
+void Router::flush_egress( Egress& egress )
+{
+  for ( size_t i = 0; i < egress.queues.size(); i++ ) {
+    if ( egress.queues[i].empty() ) {
+      continue;
+    }
+    const lock_guard lock { egress_mutexes_[i] };
+    auto& interface = interfaces_[i];
+    for ( auto& f : egress.queues[i] ) {
+      if ( auto dgram = interface.shape( { std::move( f.dgram ), f.next_hop }, f.traffic_class ) ) {
+        egress.sending.push_back( std::move( *dgram ) );
+      }
+    }
+    interface.send_datagrams( egress.sending );
+    egress.sending.clear();
+    egress.queues[i].clear();
   }
 }
 
 void Router::route()
 {
+  if ( has_staged_ ) {
+    publish_staged();
+  }
+
+  if ( not workers_.empty() ) {
+    route_on_workers();
+    return;
+  }
+
   // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface.
+  const auto table = routing_table_.read( route_reader_ );
+  for ( auto& interface : interfaces_ ) {
+    while ( interface.receive_batch( batch_.in, BATCH_SIZE ) ) {
+      forward_batch( *table, route_cache_, route_counters_, batch_.in, batch_.out );
+      enqueue( egress_, route_counters_, batch_.out );
+    }
+  }
+  send_errors( *table, egress_, route_counters_ );
+  flush_egress( egress_ );
+}
+
+bool Router::collect( Worker& worker )
+{
+  bool any = false;
+  while ( auto batch = worker.batches_out.pop() ) {
+    spare_batches_.push_back( std::move( *batch ) );
+    worker.in_flight--;
+    any = true;
+  }
+  return any;
+}
+
+void Router::submit( Worker& worker )
+{
+  while ( not worker.batches_in.push( std::move( worker.filling ) ) ) {
+    // (Collect from every worker, so that none is held up by a full ring of finished batches.)
+    const uint32_t ticket = worker.batches_out.ticket();
+    bool any = false;
+    for ( const auto& w : workers_ ) {
+      any |= collect( *w );
+    }
+    if ( not any ) {
+      worker.batches_out.wait( ticket );
+    }
+  }
+  worker.in_flight++;
+
+  if ( spare_batches_.empty() ) {
+    worker.filling = {};
+    worker.filling.in.reserve( BATCH_SIZE );
+  } else {
+    worker.filling = std::move( spare_batches_.back() );
+    spare_batches_.pop_back();
+  }
+}
+
+void Router::deal( vector<RawIPv4Datagram>& datagrams )
+{
+  for ( auto& dgram : datagrams ) {
+    const auto w = ( uint64_t { dgram.flow_hash() } * workers_.size() ) >> 32;
+    Worker& worker = *workers_[w];
+    worker.filling.in.push_back( std::move( dgram ) );
+    if ( worker.filling.in.size() == BATCH_SIZE ) {
+      submit( worker );
+    }
+  }
+  datagrams.clear();
+}
+
+void Router::route_on_workers()
+{
+  // (Only the interfaces' incoming queues are used here, so the workers may still be sending on them.)
   for ( auto& interface : interfaces_ ) {
-    optional<InternetDatagram> maybe_dgram;
-    while ( ( maybe_dgram = interface.maybe_receive() ) != nullopt ) {
-      route_one_datagram( maybe_dgram.value() );
+    while ( interface.receive_batch( batch_.in, BATCH_SIZE ) ) {
+      deal( batch_.in );
     }
   }
+  for ( const auto& worker : workers_ ) {
+    if ( not worker->filling.in.empty() ) {
+      submit( *worker );
+    }
+  }
+
+  // Take back the batches already finished, without waiting for the others
+  for ( const auto& worker : workers_ ) {
+    collect( *worker );
+  }
+}
+
+void Router::finish_routing()
+{
+  for ( const auto& worker : workers_ ) {
+    while ( worker->in_flight > 0 ) {
+      const uint32_t ticket = worker->batches_out.ticket();
+      if ( not collect( *worker ) ) {
+        worker->batches_out.wait( ticket );
+      }
+    }
+  }
+}
+
+void Router::set_worker_threads( const size_t count )
+{
+  finish_routing();
+  for ( const auto& worker : workers_ ) {
+    worker->thread = {}; // stops and joins the worker
+    routing_table_.unregister_reader( worker->reader );
+    const auto stats = worker->cache.stats();
+    stopped_workers_stats_.hits += stats.hits;
+    stopped_workers_stats_.misses += stats.misses;
+    stopped_workers_counters_.add( worker->counters );
+  }
+  workers_.clear();
+
+  for ( size_t i = 0; i < count; i++ ) {
+    auto worker = make_unique<Worker>( routing_table_.register_reader() );
+    worker->thread = jthread( [this, &w = *worker]( const stop_token& stop ) {
+      const stop_callback wake_on_stop { stop, [&w] { w.batches_in.wake(); } };
+      while ( true ) {
+        const uint32_t ticket = w.batches_in.ticket();
+        if ( stop.stop_requested() ) {
+          return;
+        }
+        auto batch = w.batches_in.pop();
+        if ( not batch ) {
+          w.batches_in.wait( ticket );
+          continue;
+        }
+        {
+          const auto table = routing_table_.read( w.reader );
+          forward_batch( *table, w.cache, w.counters, batch->in, batch->out );
+          enqueue( w.egress, w.counters, batch->out );
+          if ( not w.egress.errors.empty() ) {
+            send_errors( *table, w.egress, w.counters );
+          }
+        }
+        flush_egress( w.egress );
+        while ( not w.batches_out.push( std::move( *batch ) ) and not stop.stop_requested() ) {
+          this_thread::yield(); // (route() is collecting finished batches, so this is brief)
+        }
+      }
+    } );
+    workers_.push_back( std::move( worker ) );
+  }
+}
+
+Router::FlowCacheStats Router::flow_cache_stats() const
+{
+  FlowCacheStats total = stopped_workers_stats_;
+  const auto add = [&total]( const FlowCache& cache ) {
+    const auto stats = cache.stats();
+    total.hits += stats.hits;
+    total.misses += stats.misses;
+  };
+
+  add( route_cache_ );
+  for ( const auto& worker : workers_ ) {
+    add( worker->cache );
+  }
+  return total;
+}
+
+void Router::ThreadCounters::add( const ThreadCounters& other )
+{
+  counters.routed += other.counters.routed;
+  counters.dropped_ttl += other.counters.dropped_ttl;
+  counters.dropped_no_route += other.counters.dropped_no_route;
+  counters.dropped_too_big += other.counters.dropped_too_big;
+  counters.icmp_errors += other.counters.icmp_errors;
+  counters.icmp_errors_sent += other.counters.icmp_errors_sent;
+  if ( route_hits.size() < other.route_hits.size() ) {
+    route_hits.resize( other.route_hits.size() );
+  }
+  for ( size_t i = 0; i < other.route_hits.size(); i++ ) {
+    route_hits[i] += other.route_hits[i];
+  }
+}
+
+Router::Snapshot Router::snapshot()
+{
+  finish_routing();
+  ThreadCounters total = stopped_workers_counters_;
+  total.add( route_counters_ );
+  for ( const auto& worker : workers_ ) {
+    total.add( worker->counters );
+  }
+
+  Snapshot ret { total.counters, {}, {} };
+  const auto table = routing_table_.read( route_reader_ );
+  total.route_hits.resize( table->entries.size() );
+  for ( size_t i = 0; i < table->entries.size(); i++ ) {
+    const auto& entry = table->entries[i];
+    ret.routes.push_back( { entry.route_prefix_, entry.prefix_length_, total.route_hits[i] } );
+  }
+  for ( const auto& interface : interfaces_ ) {
+    ret.interfaces.push_back( interface.traffic_stats() );
+  }
+  return ret;
 }
@@ -1,9 +1,24 @@
 #pragma once
 
+#include "cow_vector.hh"
+#include "lpm_trie.hh"
 #include "network_interface.hh"
+#include "rcu.hh"
+#include "spsc_ring.hh"
+#include "token_bucket_shaper.hh"
 
+#include <array>
+#include <atomic>
+#include <bit>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 // A wrapper for NetworkInterface that makes the host-side
 // interface asynchronous: instead of returning received datagrams
@@ -12,7 +27,15 @@
 // implementation of NetworkInterface.
 class AsyncNetworkInterface : public NetworkInterface
 {
-  std::queue<InternetDatagram> datagrams_in_ {};
+public:
+  // Shaper of the datagrams the router sends out of the interface
+  using Shaper = TokenBucketShaper<OutboundDatagram>;
+
+private:
+  std::queue<RawIPv4Datagram> datagrams_in_ {};
+
+  std::optional<Shaper> shaper_ {};
+  std::vector<OutboundDatagram> released_ {}; // datagrams released by the shaper, to send together
 
 public:
   using NetworkInterface::NetworkInterface;
@@ -26,26 +49,126 @@ public:
   // - If type is ARP request, learn a mapping from the "sender" fields, and send an ARP reply.
   // - If type is ARP reply, learn a mapping from the "target" fields.
   //
-  // \param[in] frame the incoming Ethernet frame
-  void recv_frame( const EthernetFrame& frame )
+  // \param[in] frame the incoming Ethernet frame (pass it by rvalue if it is not needed afterwards: the router
+  // can then decrement the TTL in the frame's own buffer, instead of copying the header)
+  void recv_frame( EthernetFrame frame )
   {
-    auto optional_dgram = NetworkInterface::recv_frame( frame );
+    auto optional_dgram = NetworkInterface::recv_raw_frame( std::move( frame ) );
     if ( optional_dgram.has_value() ) {
       datagrams_in_.push( std::move( optional_dgram.value() ) );
     }
   };
 
+  // Receives many frames, as recv_frame does when they are passed by rvalue (leaving the frames empty)
+  void recv_frames( std::span<EthernetFrame> frames )
+  {
+    for ( auto& frame : frames ) {
+      recv_frame( std::move( frame ) );
+    }
+  }
+
   // Access queue of Internet datagrams that have been received
   std::optional<InternetDatagram> maybe_receive()
+  {
+    while ( auto raw = maybe_receive_raw() ) {
+      InternetDatagram datagram;
+      if ( parse( datagram, raw->buffers ) ) {
+        return datagram;
+      }
+    }
+    return {};
+  }
+
+  // Same, but without parsing the datagrams (for forwarding them)
+  std::optional<RawIPv4Datagram> maybe_receive_raw()
   {
     if ( datagrams_in_.empty() ) {
       return {};
     }
 
-    InternetDatagram datagram = std::move( datagrams_in_.front() );
+    RawIPv4Datagram datagram = std::move( datagrams_in_.front() );
     datagrams_in_.pop();
     return datagram;
   }
+
+  // Move up to `max` received datagrams (without parsing them) to the end of `out`; returns how many
+  size_t receive_batch( std::vector<RawIPv4Datagram>& out, size_t max )
+  {
+    size_t count = 0;
+    for ( ; count < max and not datagrams_in_.empty(); ++count ) {
+      out.push_back( std::move( datagrams_in_.front() ) );
+      datagrams_in_.pop();
+    }
+    return count;
+  }
+
+  // Shape the router's traffic out of this interface with token buckets: one for the whole interface, and one
+  // per class (each datagram's class is set by its route, or else chosen by its DSCP). Datagrams wait for their
+  // buckets in their class's queue, managed by FQ-CoDel as config.queue says (with ECN, datagrams are marked
+  // rather than dropped where they allow it), and are released by tick(). Datagrams queued by a previous shaper
+  // are sent.
+  void set_shaper( const Shaper::Config& config )
+  {
+    clear_shaper();
+    shaper_.emplace( config );
+  }
+
+  // Stop shaping, sending whatever was waiting
+  void clear_shaper()
+  {
+    if ( shaper_.has_value() ) {
+      shaper_->drain( [this]( OutboundDatagram&& dgram ) { released_.push_back( std::move( dgram ) ); },
+                      mark_congestion );
+      shaper_.reset();
+      send_released();
+    }
+  }
+
+  // Pass a datagram to the shaper, in class `traffic_class` (if set, else by its DSCP). Returns the datagram if it
+  // may be sent now (always, if the interface is not shaped).
+  std::optional<OutboundDatagram> shape( OutboundDatagram dgram, std::optional<uint8_t> traffic_class )
+  {
+    if ( not shaper_.has_value() ) {
+      return dgram;
+    }
+    const size_t size = dgram.dgram.size();
+    const size_t c = traffic_class.has_value() ? *traffic_class : shaper_->classify( dgram.dgram.tos() >> 2 );
+    const uint32_t flow_hash = dgram.dgram.flow_hash();
+    return shaper_->submit( std::move( dgram ), c, size, flow_hash );
+  }
+
+  // Called periodically when time elapses: also sends the datagrams the shaper now allows
+  void tick( size_t ms_since_last_tick )
+  {
+    if ( shaper_.has_value() ) {
+      shaper_->tick(
+        ms_since_last_tick,
+        [this]( OutboundDatagram&& dgram ) { released_.push_back( std::move( dgram ) ); },
+        mark_congestion );
+      send_released();
+    }
+    NetworkInterface::tick( ms_since_last_tick );
+  }
+
+  // Counters of the shaper's classes (nullptr if the interface is not shaped)
+  const Shaper* shaper() const { return shaper_.has_value() ? &*shaper_ : nullptr; }
+
+private:
+  static bool mark_congestion( OutboundDatagram& dgram ) { return dgram.dgram.mark_congestion_experienced(); }
+
+  void send_released()
+  {
+    send_datagrams( released_ );
+    released_.clear();
+  }
+};
+
+// One of the equal-cost paths of a multipath route, with its share of the traffic (relative to the others)
+struct NextHop
+{
+  optional<Address> next_hop_ {};
+  size_t interface_num_ {};
+  uint32_t weight_ { 1 };
 };
 
 struct TableEntry
@@ -54,18 +177,274 @@ struct TableEntry
   uint8_t prefix_length_ {};
   optional<Address> next_hop_ {};
   size_t interface_num_ {};
+  std::vector<NextHop> multipath_ {}; // if not empty, the route's paths (next_hop_ and interface_num_ are unused)
+  std::optional<uint8_t> traffic_class_ {}; // shaping class on a shaped egress interface (if unset, by DSCP)
 };
 
 // A router that has multiple network interfaces and
 // performs longest-prefix-match routing between them.
 class Router
 {
+public:
+  // Most datagrams taken from one interface at a time
+  static constexpr size_t BATCH_SIZE = 64;
+
+  // Flows are hashed to this many buckets of a multipath route, each of which names one of its paths
+  static constexpr size_t MULTIPATH_BUCKETS = 256;
+
+  // A datagram whose route has been looked up (and TTL decremented), on its way to an egress interface
+  struct Forwarded
+  {
+    RawIPv4Datagram dgram;
+    uint32_t next_hop;
+    size_t interface_num;
+    std::optional<uint8_t> traffic_class;
+  };
+
+  // Flow cache hits and misses, summed over the forwarding threads
+  struct FlowCacheStats
+  {
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  // What became of the datagrams the router received
+  struct Counters
+  {
+    uint64_t routed {};           // a route was found
+    uint64_t dropped_ttl {};      // TTL expired
+    uint64_t dropped_no_route {}; // no route matched
+    uint64_t dropped_too_big {};  // routed, but larger than the egress link's MTU, with the don't-fragment flag
+    uint64_t icmp_errors {};      // ICMP errors made for sources
+    uint64_t icmp_errors_sent {}; // of those, the ones a route was found for
+  };
+
+  // How many datagrams a route has forwarded
+  struct RouteHits
+  {
+    uint32_t route_prefix;
+    uint8_t prefix_length;
+    uint64_t hits;
+  };
+
+  // The router's counters (summed over the forwarding threads) and its interfaces'
+  struct Snapshot
+  {
+    Counters counters {};
+    std::vector<RouteHits> routes {}; // in the order the routes were added
+    std::vector<NetworkInterface::TrafficStats> interfaces {};
+  };
+
+private:
+  // A direct-mapped cache of recent lookups, from destination address to route (a position in the routing
+  // table). Each forwarding thread has its own. Entries are tagged with the generation of the routing table they
+  // were looked up in, so publishing a new table invalidates them all.
+  class FlowCache
+  {
+    static constexpr size_t SIZE = 1024;
+
+    struct Entry
+    {
+      uint32_t dst {};
+      uint32_t generation {}; // zero for an empty entry
+      uint32_t route {};
+    };
+
+    std::array<Entry, SIZE> entries_ {};
+    std::atomic<uint64_t> hits_ {};
+    std::atomic<uint64_t> misses_ {};
+
+    static size_t index( uint32_t dst ) { return ( dst * 0x9e3779b1U ) >> ( 32 - std::countr_zero( SIZE ) ); }
+
+    // Counters are only written by the owning thread, so they need no read-modify-write
+    static void count( std::atomic<uint64_t>& counter )
+    {
+      counter.store( counter.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    }
+
+  public:
+    // The cached route for `dst`, if it was looked up in this generation of the table
+    std::optional<uint32_t> find( uint32_t dst, uint32_t generation )
+    {
+      const Entry& e = entries_[index( dst )];
+      if ( e.generation == generation and e.dst == dst ) {
+        count( hits_ );
+        return e.route;
+      }
+      count( misses_ );
+      return {};
+    }
+
+    void insert( uint32_t dst, uint32_t generation, uint32_t route )
+    {
+      entries_[index( dst )] = { dst, generation, route };
+    }
+
+    FlowCacheStats stats() const
+    {
+      return { hits_.load( std::memory_order_relaxed ), misses_.load( std::memory_order_relaxed ) };
+    }
+  };
+
+  // Counters written by one forwarding thread, on cache lines of their own so that threads do not contend for them
+  struct alignas( 64 ) ThreadCounters
+  {
+    Counters counters {};
+    std::vector<uint64_t> route_hits {}; // by position in the routing table (grown as routes are added)
+
+    void add( const ThreadCounters& other );
+  };
+
+  // Datagrams on their way through a forwarding thread, and back: `in` to look up, and `out` the results. The
+  // vectors travel both ways through the worker's rings and are reused, keeping their capacity.
+  struct Batch
+  {
+    std::vector<RawIPv4Datagram> in {};
+    std::vector<Forwarded> out {};
+  };
+
+  // Forwarded datagrams on their way out, queued by egress interface, and the ICMP errors to route back to their
+  // sources. Each forwarding thread has its own.
+  struct Egress
+  {
+    std::vector<std::vector<Forwarded>> queues {};               // by egress interface
+    std::vector<NetworkInterface::OutboundDatagram> sending {}; // passed by an interface's shaper, to send
+    std::vector<RawIPv4Datagram> errors {};
+  };
+
+  // A forwarding thread, fed batches by the thread that calls route(). It looks up their routes and sends them on
+  // their egress interfaces, then returns the emptied batch (to be reused).
+  struct Worker
+  {
+    size_t reader; // the worker's slot for reading the routing table
+    FlowCache cache {};
+    ThreadCounters counters {};
+    Egress egress {};
+    SPSCRing<Batch> batches_in { 16 };
+    SPSCRing<Batch> batches_out { 16 };
+    Batch filling {};       // datagrams dealt to the worker, not yet sent (used by route() only)
+    size_t in_flight {};    // batches sent, and not yet returned (used by route() only)
+    std::jthread thread {}; // last, so that it is joined before the rings are destroyed
+  };
+
   // The router's collection of network interfaces
   std::vector<AsyncNetworkInterface> interfaces_ {};
 
-  vector<TableEntry> routing_table_ {};
+  // For each interface, held while a forwarding thread shapes and sends datagrams on it
+  std::deque<std::mutex> egress_mutexes_ {};
+
+  // A next hop resolved for forwarding
+  struct Path
+  {
+    uint32_t next_hop;      // raw IP address, or zero to send to the datagram's own destination
+    uint32_t interface_num; // UINT32_MAX for an unassigned multipath bucket
+
+    bool operator==( const Path& other ) const = default;
+  };
+
+  // How to forward along one route: its resolved paths in the table's `paths` (first position, and count: one,
+  // or MULTIPATH_BUCKETS), and its shaping class
+  struct Route
+  {
+    uint32_t first_path {};
+    uint32_t path_count {};
+    std::optional<uint8_t> traffic_class {};
+  };
+
+  // One version of the routing table: the routes, and a longest-prefix-match index from destination
+  // address to position in `entries`. Versions share what they have in common (see CowVector and LPMTrie), so
+  // publishing a version costs about what it changes.
+  struct RouteTable
+  {
+    CowVector<TableEntry, 256> entries {};
+    CowVector<Route> routes {}; // for each entry
+    CowVector<Path> paths {};
 
-  void route_one_datagram( InternetDatagram& dgram );
+    LPMTrie lpm {};
+    uint32_t generation { 1 }; // incremented with each new version
+
+    // The path of `route` (an entry's position) for `dgram`: by flow hash, if the route has several
+    const Path& path( uint32_t route, const RawIPv4Datagram& dgram ) const
+    {
+      const Route& r = routes[route];
+      return paths[r.first_path + ( r.path_count > 1 ? dgram.flow_hash() % r.path_count : 0 )];
+    }
+  };
+
+  // Share `buckets` between `next_hops` in proportion to their weights. A bucket keeps its path if that is
+  // still a next hop with buckets to spare, so that flows hashed to it are not moved (resilient hashing).
+  static void assign_buckets( std::span<Path> buckets, const std::vector<NextHop>& next_hops );
+
+  // The current routing table. Forwarding reads it without locks, while adding routes publishes a new version
+  // (so routes can change while datagrams are being forwarded on other threads).
+  RCUPointer<RouteTable> routing_table_ { std::make_unique<const RouteTable>() };
+
+  // Reader slot and flow cache used by route() itself
+  size_t route_reader_ { routing_table_.register_reader() };
+  FlowCache route_cache_ {};
+
+  // Counters of route() itself (which also counts what happens to datagrams after their lookup)
+  ThreadCounters route_counters_ {};
+
+  // Flow cache counts and counters of workers that have been stopped
+  FlowCacheStats stopped_workers_stats_ {};
+  ThreadCounters stopped_workers_counters_ {};
+
+  // Routes added but not yet published (so that adding routes one at a time does not copy the table each time)
+  std::mutex staged_mutex_ {};
+  std::vector<TableEntry> staged_ {};
+  std::atomic<bool> has_staged_ {};
+
+  // Position in the routing table of the route (the first one added) for each masked prefix and length, so that
+  // a multipath route added for it can replace it (guarded by staged_mutex_)
+  std::unordered_map<uint64_t, uint32_t> route_positions_ {};
+
+  // Positions in `paths` left unused by single-path routes that a multipath route replaced, for later single-path
+  // routes to reuse (guarded by staged_mutex_)
+  std::vector<uint32_t> free_paths_ {};
+
+  // Publish the staged routes as a new version of the routing table
+  void publish_staged();
+
+  // Egress queues of route() itself
+  Egress egress_ {};
+
+  std::vector<std::unique_ptr<Worker>> workers_ {};
+
+  // Batches returned by the workers, to be filled again; and the batch route() uses without workers
+  std::vector<Batch> spare_batches_ {};
+  Batch batch_ {};
+
+  // Deal `datagrams` to the workers by flow hash, sending a worker its batch once it is full
+  void deal( std::vector<RawIPv4Datagram>& datagrams );
+
+  // Send a worker the batch it has been dealt, first collecting results if its ring is full
+  void submit( Worker& worker );
+
+  // Take back the batches a worker has finished, to reuse; returns whether there were any
+  bool collect( Worker& worker );
+
+  // Look up the route of every datagram in `batch`, and append those to forward (TTL decremented) to `out`.
+  // Only reads `table`, so it may run on a worker thread.
+  static void forward_batch( const RouteTable& table,
+                             FlowCache& cache,
+                             ThreadCounters& counters,
+                             std::vector<RawIPv4Datagram>& batch,
+                             std::vector<Forwarded>& out );
+
+  // Move forwarded datagrams to their egress queues (except those too big for the egress link, which may not be
+  // fragmented: they are dropped, and an ICMP error telling their sources the link's MTU is queued)
+  void enqueue( Egress& egress, ThreadCounters& counters, std::vector<Forwarded>& forwarded ) const;
+
+  // Route the queued ICMP errors (the router's own datagrams, so they are only looked up: their TTL is left
+  // alone, and they count as icmp_errors_sent instead of routed)
+  void send_errors( const RouteTable& table, Egress& egress, ThreadCounters& counters ) const;
+
+  // Pass everything in the egress queues to the interfaces' shapers, and send what they allow. Each interface is
+  // locked while it is being sent on, so forwarding threads can share it.
+  void flush_egress( Egress& egress );
+
+  void route_on_workers();
 
 public:
   // Add an interface to the router
@@ -73,24 +452,64 @@ public:
   // returns the index of the interface after it has been added to the router
   size_t add_interface( AsyncNetworkInterface&& interface )
   {
+    finish_routing();
     interfaces_.push_back( std::move( interface ) );
+    egress_mutexes_.emplace_back();
     return interfaces_.size() - 1;
   }
 
-  // Access an interface by index
-  AsyncNetworkInterface& interface( size_t N ) { return interfaces_.at( N ); }
+  // Access an interface by index (once the workers have sent what route() dealt them, so the interface is not
+  // in use; do not keep the reference across a call to route())
+  AsyncNetworkInterface& interface( size_t N )
+  {
+    finish_routing();
+    return interfaces_.at( N );
+  }
 
-  // Add a route (a forwarding rule)
+  // Add a route (a forwarding rule). It takes effect at the next call to route() or add_routes().
   void add_route( uint32_t route_prefix,
                   uint8_t prefix_length,
                   std::optional<Address> next_hop,
                   size_t interface_num );
 
+  // Add a multipath route: each flow (by hash of its 5-tuple) is sent on one of the next hops, in proportion
+  // to their weights. Adding a multipath route again for the same prefix changes its next hops, moving only
+  // the flows whose next hop was removed or had more than its share; adding one for the prefix of a single-path
+  // route replaces that route.
+  void add_route( uint32_t route_prefix, uint8_t prefix_length, std::vector<NextHop> next_hops );
+
+  // Add routes (and any added by add_route) as one new version of the routing table, which takes effect
+  // immediately. Publishing copies the parts of the table that change, so routes are best added together. Safe
+  // to call from any thread, including while route() runs: datagrams already being looked up see the old table.
+  void add_routes( const std::vector<TableEntry>& entries );
+
   // Route packets between the interfaces. For each interface, use the
   // maybe_receive() method to consume every incoming datagram and
   // send it on one of interfaces to the correct next hop. The router
   // chooses the outbound interface and next-hop as specified by the
   // route with the longest prefix_length that matches the datagram's
   // destination address.
+  // Datagrams are taken BATCH_SIZE at a time. With worker threads, they are
+  // dealt to the workers by flow hash (so each flow stays in order, and the
+  // traffic of one interface is spread over all the workers), which look them
+  // up and send them in parallel; route() returns once all are dealt, while
+  // the workers may still be sending (see finish_routing()).
   void route();
+
+  // Wait for the workers to send every datagram route() has dealt them. interface(), snapshot(), add_interface()
+  // and set_worker_threads() do this first.
+  void finish_routing();
+
+  // Forward on `count` worker threads (0, the default, does all the work on the thread that calls route()); idle
+  // workers sleep until they are dealt datagrams. The thread that calls route() only takes the datagrams from the
+  // interfaces and deals them: the workers look up their routes, make any ICMP errors, and pass them to the
+  // egress interfaces' shapers and send them. The router must not be moved while it has workers.
+  void set_worker_threads( size_t count );
+
+  // How often route lookups were answered by the flow caches
+  FlowCacheStats flow_cache_stats() const;
+
+  // The router's counters, and its interfaces'. Each forwarding thread keeps its own, which are summed here, so
+  // call this from the thread that calls route() (not while it runs).
+  Snapshot snapshot();
 };
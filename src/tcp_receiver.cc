@@ -18,7 +18,7 @@ void TCPReceiver::receive( TCPSenderMessage message, Reassembler& reassembler, W
     zero_point_ = message.seqno;
   }
 
-  string data = message.payload;
+  string data { string_view { message.payload } };
   uint64_t first_index = message.seqno.unwrap( zero_point_.value(), checkpoint ) - ( !message.SYN );
   reassembler.insert( first_index, data, message.FIN, inbound_stream );
 }
@@ -123,6 +123,10 @@ void TCPSender::push( Reader& outbound_stream )
   }
 
   // Send messages according to buffer and window size.
+  // (A reordered, stale ACK can shrink the window below what is already in flight.)
+  if ( sequence_numbers_in_flight() >= window_size_ ) {
+    return;
+  }
   uint64_t bytes_can_send = window_size_ - sequence_numbers_in_flight();
   uint64_t bytes_can_read = outbound_stream.bytes_buffered();
 
@@ -159,13 +163,11 @@ void TCPSender::push( Reader& outbound_stream )
 
   while ( bytes_to_send ) {
     TCPSenderMessage msg;
-    uint64_t payload_size
-      = bytes_to_send < TCPConfig::MAX_PAYLOAD_SIZE ? bytes_to_send : TCPConfig::MAX_PAYLOAD_SIZE;
-    string_view sv = outbound_stream.peek();
-    string payload = { sv.begin(), sv.end() };
+    uint64_t payload_size = bytes_to_send < max_payload_size_ ? bytes_to_send : max_payload_size_;
+    const string_view sv = outbound_stream.peek();
 
     msg.seqno = Wrap32::wrap( abs_seqno_, isn_ );
-    msg.payload = Buffer( payload.substr( 0, payload_size ) );
+    msg.payload = Buffer::copy_and_checksum( sv.substr( 0, payload_size ) );
     outbound_stream.pop( payload_size );
 
     // If stream is finished and there is enough space, send FIN.
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "byte_stream.hh"
+#include "tcp_config.hh"
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 #include <iostream>
@@ -12,6 +13,8 @@ class TCPSender
   uint64_t abs_ackno_ { 0 }; // Next byte to be acked.
   uint64_t abs_seqno_ { 0 }; // Next byte to be sent.
   uint16_t window_size_;     // Receiver's window size.
+  // Largest payload of a new segment (segments already sent keep their size).
+  size_t max_payload_size_ { TCPConfig::MAX_PAYLOAD_SIZE };
   // Messages that has been sent. (used for 'maybe_send').
   queue<TCPSenderMessage> messages_out_ {};
   // Messages that has been sent. (used for 'receive' and 'tick').
@@ -43,6 +46,10 @@ public:
   /* Time has passed by the given # of milliseconds since the last time the tick() method was called. */
   void tick( uint64_t ms_since_last_tick );
 
+  /* Limit the payload of new segments (e.g. to what fits the path MTU) */
+  void set_max_payload_size( size_t max_payload_size ) { max_payload_size_ = max_payload_size; }
+  size_t max_payload_size() const { return max_payload_size_; }
+
   /* Accessors for use in testing */
   uint64_t sequence_numbers_in_flight() const;  // How many sequence numbers are outstanding?
   uint64_t consecutive_retransmissions() const; // How many consecutive *re*transmissions have happened?
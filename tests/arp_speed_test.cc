@@ -0,0 +1,178 @@
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "ipv4_datagram.hh"
+#include "network_interface.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+const EthernetAddress local_ethernet_address { 0x02, 0, 0, 0, 0, 1 };
+
+EthernetAddress neighbour_ethernet_address( const uint32_t i )
+{
+  return { 0x02, 1, 0, static_cast<uint8_t>( i >> 16 ), static_cast<uint8_t>( i >> 8 ), static_cast<uint8_t>( i ) };
+}
+
+uint32_t neighbour_ip( const uint32_t i )
+{
+  return 0x0a000002 + i;
+}
+
+EthernetFrame arp_reply_from_neighbour( const uint32_t i )
+{
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REPLY;
+  arp.sender_ethernet_address = neighbour_ethernet_address( i );
+  arp.sender_ip_address = neighbour_ip( i );
+  arp.target_ethernet_address = local_ethernet_address;
+  arp.target_ip_address = 0x0a000001;
+
+  EthernetFrame frame;
+  frame.header = { local_ethernet_address, neighbour_ethernet_address( i ), EthernetHeader::TYPE_ARP };
+  frame.payload = serialize( arp );
+  return frame;
+}
+
+RawIPv4Datagram make_datagram( const size_t payload_size )
+{
+  IPv4Datagram dgram;
+  dgram.header.len = IPv4Header::LENGTH + payload_size;
+  dgram.payload.emplace_back( string( payload_size, 'x' ) );
+  dgram.header.compute_checksum();
+  auto ret = RawIPv4Datagram::from( serialize( dgram ) );
+  if ( not ret.has_value() ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return *ret;
+}
+
+// Send to `neighbours` neighbours for a simulated 60 s in 10 ms ticks. Each neighbour re-announces itself
+// every 20 s (so its mapping never expires), and half of them go quiet halfway through (so theirs do).
+// Each tick's datagrams are sent and their frames collected one at a time, or as one batch.
+void speed_test( const uint32_t neighbours, const size_t sends_per_tick, const bool batched )
+{
+  constexpr size_t TICK_MS = 10;
+  constexpr size_t TICKS = 6000;
+
+  cerr.setstate( ios::badbit );
+  NetworkInterface interface { local_ethernet_address, Address::from_ipv4_numeric( 0x0a000001 ) };
+  cerr.clear();
+
+  vector<EthernetFrame> announcements;
+  for ( uint32_t i = 0; i < neighbours; i++ ) {
+    announcements.push_back( arp_reply_from_neighbour( i ) );
+    interface.recv_frame( announcements.back() );
+  }
+
+  const auto datagram = make_datagram( 64 );
+
+  default_random_engine rd { 789 };
+  const size_t announcements_per_tick = ( neighbours + 1999 ) / 2000; // everyone within 20 s
+  size_t next_announcement = 0;
+  size_t sent = 0;
+  size_t arp_requests = 0;
+  duration<double> tick_time {};
+  duration<double> send_time {};
+  vector<NetworkInterface::OutboundDatagram> batch;
+  vector<EthernetFrame> frames;
+
+  for ( size_t tick = 0; tick < TICKS; tick++ ) {
+    const uint32_t active = tick < TICKS / 2 ? neighbours : neighbours / 2;
+    for ( size_t i = 0; i < announcements_per_tick; i++, next_announcement++ ) {
+      if ( next_announcement % neighbours < active ) {
+        interface.recv_frame( announcements[next_announcement % neighbours] );
+      }
+    }
+
+    auto start_time = steady_clock::now();
+    if ( batched ) {
+      for ( size_t i = 0; i < sends_per_tick; i++ ) {
+        batch.push_back( { datagram, neighbour_ip( rd() % active ) } );
+      }
+      interface.send_datagrams( batch );
+      batch.clear();
+      interface.drain_frames( frames );
+    } else {
+      for ( size_t i = 0; i < sends_per_tick; i++ ) {
+        interface.send_datagram( datagram, neighbour_ip( rd() % active ) );
+      }
+      while ( auto frame = interface.maybe_send() ) {
+        frames.push_back( std::move( *frame ) );
+      }
+    }
+    send_time += steady_clock::now() - start_time;
+
+    for ( const auto& frame : frames ) {
+      sent += frame.header.type == EthernetHeader::TYPE_IPv4;
+      arp_requests += frame.header.type == EthernetHeader::TYPE_ARP;
+    }
+    frames.clear();
+
+    start_time = steady_clock::now();
+    interface.tick( TICK_MS );
+    tick_time += steady_clock::now() - start_time;
+  }
+
+  if ( sent != TICKS * sends_per_tick ) {
+    throw runtime_error( "interface sent " + to_string( sent ) + " of " + to_string( TICKS * sends_per_tick )
+                         + " datagrams" );
+  }
+  if ( arp_requests != 0 ) {
+    throw runtime_error( "interface sent ARP requests for neighbours whose mappings were fresh" );
+  }
+
+  const auto sends_per_second = static_cast<double>( sent ) / send_time.count();
+  const auto ns_per_tick = 1e9 * tick_time.count() / TICKS;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const string mode = batched ? "batched" : "one at a time";
+  cout << "NetworkInterface with " << neighbours << " neighbours sent " << fixed << setprecision( 2 )
+       << sends_per_second / 1e6 << " M datagrams/s (" << mode << ") and spent " << ns_per_tick
+       << " ns per tick.\n";
+
+  debug_output << "             Neighbour table (" << neighbours << " neighbours, " << mode << "): " << fixed
+               << setprecision( 2 ) << sends_per_second / 1e6 << " M sends/s, " << ns_per_tick << " ns/tick\n";
+
+  if ( sends_per_second < 1e6 ) {
+    throw runtime_error( "NetworkInterface did not meet minimum speed of 1 M sends/s." );
+  }
+  if ( ns_per_tick > 100'000 ) {
+    throw runtime_error( "NetworkInterface::tick took over 100 us on average." );
+  }
+}
+
+void program_body()
+{
+  for ( const bool batched : { false, true } ) {
+    speed_test( 16, 100, batched );
+    speed_test( 10'000, 100, batched );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#include "buffer.hh"
+#include "parser.hh"
+#include "test_should_be.hh"
+
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( "Buffer test failed: " + what );
+  }
+}
+
+const char* address( const Buffer& buf )
+{
+  return string_view { buf }.data();
+}
+
+// Two holders of one block may not both claim the headroom in front of it: the second prepend has to copy
+void shared_prepend()
+{
+  const Buffer payload { "payload" };
+  Buffer first = payload;
+  Buffer second = payload;
+  test_should_be( payload.headroom(), Buffer::DEFAULT_HEADROOM );
+
+  expect( first.prepend( "1111" ), "first prepend into a shared block" );
+  expect( string_view { first } == "1111payload", "first prepend wrote its header" );
+  expect( address( first ) + 4 == address( payload ), "first prepend was in place" );
+  test_should_be( second.headroom(), size_t { 0 } );
+  expect( not second.prepend( "2222" ), "second prepend into a shared block must fail" );
+  expect( string_view { second } == "payload", "failed prepend left its buffer unchanged" );
+  expect( string_view { first } == "1111payload", "failed prepend left the first header alone" );
+
+  // The same through Serializer, which falls back to a separate header chunk
+  const Buffer body { "body" };
+  Serializer s1;
+  s1.bytes( "HDR1" );
+  s1.buffer( body );
+  const auto out1 = s1.output();
+  Serializer s2;
+  s2.bytes( "HDR2" );
+  s2.buffer( body );
+  const auto out2 = s2.output();
+  test_should_be( out1.size(), size_t { 1 } );
+  test_should_be( out2.size(), size_t { 2 } );
+  expect( string_view { out1[0] } == "HDR1body", "serialized header was prepended" );
+  expect( string_view { out2[0] } == "HDR2" and string_view { out2[1] } == "body",
+          "second serialized header was copied" );
+
+  // Once the other holders are gone, the survivor still cannot claim headroom that was handed out
+  first = {};
+  expect( not second.prepend( "2222" ), "headroom claimed by a released buffer" );
+
+  // A buffer that has dropped its prefix may not prepend over it either
+  Buffer trimmed { "headerpayload" };
+  trimmed.remove_prefix( 6 );
+  test_should_be( trimmed.headroom(), size_t { 0 } );
+  expect( not trimmed.prepend( "x" ), "prepend over removed prefix" );
+}
+
+// Each size class hands back the blocks freed into it, reset for the new holder
+void size_class_reuse()
+{
+  // (lengths, with the default headroom, that fall in the 256-, 2K- and 32K-byte classes)
+  for ( const size_t len : { size_t { 100 }, size_t { 1500 }, size_t { 30000 } } ) {
+    Buffer buf = Buffer::copy_and_checksum( string( len, 'a' ) );
+    expect( buf.checksum().has_value(), "checksum remembered" );
+    const char* old = address( buf );
+    buf = {};
+
+    Buffer again = Buffer::allocate( len - 10 );
+    expect( address( again ) == old, "block of " + to_string( len ) + " bytes reused" );
+    expect( again.unique(), "reused block has one reference" );
+    test_should_be( again.headroom(), Buffer::DEFAULT_HEADROOM );
+    expect( not again.checksum().has_value(), "reused block forgot its checksum" );
+    expect( again.prepend( "hdr" ), "reused block's headroom can be claimed" );
+
+    // While it is in use, another buffer of the class gets a different block
+    const Buffer other = Buffer::allocate( len );
+    expect( address( other ) != old, "block in use was not handed out again" );
+  }
+
+  // A freed block of one class is not handed out for another
+  Buffer small = Buffer::allocate( 100 );
+  const char* old = address( small );
+  small = {};
+  const Buffer large = Buffer::allocate( 1500 );
+  expect( address( large ) != old, "small block used for a large buffer" );
+  const Buffer small_again = Buffer::allocate( 50 );
+  expect( address( small_again ) == old, "small block reused after a large allocation" );
+
+  // Buffers too large for any class still work
+  Buffer huge { string( 100'000, 'h' ) };
+  test_should_be( huge.size(), size_t { 100'000 } );
+  expect( huge.prepend( "hdr" ), "prepend into an unpooled block" );
+}
+
+// A block may be freed on a different thread from the one that allocated it
+void cross_thread_free()
+{
+  // Allocated here, freed (and then reused) on another thread
+  Buffer here = Buffer::allocate( 1000 );
+  here.mutable_data()[0] = 'x';
+  const char* here_address = address( here );
+  thread( [buf = std::move( here ), here_address]() mutable {
+    expect( buf.unique(), "moved buffer is unique" );
+    expect( string_view { buf }[0] == 'x', "bytes seen by the other thread" );
+    buf = {};
+    const Buffer reused = Buffer::allocate( 1000 );
+    expect( address( reused ) == here_address, "block reused by the thread that freed it" );
+  } ).join();
+
+  // Allocated on another thread (which then exits), freed here
+  Buffer there;
+  thread( [&there] { there = Buffer { string( 1000, 'y' ) }; } ).join();
+  expect( string_view { there } == string( 1000, 'y' ), "bytes from an exited thread" );
+  const char* there_address = address( there );
+  there = {};
+  const Buffer reused = Buffer::allocate( 1000 );
+  expect( address( reused ) == there_address, "block from an exited thread reused here" );
+
+  // Shared between threads that drop their references concurrently
+  for ( size_t round = 0; round < 100; round++ ) {
+    const Buffer shared { string( 200, 's' ) };
+    vector<thread> threads;
+    for ( size_t i = 0; i < 4; i++ ) {
+      threads.emplace_back( [copy = shared] { expect( copy.size() == 200, "shared copy" ); } );
+    }
+    for ( auto& t : threads ) {
+      t.join();
+    }
+    expect( shared.unique(), "shared block back to one reference" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    shared_prepend();
+    size_class_reuse();
+    cross_thread_free();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#include "checksum.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+// The original byte-at-a-time algorithm, as a reference
+uint16_t reference_checksum( const string_view data )
+{
+  uint32_t sum = 0;
+  bool parity = false;
+  for ( const uint8_t i : data ) {
+    sum += parity ? i : uint32_t { i } << 8;
+    parity = !parity;
+    while ( sum > 0xffff ) {
+      sum = ( sum >> 16 ) + ( sum & 0xffff );
+    }
+  }
+  return ~sum;
+}
+
+// Every implementation the CPU supports must agree with the reference, at any length and alignment, and the
+// dispatched one however its input is split
+void implementations_agree( const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  for ( size_t len = 0; len < 300; ++len ) {
+    string data( len, 0 );
+    ranges::generate( data, [&] { return static_cast<char>( rd() ); } );
+    const uint16_t expected = reference_checksum( data );
+
+    // every implementation, on the whole input (at an odd address too)
+    const string shifted = "x" + data;
+    for ( const auto& impl : InternetChecksum::available_implementations() ) {
+      for ( const auto* bytes : { as_const( data ).data(), shifted.data() + 1 } ) {
+        uint64_t wide = impl.sum( reinterpret_cast<const uint8_t*>( bytes ), len );
+        while ( wide > 0xffff ) {
+          wide = ( wide >> 16 ) + ( wide & 0xffff );
+        }
+        auto sum = static_cast<uint16_t>( wide );
+        if constexpr ( endian::native == endian::little ) {
+          sum = __builtin_bswap16( sum );
+        }
+        if ( static_cast<uint16_t>( ~sum ) != expected ) {
+          throw runtime_error( string { impl.name } + " checksum mismatch for length " + to_string( len ) );
+        }
+      }
+    }
+
+    // the dispatched implementation, with the input split at every point
+    for ( size_t split = 0; split <= len; ++split ) {
+      InternetChecksum check;
+      check.add( string_view { data }.substr( 0, split ) );
+      check.add( string_view { data }.substr( split ) );
+      if ( check.value() != expected ) {
+        throw runtime_error( "split checksum mismatch for length " + to_string( len ) );
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    implementations_agree( 1234 );
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
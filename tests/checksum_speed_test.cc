@@ -0,0 +1,93 @@
+#include "checksum.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+uint16_t fold( uint64_t sum )
+{
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + ( sum & 0xffff );
+  }
+  return sum;
+}
+
+string random_string( default_random_engine& rd, const size_t len )
+{
+  uniform_int_distribution<char> ud;
+  string ret;
+  for ( size_t i = 0; i < len; ++i ) {
+    ret += ud( rd );
+  }
+  return ret;
+}
+
+void speed_test( const InternetChecksum::Implementation& impl, const string& data, const size_t iterations )
+{
+  const auto* bytes = reinterpret_cast<const uint8_t*>( data.data() );
+  uint64_t total = 0;
+
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; ++i ) {
+    total += fold( impl.sum( bytes, data.size() ) );
+    asm volatile( "" : : "r"( bytes ) : "memory" ); // keep the compiler from hoisting the sum out of the loop
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( total == 0 ) {
+    throw runtime_error( "implausible checksum" );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto bytes_per_second = static_cast<double>( data.size() * iterations ) / test_duration.count();
+  auto gigabits_per_second = 8 * bytes_per_second / 1e9;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Internet checksum (" << impl.name << ", " << data.size() << "-byte input) reached " << fixed
+       << setprecision( 2 ) << gigabits_per_second << " Gbit/s.\n";
+
+  debug_output << "             Checksum throughput (" << impl.name << ", " << data.size() << " bytes): " << fixed
+               << setprecision( 2 ) << gigabits_per_second << " Gbit/s\n";
+
+  if ( gigabits_per_second < 0.1 ) {
+    throw runtime_error( "Checksum did not meet minimum speed of 0.1 Gbit/s." );
+  }
+}
+
+void program_body()
+{
+  default_random_engine rd { 789 };
+  const string header = random_string( rd, 20 );
+  const string packet = random_string( rd, 1500 );
+
+  cout << "Dispatched implementation: " << InternetChecksum::implementation().name << "\n";
+  for ( const auto& impl : InternetChecksum::available_implementations() ) {
+    speed_test( impl, header, 10'000'000 );
+    speed_test( impl, packet, 1'000'000 );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
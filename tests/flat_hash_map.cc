@@ -0,0 +1,63 @@
+#include "flat_hash_map.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+// The neighbour table's map must agree with unordered_map through random inserts, erases and lookups
+void agrees_with_unordered_map( const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  FlatHashMap<uint64_t> map;
+  unordered_map<uint32_t, uint64_t> reference;
+
+  for ( size_t i = 0; i < 200'000; i++ ) {
+    // Keys from a small range, including consecutive addresses, so that probe runs collide and wrap
+    const uint32_t key = i % 2 ? 0x0a000000 + rd() % 4096 : static_cast<uint32_t>( rd() ) % 65536 * 65536;
+    switch ( rd() % 3 ) {
+      case 0: {
+        map.try_emplace( key ).first = i;
+        reference[key] = i;
+        break;
+      }
+      case 1:
+        if ( map.erase( key ) != ( reference.erase( key ) == 1 ) ) {
+          throw runtime_error( "FlatHashMap erase disagrees with unordered_map" );
+        }
+        break;
+      default: {
+        const auto* value = map.find( key );
+        const auto it = reference.find( key );
+        if ( ( value == nullptr ) != ( it == reference.end() ) or ( value and *value != it->second ) ) {
+          throw runtime_error( "FlatHashMap find disagrees with unordered_map" );
+        }
+      }
+    }
+    if ( map.size() != reference.size() ) {
+      throw runtime_error( "FlatHashMap size disagrees with unordered_map" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    agrees_with_unordered_map( 1234 );
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "header_codec.hh"
+#include "ipv4_datagram.hh"
+#include "network_interface.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr uint32_t SENDER_IP = 0x0a000001;
+constexpr uint32_t RECEIVER_IP = 0x0a000002;
+const EthernetAddress sender_ethernet_address { 0x02, 0, 0, 0, 0, 1 };
+const EthernetAddress receiver_ethernet_address { 0x02, 0, 0, 0, 0, 2 };
+
+constexpr uint8_t PROTO_UDP = 17;
+
+// A UDP datagram of `size` bytes (headers included), from a port that identifies `flow`
+RawIPv4Datagram make_datagram( const uint32_t flow, const size_t size )
+{
+  string payload( size - IPv4Header::LENGTH, 0 );
+  header_codec::store( payload.data(), static_cast<uint16_t>( 1000 + flow ) );
+  header_codec::store( payload.data() + 2, uint16_t { 9 } );
+
+  IPv4Datagram dgram;
+  dgram.header.proto = PROTO_UDP;
+  dgram.header.src = SENDER_IP;
+  dgram.header.dst = RECEIVER_IP;
+  dgram.header.len = size;
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.compute_checksum();
+
+  auto ret = RawIPv4Datagram::from( serialize( dgram ) );
+  if ( not ret.has_value() ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return std::move( *ret );
+}
+
+EthernetFrame arp_reply()
+{
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REPLY;
+  arp.sender_ethernet_address = receiver_ethernet_address;
+  arp.sender_ip_address = RECEIVER_IP;
+  arp.target_ethernet_address = sender_ethernet_address;
+  arp.target_ip_address = SENDER_IP;
+  return { { sender_ethernet_address, receiver_ethernet_address, EthernetHeader::TYPE_ARP }, serialize( arp ) };
+}
+
+NetworkInterface make_interface()
+{
+  cerr.setstate( ios::badbit );
+  NetworkInterface ret { sender_ethernet_address, Address::from_ipv4_numeric( SENDER_IP ) };
+  cerr.clear();
+  ret.recv_frame( arp_reply() );
+  return ret;
+}
+
+// Queue and send full-size frames from many flows through FQ-CoDel
+void speed_test()
+{
+  constexpr size_t ROUNDS = 2'000;
+  constexpr size_t BATCH = 1024;
+  NetworkInterface interface = make_interface();
+  interface.enable_fq_codel();
+
+  vector<NetworkInterface::OutboundDatagram> datagrams;
+  vector<RawIPv4Datagram> templates;
+  for ( uint32_t flow = 0; flow < 256; flow++ ) {
+    templates.push_back( make_datagram( flow, 1500 ) );
+  }
+
+  size_t bytes = 0;
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < ROUNDS; i++ ) {
+    datagrams.clear();
+    for ( size_t j = 0; j < BATCH; j++ ) {
+      datagrams.push_back( { templates[( i + j ) % templates.size()], RECEIVER_IP } );
+    }
+    interface.send_datagrams( datagrams );
+    while ( const auto frame = interface.maybe_send() ) {
+      for ( const auto& b : frame->payload ) {
+        bytes += b.size();
+      }
+    }
+  }
+  const duration<double> elapsed = steady_clock::now() - start_time;
+
+  if ( bytes != ROUNDS * BATCH * 1500 ) {
+    throw runtime_error( "FQ-CoDel sent " + to_string( bytes ) + " bytes" );
+  }
+
+  const auto gigabits_per_second = 8 * static_cast<double>( bytes ) / 1e9 / elapsed.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "NetworkInterface with FQ-CoDel (1500-byte datagrams, 256 flows) achieved " << fixed << setprecision( 2 )
+       << gigabits_per_second << " Gbit/s.\n";
+  debug_output << "                 NetworkInterface with FQ-CoDel: " << fixed << setprecision( 2 )
+               << gigabits_per_second << " Gbit/s\n";
+
+  if ( gigabits_per_second < 0.1 ) {
+    throw runtime_error( "NetworkInterface with FQ-CoDel did not meet minimum speed of 0.1 Gbit/s." );
+  }
+}
+
+void program_body()
+{
+  speed_test();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#include "ipv4_datagram.hh"
+#include "ipv4_fragments.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+string concatenate( const vector<Buffer>& buffers )
+{
+  string ret;
+  for ( const auto& b : buffers ) {
+    ret += string_view { b };
+  }
+  return ret;
+}
+
+// A datagram with `payload_size` random bytes
+RawIPv4Datagram make_datagram( default_random_engine& rd, const uint16_t id, const size_t payload_size )
+{
+  string payload( payload_size, 0 );
+  ranges::generate( payload, [&] { return static_cast<char>( rd() ); } );
+
+  IPv4Datagram dgram;
+  dgram.header.id = id;
+  dgram.header.df = false;
+  dgram.header.src = 0x0a000001;
+  dgram.header.dst = 0x0a000002;
+  dgram.header.len = IPv4Header::LENGTH + payload_size;
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.compute_checksum();
+
+  auto ret = RawIPv4Datagram::from( { Buffer { concatenate( serialize( dgram ) ) } } );
+  if ( not ret.has_value() ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return std::move( *ret );
+}
+
+// Fragment and reassemble 9000-byte datagrams at an MTU of 1500
+void speed_test()
+{
+  constexpr size_t ROUNDS = 100'000;
+  default_random_engine rd { 4321 };
+  vector<RawIPv4Datagram> datagrams;
+  for ( uint16_t id = 0; id < 64; id++ ) {
+    datagrams.push_back( make_datagram( rd, id, 9000 - 20 ) );
+  }
+
+  IPv4Reassembler reassembler;
+  vector<RawIPv4Datagram> fragments;
+  size_t bytes = 0;
+
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < ROUNDS; i++ ) {
+    fragments.clear();
+    fragment_ipv4( datagrams[i % datagrams.size()], 1500, fragments );
+    for ( size_t j = fragments.size(); j-- > 0; ) {
+      if ( auto whole = reassembler.add( fragments[j] ) ) {
+        bytes += whole->size();
+      }
+    }
+  }
+  const duration<double> elapsed = steady_clock::now() - start_time;
+
+  if ( bytes != ROUNDS * 9000 ) {
+    throw runtime_error( "IPv4Reassembler reassembled " + to_string( bytes ) + " bytes" );
+  }
+
+  const auto gigabits_per_second = 8 * static_cast<double>( bytes ) / 1e9 / elapsed.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "IPv4 fragmentation and reassembly (9000-byte datagrams, MTU 1500) achieved " << fixed
+       << setprecision( 2 ) << gigabits_per_second << " Gbit/s.\n";
+  debug_output << "             IPv4 fragmentation and reassembly: " << fixed << setprecision( 2 )
+               << gigabits_per_second << " Gbit/s\n";
+
+  if ( gigabits_per_second < 0.1 ) {
+    throw runtime_error( "IPv4 fragmentation and reassembly did not meet minimum speed of 0.1 Gbit/s." );
+  }
+}
+
+void program_body()
+{
+  speed_test();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
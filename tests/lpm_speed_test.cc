@@ -0,0 +1,131 @@
+#include "lpm_trie.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Prefix
+{
+  uint32_t prefix;
+  uint8_t length;
+};
+
+uint32_t mask( const uint8_t length )
+{
+  return length == 0 ? 0 : UINT32_MAX << ( 32 - length );
+}
+
+// A length distribution roughly like a full IPv4 table: mostly /24s, then /22-/23, /16-/21, a few longer than
+// /24 and very few shorter than /16
+uint8_t random_length( default_random_engine& rd )
+{
+  const auto pick = uniform_int_distribution<int> { 0, 999 }( rd );
+  if ( pick < 600 ) {
+    return 24;
+  }
+  if ( pick < 800 ) {
+    return uniform_int_distribution<int> { 22, 23 }( rd );
+  }
+  if ( pick < 945 ) {
+    return uniform_int_distribution<int> { 16, 21 }( rd );
+  }
+  if ( pick < 950 ) {
+    return uniform_int_distribution<int> { 8, 15 }( rd );
+  }
+  return uniform_int_distribution<int> { 25, 32 }( rd );
+}
+
+vector<Prefix> random_prefixes( default_random_engine& rd, const size_t count )
+{
+  vector<Prefix> ret;
+  ret.reserve( count );
+  for ( size_t i = 0; i < count; ++i ) {
+    const uint8_t length = random_length( rd );
+    ret.push_back( { static_cast<uint32_t>( rd() ) & mask( length ), length } );
+  }
+  return ret;
+}
+
+void speed_test( const size_t prefix_count, const size_t lookups )
+{
+  default_random_engine rd { 789 };
+  const auto prefixes = random_prefixes( rd, prefix_count );
+
+  // Addresses drawn from the inserted prefixes, so that most lookups walk to a deeper level
+  vector<uint32_t> addresses;
+  addresses.reserve( lookups );
+  for ( size_t i = 0; i < lookups; ++i ) {
+    const auto& p = prefixes[rd() % prefixes.size()];
+    addresses.push_back( p.prefix | ( static_cast<uint32_t>( rd() ) & ~mask( p.length ) ) );
+  }
+
+  LPMTrie trie;
+  const auto build_start = steady_clock::now();
+  for ( size_t i = 0; i < prefixes.size(); ++i ) {
+    trie.insert( prefixes[i].prefix, prefixes[i].length, i );
+  }
+  const auto build_stop = steady_clock::now();
+
+  size_t matched = 0;
+  uint64_t total = 0;
+  const auto start_time = steady_clock::now();
+  for ( const uint32_t address : addresses ) {
+    const auto value = trie.lookup( address );
+    matched += value.has_value();
+    total += value.value_or( 0 );
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( matched != addresses.size() || total == 0 ) {
+    throw runtime_error( "implausible lookup results" );
+  }
+
+  const auto build_duration = duration_cast<duration<double>>( build_stop - build_start );
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto lookups_per_second = static_cast<double>( lookups ) / test_duration.count();
+  const auto bytes_per_prefix = static_cast<double>( trie.memory_usage() ) / static_cast<double>( trie.size() );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "LPMTrie with " << prefix_count << " prefixes (built in " << fixed << setprecision( 2 )
+       << build_duration.count() << " s) reached " << lookups_per_second / 1e6 << " M lookups/s using "
+       << bytes_per_prefix << " bytes/prefix.\n";
+
+  debug_output << "             LPM lookups (" << prefix_count << " prefixes): " << fixed << setprecision( 2 )
+               << lookups_per_second / 1e6 << " M/s, " << bytes_per_prefix << " bytes/prefix\n";
+
+  if ( lookups_per_second < 1e6 ) {
+    throw runtime_error( "LPMTrie did not meet minimum speed of 1 M lookups/s." );
+  }
+}
+
+void program_body()
+{
+  speed_test( 1'000'000, 20'000'000 );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
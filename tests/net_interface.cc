@@ -1,11 +1,21 @@
 #include "arp_message.hh"
+#include "checksum.hh"
 #include "ethernet_header.hh"
+#include "header_codec.hh"
 #include "ipv4_datagram.hh"
 #include "network_interface_test_harness.hh"
 
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <iostream>
+#include <optional>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
@@ -32,6 +42,34 @@ InternetDatagram make_datagram( const string& src_ip, const string& dst_ip ) //
   return dgram;
 }
 
+// A datagram of `length` bytes in all
+InternetDatagram make_datagram( const string& src_ip, const string& dst_ip, const size_t length )
+{
+  InternetDatagram dgram = make_datagram( src_ip, dst_ip );
+  dgram.payload = { Buffer { string( length - IPv4Header::LENGTH, 'x' ) } };
+  dgram.header.len = static_cast<uint16_t>( length );
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// A fragment of a datagram from `src_ip` to `dst_ip`: `payload`, at `offset` bytes into the datagram's payload
+InternetDatagram make_fragment( const string& src_ip, // NOLINT(*-swappable-*)
+                                const string& dst_ip,
+                                const size_t offset,
+                                const bool more,
+                                string payload )
+{
+  InternetDatagram dgram = make_datagram( src_ip, dst_ip );
+  dgram.header.id = 1;
+  dgram.header.df = false;
+  dgram.header.mf = more;
+  dgram.header.offset = static_cast<uint16_t>( offset / 8 );
+  dgram.payload = { Buffer { std::move( payload ) } };
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + dgram.payload.front().size();
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
 ARPMessage make_arp( const uint16_t opcode,
                      const EthernetAddress sender_ethernet_address,
                      const string& sender_ip_address,
@@ -60,6 +98,428 @@ EthernetFrame make_frame( const EthernetAddress& src,
   return frame;
 }
 
+// A datagram with `payload_size` random bytes. With `options`, its header carries a router-alert option (copied
+// into every fragment) and a record-route option (only in the first).
+RawIPv4Datagram make_random_datagram( default_random_engine& rd,
+                                      const uint16_t id,
+                                      const size_t payload_size,
+                                      const bool options,
+                                      const bool df = false )
+{
+  string payload( payload_size, 0 );
+  ranges::generate( payload, [&] { return static_cast<char>( rd() ); } );
+
+  IPv4Datagram dgram;
+  dgram.header.id = id;
+  dgram.header.df = df;
+  dgram.header.src = 0x0a000001;
+  dgram.header.dst = 0x0a000002;
+  dgram.header.len = IPv4Header::LENGTH + payload_size;
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.compute_checksum();
+
+  string raw = concat( serialize( dgram ) );
+  if ( options ) {
+    raw.insert( IPv4Header::LENGTH, string { "\x94\x04\x00\x00\x07\x03\x04\x00", 8 } );
+    raw[0] = 0x47;
+    raw[2] = static_cast<char>( ( raw.size() >> 8 ) & 0xff );
+    raw[3] = static_cast<char>( raw.size() & 0xff );
+    raw[10] = raw[11] = 0;
+    InternetChecksum check;
+    check.add( string_view { raw }.substr( 0, 28 ) );
+    const uint16_t sum = check.value();
+    raw[10] = static_cast<char>( sum >> 8 );
+    raw[11] = static_cast<char>( sum & 0xff );
+  }
+
+  auto ret = RawIPv4Datagram::from( { Buffer { std::move( raw ) } } );
+  if ( not ret.has_value() ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return std::move( *ret );
+}
+
+// Fragment random datagrams at random MTUs, then reassemble them from the fragments shuffled, with duplicates
+// and overlapping fragments (the same datagram fragmented at a second MTU)
+void check_fragment_round_trip( const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  IPv4Reassembler reassembler;
+  vector<RawIPv4Datagram> fragments;
+  vector<RawIPv4Datagram> others;
+
+  for ( uint16_t id = 0; id < 500; id++ ) {
+    const bool options = rd() % 2;
+    const size_t payload_size = 1 + rd() % ( id % 10 == 0 ? 65000 : 5000 );
+    const auto dgram = make_random_datagram( rd, id, payload_size, options );
+    const string original = concat( dgram.buffers );
+
+    const size_t mtu = 68 + rd() % 4000;
+    fragments.clear();
+    if ( not fragment_ipv4( dgram, mtu, fragments ) ) {
+      throw runtime_error( "fragment_ipv4 refused a datagram that may be fragmented" );
+    }
+
+    size_t covered = 0;
+    for ( const auto& fragment : fragments ) {
+      const auto parsed = RawIPv4Datagram::from( { Buffer { concat( fragment.buffers ) } } );
+      if ( not parsed.has_value() or parsed->total_length() > mtu or parsed->size() != parsed->total_length()
+           or parsed->fragment_offset() != covered or parsed->id() != id ) {
+        throw runtime_error( "fragment_ipv4 made a bad fragment" );
+      }
+      covered += parsed->total_length() - parsed->header_length();
+    }
+    if ( covered != payload_size or ( payload_size + dgram.header_length() <= mtu ) != ( fragments.size() == 1 ) ) {
+      throw runtime_error( "fragment_ipv4 did not cover the datagram" );
+    }
+    if ( fragments.size() == 1 ) {
+      continue;
+    }
+
+    others.clear();
+    fragment_ipv4( dgram, 68 + rd() % 4000, others );
+    for ( auto& fragment : others ) {
+      if ( rd() % 2 ) {
+        fragments.push_back( std::move( fragment ) );
+      }
+    }
+    for ( size_t i = fragments.size() / 4; i > 0; i-- ) {
+      fragments.push_back( fragments[rd() % fragments.size()] );
+    }
+    ranges::shuffle( fragments, rd );
+
+    optional<RawIPv4Datagram> whole;
+    for ( const auto& fragment : fragments ) {
+      whole = reassembler.add( fragment );
+      if ( whole.has_value() ) {
+        break;
+      }
+    }
+    if ( not whole.has_value() or concat( whole->buffers ) != original ) {
+      throw runtime_error( "IPv4Reassembler did not put datagram " + to_string( id ) + " back together" );
+    }
+  }
+
+  if ( reassembler.stats().pending_datagrams != 0 or reassembler.stats().pending_bytes != 0
+       or reassembler.stats().malformed != 0 ) {
+    throw runtime_error( "IPv4Reassembler kept something after reassembling every datagram" );
+  }
+}
+
+// Datagrams that never complete are given up to stay within the reassembler's limits, inconsistent fragments are
+// dropped, and a datagram with the don't-fragment flag is not fragmented
+void check_reassembly_limits()
+{
+  default_random_engine rd { 1234 };
+  vector<RawIPv4Datagram> fragments;
+
+  {
+    // Many datagrams, each missing its last fragment
+    IPv4Reassembler reassembler;
+    for ( uint16_t id = 0; id < 200; id++ ) {
+      fragments.clear();
+      fragment_ipv4( make_random_datagram( rd, id, 20'000, false ), 1500, fragments );
+      fragments.pop_back();
+      for ( const auto& fragment : fragments ) {
+        if ( reassembler.add( fragment ).has_value() ) {
+          throw runtime_error( "IPv4Reassembler completed a datagram with a fragment missing" );
+        }
+        if ( reassembler.stats().pending_datagrams > IPv4Reassembler::MAX_DATAGRAMS
+             or reassembler.stats().pending_bytes > IPv4Reassembler::MAX_BYTES ) {
+          throw runtime_error( "IPv4Reassembler held too much" );
+        }
+      }
+    }
+    if ( reassembler.stats().evicted < 200 - IPv4Reassembler::MAX_DATAGRAMS ) {
+      throw runtime_error( "IPv4Reassembler did not count the datagrams it gave up" );
+    }
+  }
+
+  {
+    // Two different last fragments
+    IPv4Reassembler reassembler;
+    fragments.clear();
+    fragment_ipv4( make_random_datagram( rd, 7, 3000, false ), 1500, fragments );
+    reassembler.add( fragments.back() );
+    fragments.clear();
+    fragment_ipv4( make_random_datagram( rd, 7, 4000, false ), 1500, fragments );
+    reassembler.add( fragments.back() );
+    if ( reassembler.stats().malformed != 1 or reassembler.stats().pending_datagrams != 0 ) {
+      throw runtime_error( "IPv4Reassembler accepted inconsistent fragments" );
+    }
+  }
+
+  {
+    // The reassembled datagram takes the first fragment's header: with 40 bytes of options, the payload must end
+    // by 65,495 bytes, whichever fragment arrives first
+    const auto fragment = []( const size_t offset, const bool more, const size_t length, const size_t options ) {
+      string raw = concat( serialize( make_fragment( "10.0.0.2", "10.0.0.1", offset, more, string( length, 'x' ) ) ) );
+      raw.insert( IPv4Header::LENGTH, string( options, '\x01' ) ); // no-operation options
+      const size_t header_length = IPv4Header::LENGTH + options;
+      raw[0] = static_cast<char>( 0x40 | header_length / 4 );
+      raw[2] = static_cast<char>( ( raw.size() >> 8 ) & 0xff );
+      raw[3] = static_cast<char>( raw.size() & 0xff );
+      raw[10] = raw[11] = 0;
+      InternetChecksum check;
+      check.add( string_view { raw }.substr( 0, header_length ) );
+      const uint16_t sum = check.value();
+      raw[10] = static_cast<char>( sum >> 8 );
+      raw[11] = static_cast<char>( sum & 0xff );
+      auto ret = RawIPv4Datagram::from( { Buffer { std::move( raw ) } } );
+      if ( not ret.has_value() ) {
+        throw runtime_error( "could not build fragment" );
+      }
+      return std::move( *ret );
+    };
+
+    for ( const bool in_order : { true, false } ) {
+      IPv4Reassembler reassembler;
+      const auto first = fragment( 0, true, 32760, 40 );
+      const auto last = fragment( 32760, false, 32755, 0 );
+      reassembler.add( in_order ? first : last );
+      if ( reassembler.add( in_order ? last : first ).has_value() or reassembler.stats().malformed != 1
+           or reassembler.stats().pending_datagrams != 0 ) {
+        throw runtime_error( "IPv4Reassembler accepted a datagram too long for the first fragment's header" );
+      }
+    }
+
+    IPv4Reassembler reassembler;
+    reassembler.add( fragment( 0, true, 32760, 40 ) );
+    const auto whole = reassembler.add( fragment( 32760, false, 32715, 0 ) );
+    if ( not whole.has_value() or whole->header_length() != 60 or whole->total_length() != 65535 ) {
+      throw runtime_error( "IPv4Reassembler did not reassemble the largest datagram with options" );
+    }
+  }
+
+  fragments.clear();
+  if ( fragment_ipv4( make_random_datagram( rd, 8, 3000, false, true ), 1500, fragments ) or not fragments.empty() ) {
+    throw runtime_error( "fragment_ipv4 fragmented a datagram with the don't-fragment flag" );
+  }
+}
+
+// Frames received in a batch hand their buffers over: the raw datagrams are the frames' own buffers, and the
+// frames are left empty
+void check_batch_receive()
+{
+  const EthernetAddress local_eth = random_private_ethernet_address();
+  const EthernetAddress remote_eth = random_private_ethernet_address();
+  NetworkInterface interface { local_eth, Address( "10.0.0.1", 0 ) };
+
+  const auto make_batch = [&] {
+    vector<EthernetFrame> frames;
+    for ( const auto& dst : { local_eth, random_private_ethernet_address(), local_eth } ) {
+      frames.push_back( make_frame(
+        remote_eth, dst, EthernetHeader::TYPE_IPv4, serialize( make_datagram( "10.0.0.2", "10.0.0.1" ) ) ) );
+    }
+    return frames;
+  };
+
+  vector<EthernetFrame> frames = make_batch();
+  const array<const char*, 2> bytes { string_view { frames[0].payload.front() }.data(),
+                                      string_view { frames[2].payload.front() }.data() };
+  vector<RawIPv4Datagram> raw;
+  interface.recv_raw_frames( frames, raw );
+  if ( raw.size() != 2 or string_view { raw[0].buffers.front() }.data() != bytes[0]
+       or string_view { raw[1].buffers.front() }.data() != bytes[1] ) {
+    throw runtime_error( "NetworkInterface::recv_raw_frames did not hand over the frames' buffers" );
+  }
+  if ( not frames[0].payload.empty() or not frames[2].payload.empty() ) {
+    throw runtime_error( "NetworkInterface::recv_raw_frames left the frames holding their buffers" );
+  }
+
+  frames = make_batch();
+  vector<InternetDatagram> parsed;
+  interface.recv_frames( frames, parsed );
+  if ( parsed.size() != 2 or not equal( parsed[1], make_datagram( "10.0.0.2", "10.0.0.1" ) )
+       or not frames[0].payload.empty() ) {
+    throw runtime_error( "NetworkInterface::recv_frames did not receive the batch" );
+  }
+}
+
+// What the datagrams of the congestion simulation carry after their UDP ports: which flow sent them, in what
+// order, and when
+struct Probe
+{
+  uint32_t flow {};
+  uint64_t seq {};
+  uint64_t sent {};
+};
+
+constexpr size_t PROBE_OFFSET = 8;
+
+// A UDP datagram of `size` bytes (headers included) carrying `probe`, from a port that identifies the flow
+RawIPv4Datagram make_probe_datagram( const Probe& probe, const size_t size, const uint8_t tos = 0 )
+{
+  string payload( size - IPv4Header::LENGTH, 0 );
+  header_codec::store( payload.data(), static_cast<uint16_t>( 1000 + probe.flow ) );
+  header_codec::store( payload.data() + 2, uint16_t { 9 } );
+  header_codec::store( payload.data() + PROBE_OFFSET, probe.flow );
+  header_codec::store( payload.data() + PROBE_OFFSET + 4, probe.seq );
+  header_codec::store( payload.data() + PROBE_OFFSET + 12, probe.sent );
+
+  IPv4Datagram dgram;
+  dgram.header.tos = tos;
+  dgram.header.proto = 17;
+  dgram.header.src = 0x0a000001;
+  dgram.header.dst = 0x0a000002;
+  dgram.header.len = size;
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.compute_checksum();
+
+  auto ret = RawIPv4Datagram::from( serialize( dgram ) );
+  if ( not ret.has_value() ) {
+    throw runtime_error( "could not build datagram" );
+  }
+  return std::move( *ret );
+}
+
+// A sent frame's probe, and whether it was marked Congestion Experienced (checking its header checksum)
+pair<Probe, bool> read_probe( const EthernetFrame& frame )
+{
+  auto dgram = RawIPv4Datagram::from( frame.payload );
+  if ( not dgram.has_value() ) {
+    throw runtime_error( "NetworkInterface sent a datagram with a bad header" );
+  }
+  const string bytes = concat( dgram->buffers );
+  const char* probe = bytes.data() + dgram->header_length() + PROBE_OFFSET;
+  return { { header_codec::load<uint32_t>( probe ),
+             header_codec::load<uint64_t>( probe + 4 ),
+             header_codec::load<uint64_t>( probe + 12 ) },
+           ( dgram->header()[1] & 0x03 ) == 0x03 };
+}
+
+struct CongestionOutcome
+{
+  double bulk_delay {};          // mean, in ms, over the second half of the run
+  uint64_t interactive_delay {}; // most, in ms
+  double utilization {};         // of the link, over the second half
+  uint64_t losses {};
+  uint64_t marks {};
+};
+
+// Bulk flows that react to loss or marking (adding a little to their rate every ms, up to 30% more than the link
+// can carry between them, and halving it at most once per RTT on congestion) share a link of LINK_RATE frames
+// per ms with an interactive flow that sends a frame every 10 ms
+CongestionOutcome simulate_congestion( NetworkInterface& interface, const bool ecn )
+{
+  constexpr size_t DURATION = 5'000; // ms
+  constexpr double LINK_RATE = 10;
+  constexpr uint32_t BULK_FLOWS = 4;
+  constexpr uint32_t INTERACTIVE = BULK_FLOWS;
+  constexpr uint64_t RTT = 20;
+  constexpr double MAX_RATE = 1.3 * LINK_RATE / BULK_FLOWS;
+
+  struct Flow
+  {
+    double rate = 1;
+    double credit {};
+    uint64_t next_seq {};
+    uint64_t expected_seq {};
+    uint64_t last_decrease {};
+  };
+  array<Flow, BULK_FLOWS + 1> flows {};
+
+  CongestionOutcome outcome;
+  uint64_t delay_sum = 0;
+  uint64_t delay_count = 0;
+  uint64_t delivered = 0;
+  double link_credit = 0;
+
+  for ( uint64_t now = 0; now < DURATION; now++ ) {
+    for ( uint32_t i = 0; i < BULK_FLOWS; i++ ) {
+      flows[i].rate = min( flows[i].rate + 0.002, MAX_RATE );
+      for ( flows[i].credit += flows[i].rate; flows[i].credit >= 1; flows[i].credit-- ) {
+        interface.send_datagram( make_probe_datagram( { i, flows[i].next_seq++, now }, 1500, ecn ? 0x02 : 0 ),
+                                 0x0a000002 );
+      }
+    }
+    if ( now % 10 == 0 ) {
+      interface.send_datagram( make_probe_datagram( { INTERACTIVE, flows[INTERACTIVE].next_seq++, now }, 100 ),
+                               0x0a000002 );
+    }
+
+    for ( link_credit += LINK_RATE; link_credit >= 1; link_credit-- ) {
+      const auto frame = interface.maybe_send();
+      if ( not frame.has_value() ) {
+        link_credit = 0;
+        break;
+      }
+      const auto [probe, marked] = read_probe( *frame );
+      Flow& flow = flows.at( probe.flow );
+      const bool lost = probe.seq != flow.expected_seq;
+      outcome.losses += probe.seq - flow.expected_seq;
+      outcome.marks += marked;
+      flow.expected_seq = probe.seq + 1;
+      if ( ( lost or marked ) and now >= flow.last_decrease + RTT ) {
+        flow.rate /= 2;
+        flow.last_decrease = now;
+      }
+
+      if ( probe.flow == INTERACTIVE ) {
+        outcome.interactive_delay = max( outcome.interactive_delay, now - probe.sent );
+      } else if ( now >= DURATION / 2 ) {
+        delay_sum += now - probe.sent;
+        delay_count++;
+        delivered++;
+      }
+    }
+
+    interface.tick( 1 );
+  }
+
+  outcome.bulk_delay = static_cast<double>( delay_sum ) / static_cast<double>( max( delay_count, uint64_t { 1 } ) );
+  outcome.utilization = static_cast<double>( delivered ) / ( LINK_RATE * ( DURATION / 2 ) );
+  return outcome;
+}
+
+// Without AQM the bulk flows fill the queue without limit; with FQ-CoDel (dropping or marking) they are held near
+// the target delay while keeping the link busy, and the interactive flow is never stuck behind them
+void check_fq_codel_delay()
+{
+  const EthernetAddress local_eth = random_private_ethernet_address();
+  const EthernetAddress remote_eth = random_private_ethernet_address();
+  const auto make_interface = [&] {
+    cerr.setstate( ios::badbit );
+    NetworkInterface ret { local_eth, Address( "10.0.0.1", 0 ) };
+    cerr.clear();
+    ret.recv_frame( make_frame(
+      remote_eth,
+      local_eth,
+      EthernetHeader::TYPE_ARP, // NOLINTNEXTLINE(*-suspicious-*)
+      serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "10.0.0.2", local_eth, "10.0.0.1" ) ) ) );
+    return ret;
+  };
+
+  NetworkInterface fifo = make_interface();
+  const CongestionOutcome unmanaged = simulate_congestion( fifo, false );
+  if ( unmanaged.bulk_delay < 250 or unmanaged.interactive_delay < 250 ) {
+    throw runtime_error( "a FIFO queue without AQM unexpectedly stayed short" );
+  }
+
+  for ( const bool ecn : { false, true } ) {
+    NetworkInterface interface = make_interface();
+    interface.enable_fq_codel( { .ecn = ecn } );
+    const CongestionOutcome managed = simulate_congestion( interface, ecn );
+    const auto stats = interface.output_queue_stats();
+    const string name = ecn ? "FQ-CoDel with ECN" : "FQ-CoDel";
+
+    if ( managed.bulk_delay > 30 or managed.utilization < 0.8 ) {
+      throw runtime_error( name + " held bulk flows at " + to_string( managed.bulk_delay ) + " ms with "
+                           + to_string( managed.utilization ) + " utilization" );
+    }
+    if ( managed.interactive_delay > 1 ) {
+      throw runtime_error( name + " delayed an interactive flow by " + to_string( managed.interactive_delay )
+                           + " ms" );
+    }
+    if ( ecn
+           ? managed.marks == 0 or managed.marks != stats.marked or managed.losses != 0 or stats.dropped_codel != 0
+           : managed.losses == 0 or managed.losses != stats.dropped_codel or stats.marked != 0 ) {
+      throw runtime_error( name + " dropped " + to_string( managed.losses ) + " and marked "
+                           + to_string( managed.marks ) + " datagrams" );
+    }
+  }
+}
+
 int main()
 {
   try {
@@ -320,6 +780,396 @@ int main()
         serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", {}, "10.0.0.5" ) ) ) } );
       test.execute( ExpectNoFrame {} );
     }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "mappings in use are refreshed before they expire", local_eth, Address( "10.0.0.1", 0 ) };
+
+      const auto send_datagram = [&]( const string& dst ) {
+        const auto datagram = make_datagram( "10.0.0.1", dst );
+        test.execute( SendDatagram { datagram, Address( "10.0.0.7", 0 ) } );
+        test.execute(
+          ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( datagram ) ) } );
+      };
+      const auto probe = make_frame(
+        local_eth,
+        remote_eth,
+        EthernetHeader::TYPE_ARP,
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", remote_eth, "10.0.0.7" ) ) );
+      const auto reply = make_frame(
+        remote_eth,
+        local_eth,
+        EthernetHeader::TYPE_ARP, // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "10.0.0.7", local_eth, "10.0.0.1" ) ) );
+
+      test.execute( ReceiveFrame { reply, {} } );
+      test.execute( ExpectNoFrame {} );
+
+      // fresh mapping: no ARP
+      test.execute( Tick { 27000 } );
+      send_datagram( "1.1.1.1" );
+      test.execute( ExpectNoFrame {} );
+
+      // mapping getting old: datagram is still sent with the cached address, and a unicast ARP request follows
+      test.execute( Tick { 500 } );
+      send_datagram( "2.2.2.2" );
+      test.execute( ExpectFrame { probe } );
+      test.execute( ExpectNoFrame {} );
+
+      // at most one request per second
+      send_datagram( "3.3.3.3" );
+      test.execute( ExpectNoFrame {} );
+      test.execute( Tick { 1000 } );
+      send_datagram( "4.4.4.4" );
+      test.execute( ExpectFrame { probe } );
+      test.execute( ExpectNoFrame {} );
+
+      // the reply refreshes the mapping past the original 30 seconds
+      test.execute( ReceiveFrame { reply, {} } );
+      test.execute( Tick { 2000 } );
+      send_datagram( "5.5.5.5" );
+      test.execute( ExpectNoFrame {} );
+
+      // an unused mapping is not refreshed, and expires
+      test.execute( Tick { 29000 } );
+      test.execute( SendDatagram { make_datagram( "10.0.0.1", "6.6.6.6" ), Address( "10.0.0.7", 0 ) } );
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", {}, "10.0.0.7" ) ) ) } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "a neighbour's waiting datagrams are limited to 64 KiB", local_eth, Address( "10.0.0.1", 0 ) };
+
+      // 1500-byte datagrams, of which 43 fit: the oldest are dropped to make room for the newest
+      vector<InternetDatagram> datagrams;
+      for ( size_t i = 0; i < 50; i++ ) {
+        datagrams.push_back( make_datagram( "10.0.0.1", "13.0.0." + to_string( i ), 1500 ) );
+        test.execute( SendDatagram { datagrams.back(), Address( "10.0.0.7", 0 ) } );
+      }
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", {}, "10.0.0.7" ) ) ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingStats { { .queued_datagrams = 43,
+                                           .queued_bytes = 43 * 1500,
+                                           .dropped_datagrams = 7,
+                                           .dropped_bytes = 7 * 1500,
+                                           .requests_sent = 1 } } );
+
+      test.execute( ReceiveFrame {
+        make_frame(
+          remote_eth,
+          local_eth,
+          EthernetHeader::TYPE_ARP, // NOLINTNEXTLINE(*-suspicious-*)
+          serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "10.0.0.7", local_eth, "10.0.0.1" ) ) ),
+        {} } );
+      for ( size_t i = 7; i < datagrams.size(); i++ ) {
+        test.execute( ExpectFrame {
+          make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( datagrams[i] ) ) } );
+      }
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingStats {
+        { .dropped_datagrams = 7, .dropped_bytes = 7 * 1500, .requests_sent = 1 } } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "all waiting datagrams are limited to 1 MiB", local_eth, Address( "10.0.0.1", 0 ) };
+
+      // 43 datagrams of 1500 bytes to each of 17 neighbours: only 11 of the last neighbour's fit
+      for ( size_t n = 0; n < 17; n++ ) {
+        const string next_hop = "10.0.1." + to_string( n );
+        for ( size_t i = 0; i < 43; i++ ) {
+          test.execute(
+            SendDatagram { make_datagram( "10.0.0.1", "13.0.0.1", 1500 ), Address( next_hop, 0 ) } );
+        }
+        test.execute( ExpectFrame { make_frame(
+          local_eth,
+          ETHERNET_BROADCAST,
+          EthernetHeader::TYPE_ARP,
+          serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", {}, next_hop ) ) ) } );
+      }
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingStats { { .queued_datagrams = 16 * 43 + 11,
+                                           .queued_bytes = ( 16 * 43 + 11 ) * 1500,
+                                           .dropped_datagrams = 32,
+                                           .dropped_bytes = 32 * 1500,
+                                           .requests_sent = 17 } } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "datagrams waiting for an unanswered ARP request are dropped", local_eth, Address( "10.0.0.1", 0 ) };
+
+      for ( size_t i = 0; i < 3; i++ ) {
+        test.execute( SendDatagram { make_datagram( "10.0.0.1", "13.0.0.1" ), Address( "10.0.0.7", 0 ) } );
+      }
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", {}, "10.0.0.7" ) ) ) } );
+      const size_t size = make_datagram( "10.0.0.1", "13.0.0.1" ).header.len;
+
+      test.execute( Tick { 5000 } );
+      test.execute( ExpectPendingStats { { .queued_datagrams = 3, .queued_bytes = 3 * size, .requests_sent = 1 } } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectPendingStats {
+        { .dropped_datagrams = 3, .dropped_bytes = 3 * size, .requests_sent = 1 } } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "broadcast ARP requests are limited to 1000 a second", local_eth, Address( "10.0.0.1", 0 ) };
+
+      const auto next_hop = []( const size_t i ) {
+        return "10.1." + to_string( i / 256 ) + "." + to_string( i % 256 );
+      };
+      const auto request = [&]( const size_t i ) {
+        return make_frame(
+          local_eth,
+          ETHERNET_BROADCAST,
+          EthernetHeader::TYPE_ARP,
+          serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "10.0.0.1", {}, next_hop( i ) ) ) );
+      };
+      const auto datagram = make_datagram( "10.0.0.1", "13.0.0.1" );
+      const size_t size = datagram.header.len;
+
+      // a burst of 1000 new neighbours is asked at once
+      for ( size_t i = 0; i < 1000; i++ ) {
+        test.execute( SendDatagram { datagram, Address( next_hop( i ), 0 ) } );
+        test.execute( ExpectFrame { request( i ) } );
+      }
+
+      // then the next is not asked (and its datagram is dropped), until a request's worth of time has passed
+      test.execute( SendDatagram { datagram, Address( next_hop( 1000 ), 0 ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingStats { { .queued_datagrams = 1000,
+                                           .queued_bytes = 1000 * size,
+                                           .dropped_datagrams = 1,
+                                           .dropped_bytes = size,
+                                           .requests_sent = 1000,
+                                           .requests_suppressed = 1 } } );
+      test.execute( Tick { 1 } );
+      test.execute( SendDatagram { datagram, Address( next_hop( 1000 ), 0 ) } );
+      test.execute( ExpectFrame { request( 1000 ) } );
+      test.execute( SendDatagram { datagram, Address( next_hop( 1001 ), 0 ) } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "reassembly up to the largest datagram", local_eth, Address( "10.0.0.1", 0 ) };
+      const auto fragment_frame = [&]( const size_t offset, const bool more, string payload ) {
+        return make_frame( remote_eth,
+                           local_eth,
+                           EthernetHeader::TYPE_IPv4,
+                           serialize( make_fragment( "10.0.0.2", "10.0.0.1", offset, more, std::move( payload ) ) ) );
+      };
+
+      // payloads ending at 65,515 bytes: with the 20-byte header, a datagram of exactly 65,535 bytes
+      const string first( 32760, 'a' );
+      const string last( 32755, 'b' );
+      test.execute( ReceiveFrame { fragment_frame( 0, true, first ), {} } );
+      test.execute( ReceiveFrame { fragment_frame( first.size(), false, last ),
+                                   make_fragment( "10.0.0.2", "10.0.0.1", 0, false, first + last ) } );
+      test.execute( ExpectReassemblyStats { { .reassembled = 1 } } );
+
+      // 5 bytes more would not fit in the total length field with the header: the fragment is dropped
+      test.execute( ReceiveFrame { fragment_frame( 0, true, first ), {} } );
+      test.execute( ReceiveFrame { fragment_frame( first.size(), false, last + "bbbbb" ), {} } );
+      test.execute( ExpectReassemblyStats {
+        { .pending_datagrams = 1, .pending_bytes = first.size(), .reassembled = 1, .malformed = 1 } } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "datagrams larger than the MTU are sent as fragments", local_eth, Address( "10.0.0.1", 0 ) };
+      test.execute( ReceiveFrame {
+        make_frame(
+          remote_eth,
+          local_eth,
+          EthernetHeader::TYPE_ARP, // NOLINTNEXTLINE(*-suspicious-*)
+          serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "10.0.0.2", local_eth, "10.0.0.1" ) ) ),
+        {} } );
+      test.execute( SetMTU { 576 } );
+
+      string payload( 1480, 0 );
+      for ( size_t i = 0; i < payload.size(); i++ ) {
+        payload[i] = static_cast<char>( 'a' + i % 26 );
+      }
+      const auto fragment_frame = [&]( const size_t offset, const bool more, const size_t length ) {
+        return make_frame(
+          local_eth,
+          remote_eth,
+          EthernetHeader::TYPE_IPv4,
+          serialize( make_fragment( "10.0.0.1", "13.0.0.1", offset, more, payload.substr( offset, length ) ) ) );
+      };
+
+      // each fragment carries as much as fits in the MTU, in a multiple of 8 bytes
+      test.execute(
+        SendDatagram { make_fragment( "10.0.0.1", "13.0.0.1", 0, false, payload ), Address( "10.0.0.2", 0 ) } );
+      test.execute( ExpectFrame { fragment_frame( 0, true, 552 ) } );
+      test.execute( ExpectFrame { fragment_frame( 552, true, 552 ) } );
+      test.execute( ExpectFrame { fragment_frame( 1104, false, 376 ) } );
+      test.execute( ExpectNoFrame {} );
+
+      // a datagram that fits is sent whole, even with the don't-fragment flag
+      const auto fits = make_datagram( "10.0.0.1", "13.0.0.1", 576 );
+      test.execute( SendDatagram { fits, Address( "10.0.0.2", 0 ) } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( fits ) ) } );
+
+      // one byte more, and it is dropped
+      test.execute( SendDatagram { make_datagram( "10.0.0.1", "13.0.0.1", 577 ), Address( "10.0.0.2", 0 ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectFragmentStats { { .fragmented = 1, .fragments = 3, .dropped_too_big = 1 } } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "only fragments addressed to the interface are reassembled", local_eth, Address( "10.0.0.1", 0 ) };
+      const auto fragment_frame = [&]( const string& dst_ip, const size_t offset, const bool more, string payload ) {
+        return make_frame( remote_eth,
+                           local_eth,
+                           EthernetHeader::TYPE_IPv4,
+                           serialize( make_fragment( "10.0.0.2", dst_ip, offset, more, std::move( payload ) ) ) );
+      };
+
+      // out of order, with a duplicate
+      test.execute( ReceiveFrame { fragment_frame( "10.0.0.1", 16, false, "cccc" ), {} } );
+      test.execute( ReceiveFrame { fragment_frame( "10.0.0.1", 8, true, "bbbbbbbb" ), {} } );
+      test.execute( ReceiveFrame { fragment_frame( "10.0.0.1", 16, false, "cccc" ), {} } );
+      test.execute( ReceiveFrame { fragment_frame( "10.0.0.1", 0, true, "aaaaaaaa" ),
+                                   make_fragment( "10.0.0.2", "10.0.0.1", 0, false, "aaaaaaaabbbbbbbbcccc" ) } );
+      test.execute( ExpectReassemblyStats { { .reassembled = 1 } } );
+
+      // a fragment passing through is passed up as it is (for a router to forward)
+      test.execute( ReceiveFrame { fragment_frame( "10.0.0.9", 8, true, "bbbbbbbb" ),
+                                   make_fragment( "10.0.0.2", "10.0.0.9", 8, true, "bbbbbbbb" ) } );
+      test.execute( ExpectReassemblyStats { { .reassembled = 1 } } );
+
+      // an incomplete datagram is given up 30 seconds after its first fragment
+      test.execute( ReceiveFrame { fragment_frame( "10.0.0.1", 0, true, "aaaaaaaa" ), {} } );
+      test.execute( Tick { IPv4Reassembler::TIMEOUT - 1 } );
+      test.execute( ExpectReassemblyStats { { .pending_datagrams = 1, .pending_bytes = 8, .reassembled = 1 } } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectReassemblyStats { { .reassembled = 1, .timed_out = 1 } } );
+    }
+
+    for ( const bool ecn : { false, true } ) {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { ecn ? "FQ-CoDel marks a flow delayed for an interval"
+                                             : "FQ-CoDel drops from a flow delayed for an interval",
+                                         local_eth,
+                                         Address( "10.0.0.1", 0 ) };
+      test.execute( ReceiveFrame {
+        make_frame(
+          remote_eth,
+          local_eth,
+          EthernetHeader::TYPE_ARP, // NOLINTNEXTLINE(*-suspicious-*)
+          serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "10.0.0.2", local_eth, "10.0.0.1" ) ) ),
+        {} } );
+      test.execute( EnableFQCoDel { { .ecn = ecn } } );
+
+      // full-size datagrams of one flow, ECN-capable if marking is enabled
+      const auto datagram = [&]( const uint16_t id, const bool congestion_experienced = false ) {
+        InternetDatagram dgram = make_datagram( "10.0.0.1", "13.0.0.1", 1500 );
+        dgram.header.id = id;
+        dgram.header.tos = congestion_experienced ? 0x03 : ecn ? 0x02 : 0;
+        dgram.header.compute_checksum();
+        return dgram;
+      };
+      const auto frame = [&]( const InternetDatagram& dgram ) {
+        return make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( dgram ) );
+      };
+      for ( uint16_t id = 0; id < 5; id++ ) {
+        test.execute( SendDatagram { datagram( id ), Address( "10.0.0.2", 0 ) } );
+      }
+
+      // waiting longer than the 5 ms target starts the 100 ms interval...
+      test.execute( Tick { 200 } );
+      test.execute( ExpectFrame { frame( datagram( 0 ) ) } );
+
+      // ...after which the next datagram is dropped (or marked)
+      test.execute( Tick { 100 } );
+      if ( ecn ) {
+        test.execute( ExpectFrame { frame( datagram( 1, true ) ) } );
+      }
+      test.execute( ExpectFrame { frame( datagram( 2 ) ) } );
+
+      // with no more than a quantum left waiting, the delay no longer counts
+      test.execute( ExpectFrame { frame( datagram( 3 ) ) } );
+      test.execute( ExpectFrame { frame( datagram( 4 ) ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectOutputQueueStats { { .enqueued = 5,
+                                               .dequeued = ecn ? 5U : 4U,
+                                               .dropped_codel = ecn ? 0U : 1U,
+                                               .marked = ecn ? 1U : 0U } } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "FQ-CoDel drops the oldest frames over its limit", local_eth, Address( "10.0.0.1", 0 ) };
+      test.execute( ReceiveFrame {
+        make_frame(
+          remote_eth,
+          local_eth,
+          EthernetHeader::TYPE_ARP, // NOLINTNEXTLINE(*-suspicious-*)
+          serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "10.0.0.2", local_eth, "10.0.0.1" ) ) ),
+        {} } );
+      test.execute( EnableFQCoDel { { .limit = 10 } } );
+
+      const auto datagram = [&]( const string& dst_ip, const uint16_t id, const size_t length ) {
+        InternetDatagram dgram = make_datagram( "10.0.0.1", dst_ip, length );
+        dgram.header.id = id;
+        dgram.header.compute_checksum();
+        return dgram;
+      };
+      const auto frame = [&]( const InternetDatagram& dgram ) {
+        return make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( dgram ) );
+      };
+
+      // a flow that ignores congestion only fills the queue to its limit, losing its oldest frames...
+      for ( uint16_t id = 0; id < 15; id++ ) {
+        test.execute( SendDatagram { datagram( "13.0.0.1", id, 1500 ), Address( "10.0.0.2", 0 ) } );
+      }
+      test.execute( ExpectFrame { frame( datagram( "13.0.0.1", 5, 1500 ) ) } );
+
+      // ...and a new flow still goes ahead of it
+      test.execute( SendDatagram { datagram( "13.0.0.2", 100, 100 ), Address( "10.0.0.2", 0 ) } );
+      test.execute( ExpectFrame { frame( datagram( "13.0.0.2", 100, 100 ) ) } );
+      test.execute( ExpectFrame { frame( datagram( "13.0.0.1", 6, 1500 ) ) } );
+      test.execute( ExpectOutputQueueStats {
+        { .backlog_items = 8, .backlog_bytes = 8 * 1514, .enqueued = 16, .dequeued = 3, .dropped_overlimit = 5 } } );
+    }
+
+    check_fragment_round_trip( 1234 );
+    check_reassembly_limits();
+    check_batch_receive();
+    check_fq_codel_delay();
   } catch ( const exception& e ) {
     cerr << e.what() << endl;
     return EXIT_FAILURE;
@@ -125,6 +125,132 @@ struct ExpectNoFrame : public Expectation<NetworkInterface>
   }
 };
 
+struct ExpectPendingStats : public Expectation<NetworkInterface>
+{
+  NetworkInterface::PendingStats expected;
+
+  static std::string describe( const NetworkInterface::PendingStats& stats )
+  {
+    return "queued=" + std::to_string( stats.queued_datagrams ) + " (" + std::to_string( stats.queued_bytes )
+           + " bytes), dropped=" + std::to_string( stats.dropped_datagrams ) + " ("
+           + std::to_string( stats.dropped_bytes ) + " bytes), requests_sent=" + std::to_string( stats.requests_sent )
+           + ", requests_suppressed=" + std::to_string( stats.requests_suppressed );
+  }
+
+  std::string description() const override { return "pending stats: " + describe( expected ); }
+  void execute( NetworkInterface& interface ) const override
+  {
+    const auto& actual = interface.pending_stats();
+    if ( actual.queued_datagrams != expected.queued_datagrams or actual.queued_bytes != expected.queued_bytes
+         or actual.dropped_datagrams != expected.dropped_datagrams or actual.dropped_bytes != expected.dropped_bytes
+         or actual.requests_sent != expected.requests_sent
+         or actual.requests_suppressed != expected.requests_suppressed ) {
+      throw ExpectationViolation( "NetworkInterface's pending stats were " + describe( actual ) );
+    }
+  }
+
+  explicit ExpectPendingStats( const NetworkInterface::PendingStats& e ) : expected( e ) {}
+};
+
+struct ExpectReassemblyStats : public Expectation<NetworkInterface>
+{
+  IPv4Reassembler::Stats expected;
+
+  static std::string describe( const IPv4Reassembler::Stats& stats )
+  {
+    return "pending=" + std::to_string( stats.pending_datagrams ) + " (" + std::to_string( stats.pending_bytes )
+           + " bytes), reassembled=" + std::to_string( stats.reassembled ) + ", timed_out="
+           + std::to_string( stats.timed_out ) + ", evicted=" + std::to_string( stats.evicted )
+           + ", malformed=" + std::to_string( stats.malformed );
+  }
+
+  std::string description() const override { return "reassembly stats: " + describe( expected ); }
+  void execute( NetworkInterface& interface ) const override
+  {
+    const auto& actual = interface.reassembly_stats();
+    if ( actual.pending_datagrams != expected.pending_datagrams or actual.pending_bytes != expected.pending_bytes
+         or actual.reassembled != expected.reassembled or actual.timed_out != expected.timed_out
+         or actual.evicted != expected.evicted or actual.malformed != expected.malformed ) {
+      throw ExpectationViolation( "NetworkInterface's reassembly stats were " + describe( actual ) );
+    }
+  }
+
+  explicit ExpectReassemblyStats( const IPv4Reassembler::Stats& e ) : expected( e ) {}
+};
+
+struct ExpectFragmentStats : public Expectation<NetworkInterface>
+{
+  NetworkInterface::FragmentStats expected;
+
+  static std::string describe( const NetworkInterface::FragmentStats& stats )
+  {
+    return "fragmented=" + std::to_string( stats.fragmented ) + ", fragments=" + std::to_string( stats.fragments )
+           + ", dropped_too_big=" + std::to_string( stats.dropped_too_big );
+  }
+
+  std::string description() const override { return "fragment stats: " + describe( expected ); }
+  void execute( NetworkInterface& interface ) const override
+  {
+    const auto& actual = interface.fragment_stats();
+    if ( actual.fragmented != expected.fragmented or actual.fragments != expected.fragments
+         or actual.dropped_too_big != expected.dropped_too_big ) {
+      throw ExpectationViolation( "NetworkInterface's fragment stats were " + describe( actual ) );
+    }
+  }
+
+  explicit ExpectFragmentStats( const NetworkInterface::FragmentStats& e ) : expected( e ) {}
+};
+
+struct ExpectOutputQueueStats : public Expectation<NetworkInterface>
+{
+  NetworkInterface::OutputQueue::Stats expected;
+
+  static std::string describe( const NetworkInterface::OutputQueue::Stats& stats )
+  {
+    return "backlog=" + std::to_string( stats.backlog_items ) + " (" + std::to_string( stats.backlog_bytes )
+           + " bytes), enqueued=" + std::to_string( stats.enqueued ) + ", dequeued="
+           + std::to_string( stats.dequeued ) + ", dropped_overlimit=" + std::to_string( stats.dropped_overlimit )
+           + ", dropped_codel=" + std::to_string( stats.dropped_codel ) + ", marked=" + std::to_string( stats.marked );
+  }
+
+  std::string description() const override { return "output queue stats: " + describe( expected ); }
+  void execute( NetworkInterface& interface ) const override
+  {
+    const auto actual = interface.output_queue_stats();
+    if ( actual.backlog_items != expected.backlog_items or actual.backlog_bytes != expected.backlog_bytes
+         or actual.enqueued != expected.enqueued or actual.dequeued != expected.dequeued
+         or actual.dropped_overlimit != expected.dropped_overlimit
+         or actual.dropped_codel != expected.dropped_codel or actual.marked != expected.marked ) {
+      throw ExpectationViolation( "NetworkInterface's output queue stats were " + describe( actual ) );
+    }
+  }
+
+  explicit ExpectOutputQueueStats( const NetworkInterface::OutputQueue::Stats& e ) : expected( e ) {}
+};
+
+struct EnableFQCoDel : public Action<NetworkInterface>
+{
+  NetworkInterface::OutputQueue::Config config;
+
+  std::string description() const override
+  {
+    return "FQ-CoDel enabled (limit " + std::to_string( config.limit ) + ( config.ecn ? ", with ECN)" : ")" );
+  }
+  void execute( NetworkInterface& interface ) const override { interface.enable_fq_codel( config ); }
+
+  explicit EnableFQCoDel( const NetworkInterface::OutputQueue::Config& c = {} ) : config( c ) {}
+};
+
+struct SetMTU : public Action<NetworkInterface>
+{
+  size_t mtu;
+
+  std::string description() const override { return "MTU set to " + std::to_string( mtu ); }
+  void execute( NetworkInterface& interface ) const override { interface.set_mtu( mtu ); }
+
+  explicit SetMTU( const size_t m ) : mtu( m ) {}
+};
+
 struct Tick : public Action<NetworkInterface>
 {
   size_t _ms;
@@ -135,7 +261,7 @@ struct Tick : public Action<NetworkInterface>
   explicit Tick( const size_t ms ) : _ms( ms ) {}
 };
 
-inline std::string concat( std::vector<Buffer>& buffers )
+inline std::string concat( const std::vector<Buffer>& buffers )
 {
   return std::accumulate(
     buffers.begin(), buffers.end(), std::string {}, []( const std::string& x, const Buffer& y ) {
@@ -0,0 +1,112 @@
+#include "ethernet_frame.hh"
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+#include "tcp_segment.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+// An Ethernet frame carrying an IPv4 datagram carrying a TCP segment with no payload
+string make_frame()
+{
+  TCPSegment seg;
+  seg.udinfo = { 54321, 8080, 0 };
+  seg.sender_message.seqno = Wrap32 { 12345 };
+  seg.receiver_message = { Wrap32 { 67890 }, 9987 };
+
+  InternetDatagram dgram;
+  dgram.header.src = 0x0a000001;
+  dgram.header.dst = 0x0a000002;
+  dgram.header.len = IPv4Header::LENGTH + 20;
+  dgram.header.compute_checksum();
+  seg.compute_checksum( dgram.header.pseudo_checksum() );
+  dgram.payload = serialize( seg );
+
+  EthernetFrame frame;
+  frame.header = { { 2, 0, 0, 0, 0, 1 }, { 2, 0, 0, 0, 0, 2 }, EthernetHeader::TYPE_IPv4 };
+  frame.payload = serialize( dgram );
+
+  string ret;
+  for ( const auto& buf : serialize( frame ) ) {
+    ret.append( string_view { buf } );
+  }
+  return ret;
+}
+
+void speed_test( const vector<Buffer>& input, const string& layout, const size_t iterations )
+{
+  uint64_t checksum = 0;
+
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; ++i ) {
+    EthernetFrame frame;
+    InternetDatagram dgram;
+    TCPSegment seg;
+    if ( not parse( frame, input ) or not parse( dgram, frame.payload )
+         or not parse( seg, dgram.payload, dgram.header.pseudo_checksum() ) ) {
+      throw runtime_error( "frame failed to parse" );
+    }
+    checksum += seg.udinfo.src_port;
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( checksum != uint64_t { 54321 } * iterations ) {
+    throw runtime_error( "wrong value parsed" );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto frames_per_second = static_cast<double>( iterations ) / test_duration.count();
+  auto ns_per_frame = 1e9 / frames_per_second;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Parsing Ethernet+IPv4+TCP headers (" << layout << ") reached " << fixed << setprecision( 2 )
+       << frames_per_second / 1e6 << " Mframes/s (" << ns_per_frame << " ns/frame).\n";
+
+  debug_output << "             Header parsing (" << layout << "): " << fixed << setprecision( 2 )
+               << frames_per_second / 1e6 << " Mframes/s\n";
+
+  if ( frames_per_second < 1e5 ) {
+    throw runtime_error( "Parser did not meet minimum speed of 0.1 Mframes/s." );
+  }
+}
+
+void program_body()
+{
+  const string frame = make_frame();
+
+  // the whole frame in one buffer
+  speed_test( { frame }, "contiguous", 1'000'000 );
+
+  // the frame split the way a TAP device read fills it, plus a split inside the IPv4 header
+  speed_test( { frame.substr( 0, EthernetHeader::LENGTH ),
+                frame.substr( EthernetHeader::LENGTH, 11 ),
+                frame.substr( EthernetHeader::LENGTH + 11 ) },
+              "split",
+              1'000'000 );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,10 +1,19 @@
 #include "router.hh"
 #include "arp_message.hh"
+#include "lpm_trie.hh"
 #include "network_interface_test_harness.hh"
 #include "random.hh"
+#include "shaper_load.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_segment.hh"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
 #include <list>
+#include <optional>
+#include <random>
 #include <unordered_map>
 #include <utility>
 
@@ -326,10 +335,649 @@ void network_simulator()
   cout << "\n\n\033[32;1mCongratulations! All datagrams were routed successfully.\033[m\n";
 }
 
+// Helpers for tests that drive a Router's interfaces directly
+
+EthernetAddress router_ethernet_address( const size_t i )
+{
+  return { 0x02, 0, 0, 0, 0, static_cast<uint8_t>( i ) };
+}
+
+EthernetAddress neighbour_ethernet_address( const size_t i )
+{
+  return { 0x02, 0, 0, 0, 1, static_cast<uint8_t>( i ) };
+}
+
+// Router interface `i` is 10.0.i.1/24, and its neighbour (which it has learned by ARP) 10.0.i.2
+uint32_t router_ip( const size_t i )
+{
+  return ip( "10.0.0.1" ) + static_cast<uint32_t>( i << 8 );
+}
+
+uint32_t neighbour_ip( const size_t i )
+{
+  return router_ip( i ) + 1;
+}
+
+void add_interfaces( Router& router, const size_t count )
+{
+  for ( size_t i = 0; i < count; i++ ) {
+    router.add_interface( { router_ethernet_address( i ), Address::from_ipv4_numeric( router_ip( i ) ) } );
+
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REPLY;
+    arp.sender_ethernet_address = neighbour_ethernet_address( i );
+    arp.sender_ip_address = neighbour_ip( i );
+    arp.target_ethernet_address = router_ethernet_address( i );
+    arp.target_ip_address = router_ip( i );
+    router.interface( i ).recv_frame(
+      { { router_ethernet_address( i ), neighbour_ethernet_address( i ), EthernetHeader::TYPE_ARP },
+        serialize( arp ) } );
+  }
+}
+
+InternetDatagram make_datagram( const uint32_t src, const uint32_t dst, const uint8_t ttl = 64 )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.ttl = ttl;
+  dgram.header.proto = 17;
+  dgram.payload.emplace_back( string { "payload" } );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + dgram.payload.back().size();
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// A frame from the neighbour on interface `i` to the router
+EthernetFrame frame_to_router( const size_t i, const InternetDatagram& dgram )
+{
+  return { { router_ethernet_address( i ), neighbour_ethernet_address( i ), EthernetHeader::TYPE_IPv4 },
+           serialize( dgram ) };
+}
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( what );
+  }
+}
+
+// Routes are looked up in a multibit trie: it must agree with a linear scan for the longest match (the first of
+// equal-length matches winning), with many overlapping prefixes inserted in any order
+void longest_prefix_match()
+{
+  cerr << "\033[32;1m\n\nTesting longest-prefix match...\033[m\n\n";
+  default_random_engine rd { 1234 };
+  const auto mask = []( const uint8_t length ) { return length == 0 ? 0 : UINT32_MAX << ( 32 - length ); };
+  // (addresses clustered in a small part of the address space, so that the prefixes overlap)
+  const auto random_address = [&] { return ip( "10.0.0.0" ) | ( static_cast<uint32_t>( rd() ) & 0x0003ffff ); };
+
+  vector<pair<uint32_t, uint8_t>> prefixes;
+  for ( size_t i = 0; i < 1000; i++ ) {
+    const auto length = static_cast<uint8_t>( uniform_int_distribution<int> { 0, 32 }( rd ) );
+    prefixes.emplace_back( random_address() & mask( length ), length );
+  }
+
+  // The first `count` prefixes' longest match for `address`, by linear scan
+  const auto reference_lookup = [&]( const size_t count, const uint32_t address ) {
+    optional<uint32_t> ret;
+    int best_length = -1;
+    for ( size_t i = 0; i < count; i++ ) {
+      const auto [prefix, length] = prefixes[i];
+      if ( ( address & mask( length ) ) == prefix and length > best_length ) {
+        ret = i;
+        best_length = length;
+      }
+    }
+    return ret;
+  };
+
+  // Check along the way too, since a short prefix inserted late has to be pushed into existing child nodes
+  LPMTrie trie;
+  for ( size_t i = 0; i < prefixes.size(); i++ ) {
+    trie.insert( prefixes[i].first, prefixes[i].second, i );
+    if ( i % 50 == 0 ) {
+      for ( size_t j = 0; j < 50; j++ ) {
+        const uint32_t address = random_address();
+        expect( trie.lookup( address ) == reference_lookup( i + 1, address ),
+                "LPMTrie lookup disagrees with linear scan" );
+      }
+    }
+  }
+
+  for ( size_t i = 0; i < 2000; i++ ) {
+    const uint32_t address = i % 2 ? static_cast<uint32_t>( rd() ) : random_address();
+    expect( trie.lookup( address ) == reference_lookup( prefixes.size(), address ),
+            "LPMTrie lookup disagrees with linear scan" );
+  }
+}
+
+// A datagram whose frame is handed to the router has its TTL decremented in the frame's own buffer; one whose
+// frame is still held elsewhere is copied first, leaving the holder's bytes alone
+void forwarding_in_place()
+{
+  cerr << "\033[32;1m\n\nTesting in-place forwarding...\033[m\n\n";
+  Router router;
+  add_interfaces( router, 2 );
+  router.add_route( router_ip( 1 ) & 0xffffff00, 24, {}, 1 );
+
+  EthernetFrame handed_over = frame_to_router( 0, make_datagram( neighbour_ip( 0 ), neighbour_ip( 1 ) ) );
+  const char* bytes = string_view { handed_over.payload.front() }.data();
+  router.interface( 0 ).recv_frame( std::move( handed_over ) );
+  router.route();
+  auto sent = router.interface( 1 ).maybe_send();
+  expect( sent.has_value(), "router did not forward a datagram" );
+  expect( string_view { sent->payload.front() }.data() == bytes, "router copied a datagram it was handed" );
+
+  InternetDatagram forwarded;
+  expect( parse( forwarded, sent->payload ) and forwarded.header.ttl == 63, "router did not decrement the TTL" );
+
+  const EthernetFrame held = frame_to_router( 0, make_datagram( neighbour_ip( 0 ), neighbour_ip( 1 ) ) );
+  router.interface( 0 ).recv_frame( held );
+  router.route();
+  sent = router.interface( 1 ).maybe_send();
+  expect( sent.has_value(), "router did not forward a datagram" );
+  InternetDatagram original;
+  expect( parse( original, held.payload ) and original.header.ttl == 64, "router wrote into a shared frame" );
+  expect( parse( forwarded, sent->payload ) and forwarded.header.ttl == 63, "router did not decrement the TTL" );
+
+  // A batch of frames is handed over as a whole
+  vector<EthernetFrame> batch;
+  vector<const char*> batch_bytes;
+  for ( uint32_t i = 0; i < 4; i++ ) {
+    batch.push_back( frame_to_router( 0, make_datagram( neighbour_ip( 0 ) + i, neighbour_ip( 1 ) ) ) );
+    batch_bytes.push_back( string_view { batch.back().payload.front() }.data() );
+  }
+  router.interface( 0 ).recv_frames( batch );
+  router.route();
+  for ( const char* expected : batch_bytes ) {
+    sent = router.interface( 1 ).maybe_send();
+    expect( sent.has_value(), "router did not forward a batch of datagrams" );
+    expect( string_view { sent->payload.front() }.data() == expected, "router copied a batch it was handed" );
+  }
+}
+
+// A datagram too big for its egress link (with the don't-fragment flag) is dropped, and the router sends its
+// source an ICMP error: routed like the router's own datagrams, with the TTL it was made with, and counted apart
+// from the datagrams it forwards
+void icmp_errors()
+{
+  cerr << "\033[32;1m\n\nTesting ICMP errors for datagrams too big for the link...\033[m\n\n";
+  Router router;
+  add_interfaces( router, 2 );
+  router.add_route( router_ip( 0 ) & 0xffffff00, 24, {}, 0 );
+  router.add_route( router_ip( 1 ) & 0xffffff00, 24, {}, 1 );
+  router.interface( 1 ).set_mtu( NetworkInterface::MIN_MTU );
+
+  const auto too_big = [&]( const uint32_t src ) {
+    InternetDatagram dgram = make_datagram( src, neighbour_ip( 1 ), 2 );
+    dgram.payload = { string( 100, 'x' ) };
+    dgram.header.len = static_cast<uint16_t>( dgram.header.hlen * 4 + 100 );
+    dgram.header.compute_checksum();
+    return frame_to_router( 0, dgram );
+  };
+  router.interface( 0 ).recv_frame( too_big( neighbour_ip( 0 ) ) );
+  router.interface( 0 ).recv_frame( too_big( ip( "192.168.0.1" ) ) ); // (no route back to it)
+  router.route();
+
+  expect( not router.interface( 1 ).maybe_send().has_value(), "router forwarded a datagram too big for the link" );
+  const auto sent = router.interface( 0 ).maybe_send();
+  expect( sent.has_value(), "router did not send an ICMP error" );
+  expect( not router.interface( 0 ).maybe_send().has_value(), "router sent an ICMP error with no route" );
+  InternetDatagram error;
+  expect( parse( error, sent->payload ) and error.header.proto == IPv4Header::PROTO_ICMP
+            and error.header.dst == neighbour_ip( 0 ) and error.header.ttl == IPv4Header::DEFAULT_TTL,
+          "router sent a bad ICMP error" );
+
+  const auto counters = router.snapshot().counters;
+  expect( counters.routed == 2 and counters.dropped_too_big == 2 and counters.dropped_no_route == 0
+            and counters.dropped_ttl == 0 and counters.icmp_errors == 2 and counters.icmp_errors_sent == 1,
+          "router miscounted ICMP errors" );
+}
+
+// Flows are spread over a multipath route's next hops by weight, and stay on their next hop (unless it was
+// removed or its share shrank) when the next hops change
+void multipath_spread()
+{
+  cerr << "\033[32;1m\n\nTesting how multipath routes spread flows...\033[m\n\n";
+  constexpr size_t INTERFACES = 4;
+  constexpr uint32_t FLOWS = 4096;
+  Router router;
+  add_interfaces( router, INTERFACES + 1 );
+  const uint32_t prefix = ip( "10.99.0.0" );
+  const uint32_t first_source = ip( "192.168.0.0" );
+
+  // Next hops on interfaces 1 to 4 (datagrams arrive on interface 0), with the given weights (zero for none)
+  const auto set_next_hops = [&]( const array<uint32_t, INTERFACES>& weights ) {
+    vector<NextHop> next_hops;
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      if ( weights.at( i ) ) {
+        next_hops.push_back( { Address::from_ipv4_numeric( neighbour_ip( i + 1 ) ), i + 1, weights.at( i ) } );
+      }
+    }
+    router.add_route( prefix, 16, next_hops );
+  };
+
+  // Send a datagram of each flow (from a source address of its own), and return the next hop each was sent to
+  const auto next_hop_of_flows = [&] {
+    for ( uint32_t flow = 0; flow < FLOWS; flow++ ) {
+      router.interface( 0 ).recv_frame( frame_to_router( 0, make_datagram( first_source + flow, prefix | 1 ) ) );
+    }
+    router.route();
+
+    vector<size_t> next_hop( FLOWS, INTERFACES );
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      while ( auto frame = router.interface( i + 1 ).maybe_send() ) {
+        InternetDatagram dgram;
+        expect( parse( dgram, frame->payload ), "router sent a bad datagram" );
+        next_hop.at( dgram.header.src - first_source ) = i;
+      }
+    }
+    return next_hop;
+  };
+
+  const auto expect_spread = [&]( const vector<size_t>& next_hop, const array<uint32_t, INTERFACES>& weights ) {
+    const double total_weight = weights[0] + weights[1] + weights[2] + weights[3];
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      const double expected = FLOWS * weights.at( i ) / total_weight;
+      const auto n = static_cast<double>( ranges::count( next_hop, i ) );
+      expect( n >= expected * 0.8 and n <= expected * 1.2,
+              "multipath route sent " + to_string( n ) + " flows to next hop " + to_string( i ) + ", expected about "
+                + to_string( expected ) );
+    }
+  };
+
+  set_next_hops( { 1, 1, 1, 1 } );
+  const auto before = next_hop_of_flows();
+  expect_spread( before, { 1, 1, 1, 1 } );
+  expect( next_hop_of_flows() == before, "multipath route moved flows without a route change" );
+
+  // Remove next hop 3: only its flows may move
+  set_next_hops( { 1, 1, 1, 0 } );
+  const auto after = next_hop_of_flows();
+  expect_spread( after, { 1, 1, 1, 0 } );
+  for ( size_t flow = 0; flow < FLOWS; flow++ ) {
+    expect( before[flow] == 3 or after[flow] == before[flow],
+            "removing a next hop moved a flow between the remaining next hops" );
+  }
+
+  // Weighted next hops
+  set_next_hops( { 4, 2, 1, 1 } );
+  expect_spread( next_hop_of_flows(), { 4, 2, 1, 1 } );
+}
+
+// A multipath route added for the prefix of a single-path route replaces it
+void multipath_replaces_single_path()
+{
+  cerr << "\033[32;1m\n\nTesting a multipath route replacing a single-path route...\033[m\n\n";
+  Router router;
+  add_interfaces( router, 4 );
+  const uint32_t prefix = ip( "10.99.0.0" );
+  router.add_route( prefix, 16, Address::from_ipv4_numeric( neighbour_ip( 1 ) ), 1 );
+  router.add_route( prefix,
+                    16,
+                    { { Address::from_ipv4_numeric( neighbour_ip( 2 ) ), 2 },
+                      { Address::from_ipv4_numeric( neighbour_ip( 3 ) ), 3 } } );
+
+  constexpr size_t FLOWS = 64;
+  for ( uint32_t flow = 0; flow < FLOWS; flow++ ) {
+    router.interface( 0 ).recv_frame( frame_to_router( 0, make_datagram( ip( "10.0.0.100" ) + flow, prefix | 1 ) ) );
+  }
+  router.route();
+
+  array<size_t, 4> sent {};
+  for ( size_t i = 0; i < sent.size(); i++ ) {
+    while ( router.interface( i ).maybe_send() ) {
+      sent.at( i )++;
+    }
+  }
+  expect( sent[1] == 0, "the replaced single-path route was still used" );
+  expect( sent[2] > 0 and sent[3] > 0 and sent[2] + sent[3] == FLOWS, "the multipath route was not used" );
+  expect( router.snapshot().routes.size() == 1, "the multipath route was added as a second route" );
+
+  // A single-path route added next takes the replaced route's path, without disturbing the multipath route's
+  const uint32_t other_prefix = ip( "10.98.0.0" );
+  router.add_route( other_prefix, 16, Address::from_ipv4_numeric( neighbour_ip( 1 ) ), 1 );
+  for ( uint32_t flow = 0; flow < FLOWS; flow++ ) {
+    router.interface( 0 ).recv_frame( frame_to_router( 0, make_datagram( ip( "10.0.0.100" ) + flow, prefix | 1 ) ) );
+    router.interface( 0 ).recv_frame(
+      frame_to_router( 0, make_datagram( ip( "10.0.0.100" ) + flow, other_prefix | 1 ) ) );
+  }
+  router.route();
+
+  array<size_t, 4> resent {};
+  for ( size_t i = 0; i < resent.size(); i++ ) {
+    while ( router.interface( i ).maybe_send() ) {
+      resent.at( i )++;
+    }
+  }
+  expect( resent[1] == FLOWS, "the single-path route reusing a path was not used" );
+  expect( resent[2] == sent[2] and resent[3] == sent[3], "reusing a path moved the multipath route's flows" );
+}
+
+// A datagram with the don't-fragment flag too big for the next link is dropped, and the router tells the sender
+// the link's MTU; the sender's TCP adapter then sizes its segments to fit
+void path_mtu_discovery()
+{
+  cerr << "\033[32;1m\n\nTesting path MTU discovery...\033[m\n\n";
+  Router router;
+  add_interfaces( router, 2 );
+  router.add_route( router_ip( 0 ) & 0xffffff00, 24, {}, 0 );
+  router.add_route( router_ip( 1 ) & 0xffffff00, 24, {}, 1 );
+  router.interface( 1 ).set_mtu( 1000 );
+
+  TCPOverIPv4Adapter adapter;
+  adapter.config_mut().source = Address::from_ipv4_numeric( neighbour_ip( 0 ) );
+  adapter.config_mut().destination = Address::from_ipv4_numeric( neighbour_ip( 1 ) );
+
+  // Send a segment through the router; returns how many frames reached the peer, handing ICMP errors back
+  const auto send = [&]( const size_t payload_size ) {
+    TCPSegment seg;
+    seg.sender_message.payload = string( payload_size, 'x' );
+    router.interface( 0 ).recv_frame( frame_to_router( 0, adapter.wrap_tcp_in_ip( seg ) ) );
+    router.route();
+
+    while ( auto frame = router.interface( 0 ).maybe_send() ) {
+      InternetDatagram dgram;
+      if ( frame->header.type == EthernetHeader::TYPE_IPv4 and parse( dgram, frame->payload ) ) {
+        adapter.unwrap_tcp_in_ip( dgram );
+      }
+    }
+    size_t frames = 0;
+    while ( router.interface( 1 ).maybe_send() ) {
+      frames++;
+    }
+    return frames;
+  };
+
+  expect( adapter.max_payload_size() == 1460 and send( 1460 ) == 0,
+          "router forwarded a datagram too big for the link" );
+  expect( adapter.path_mtu() == 1000 and adapter.max_payload_size() == 960,
+          "TCPOverIPv4Adapter did not learn the path MTU from the router" );
+  expect( send( 960 ) == 1, "router did not forward a datagram that fits the path MTU" );
+  // A segment sized before the estimate was lowered goes without the don't-fragment flag
+  expect( send( 1460 ) == 2, "router did not fragment a retransmitted segment" );
+  adapter.tick( TCPOverIPv4Adapter::PATH_MTU_TIMEOUT );
+  expect( adapter.path_mtu() == TCPOverIPv4Adapter::DEFAULT_MTU, "TCPOverIPv4Adapter did not try the link MTU again" );
+
+  router.interface( 1 ).set_mtu( NetworkInterface::JUMBO_MTU );
+  bool refused = false;
+  try {
+    router.interface( 1 ).set_mtu( NetworkInterface::JUMBO_MTU + 1 );
+  } catch ( const runtime_error& ) {
+    refused = true;
+  }
+  expect( refused and router.interface( 1 ).mtu() == NetworkInterface::JUMBO_MTU,
+          "NetworkInterface accepted an MTU beyond jumbo frames" );
+}
+
+void expect_rate( const string& what, const double rate, const double expected )
+{
+  expect( abs( rate - expected ) <= expected * 0.02,
+          what + " was shaped to " + to_string( rate / 1e6 ) + " Mbit/s instead of " + to_string( expected / 1e6 ) );
+}
+
+// A link offered twice its rate is held to its rate (plus its initial burst), from Mbit/s to Gbit/s, with 1-ms
+// ticks; classes are held to their own limits, and share what the link allows beyond them
+void shaper_rates()
+{
+  cerr << "\033[32;1m\n\nTesting token-bucket shaping rates...\033[m\n\n";
+  constexpr uint64_t BURST = 64 * 1024;
+  constexpr uint64_t DURATION = 250;
+  for ( const uint64_t rate : { 10'000'000ULL, 1'000'000'000ULL, 10'000'000'000ULL } ) {
+    const size_t queue_limit = rate / 8 / 1500 / 500; // 2 ms
+    TestShaper shaper { { .limit = { rate, BURST }, .classes = { { .queue_limit = queue_limit } } } };
+    const auto rates = offer_load( shaper, 2.0 * static_cast<double>( rate ), DURATION );
+    expect_rate( "a link of " + to_string( rate / 1'000'000 ) + " Mbit/s",
+                 rates[0],
+                 static_cast<double>( rate + BURST * 8 * 1000 / DURATION ) );
+    expect( shaper.stats( 0 ).dropped > 0, "an overloaded link did not drop" );
+  }
+
+  TestShaper shaper {
+    { .limit = { 600'000'000, BURST },
+      .classes = { { .limit = { 200'000'000, BURST } }, { .limit = { 500'000'000, BURST } }, {} } } };
+  const auto rates = offer_load( shaper, 1e9, 1000 );
+  expect_rate( "a class limited to 200 Mbit/s", rates[0], 2e8 );
+  expect_rate( "a class sharing the rest of a 600 Mbit/s link", rates[1], 2e8 );
+  expect_rate( "an unlimited class sharing the rest of a 600 Mbit/s link", rates[2], 2e8 );
+}
+
+// A router shapes an interface's traffic by the classes its routes, or else the datagrams' DSCPs, choose
+void shaped_interface()
+{
+  cerr << "\033[32;1m\n\nTesting a shaped interface...\033[m\n\n";
+  Router router;
+  add_interfaces( router, 2 );
+  const uint32_t bulk_prefix = ip( "10.1.0.0" );  // class 1 by route
+  const uint32_t other_prefix = ip( "10.2.0.0" ); // class by DSCP
+  TableEntry bulk { bulk_prefix, 16, {}, 1 };
+  bulk.traffic_class_ = 1;
+  router.add_routes( { bulk, { other_prefix, 16, {}, 1 } } );
+
+  // 12 Mbit/s (1500 bytes a ms), of which bulk may use 1.2 Mbit/s (1500 bytes every 10 ms); DSCP 46 (expedited
+  // forwarding) is class 0, and the rest class 2
+  AsyncNetworkInterface::Shaper::Config config { .limit = { 12'000'000, 1500 },
+                                                 .classes = { {},
+                                                              { .limit = { 1'200'000, 0 }, .queue_limit = 4 },
+                                                              { .queue_limit = 100 } } };
+  config.dscp_classes.fill( 2 );
+  config.dscp_classes[46] = 0;
+  router.interface( 1 ).set_shaper( config );
+
+  const auto full_size = [&]( const uint32_t dst, const uint8_t dscp ) {
+    InternetDatagram dgram = make_datagram( neighbour_ip( 0 ), dst );
+    dgram.header.tos = static_cast<uint8_t>( dscp << 2 );
+    dgram.payload = { string( 1500 - IPv4Header::LENGTH, 'x' ) };
+    dgram.header.len = 1500;
+    dgram.header.compute_checksum();
+    return frame_to_router( 0, dgram );
+  };
+  for ( size_t i = 0; i < 10; i++ ) {
+    router.interface( 0 ).recv_frame( full_size( bulk_prefix | 1, 46 ) );
+    router.interface( 0 ).recv_frame( full_size( other_prefix | 1, 46 ) );
+    router.interface( 0 ).recv_frame( full_size( other_prefix | 1, 0 ) );
+  }
+  router.route();
+
+  vector<EthernetFrame> sent;
+  router.interface( 1 ).drain_frames( sent );
+  const auto& shaper = *router.interface( 1 ).shaper();
+  expect( sent.size() == 2 and shaper.stats( 1 ).passed == 1 and shaper.stats( 0 ).passed == 1,
+          "shaped router sent " + to_string( sent.size() ) + " datagrams at once" );
+  expect( shaper.stats( 1 ).queued == 4 and shaper.stats( 1 ).dropped == 5 and shaper.stats( 0 ).queued == 9
+            and shaper.stats( 2 ).queued == 10,
+          "shaped router did not queue the datagrams by class" );
+
+  // One datagram a ms from then on, bulk only every 10 ms
+  for ( size_t ms = 1; ms <= 40; ms++ ) {
+    sent.clear();
+    router.interface( 1 ).tick( 1 );
+    router.interface( 1 ).drain_frames( sent );
+    expect( sent.size() <= 1, "shaped router sent " + to_string( sent.size() ) + " datagrams in a ms" );
+  }
+  expect( shaper.stats( 1 ).delayed == 4 and shaper.stats( 0 ).delayed == 9 and shaper.stats( 2 ).delayed == 10,
+          "shaped router did not release the queued datagrams" );
+
+  // Worker threads shape what they forward: which classes go first depends on the order the flows reach the
+  // shaper, but the link's burst still lets only two through at once
+  const auto total = [&]( uint64_t AsyncNetworkInterface::Shaper::ClassStats::* field ) {
+    uint64_t sum = 0;
+    for ( size_t c = 0; c < shaper.classes(); c++ ) {
+      sum += shaper.stats( c ).*field;
+    }
+    return sum;
+  };
+  const uint64_t passed = total( &AsyncNetworkInterface::Shaper::ClassStats::passed );
+  const uint64_t dropped = total( &AsyncNetworkInterface::Shaper::ClassStats::dropped );
+  router.interface( 1 ).tick( 100 ); // (the buckets fill up again)
+  router.set_worker_threads( 2 );
+  for ( size_t i = 0; i < 10; i++ ) {
+    router.interface( 0 ).recv_frame( full_size( bulk_prefix | 1, 46 ) );
+    router.interface( 0 ).recv_frame( full_size( other_prefix | 1, 46 ) );
+    router.interface( 0 ).recv_frame( full_size( other_prefix | 1, 0 ) );
+  }
+  router.route();
+  router.finish_routing();
+  const uint64_t passed_now = total( &AsyncNetworkInterface::Shaper::ClassStats::passed ) - passed;
+  const uint64_t waiting = total( &AsyncNetworkInterface::Shaper::ClassStats::queued )
+                           + total( &AsyncNetworkInterface::Shaper::ClassStats::dropped ) - dropped;
+  expect( passed_now == 2 and passed_now + waiting == 30,
+          "shaped router's workers let " + to_string( passed_now ) + " datagrams through at once, and queued or "
+            + "dropped " + to_string( waiting ) );
+  router.set_worker_threads( 0 );
+}
+
+// A shaped interface's queues are managed by FQ-CoDel: a backlog that builds up behind the shaper is dropped (or
+// marked, with ECN) once it has waited too long, and a new flow goes ahead of it
+void shaped_interface_delay()
+{
+  cerr << "\033[32;1m\n\nTesting delay on a shaped interface...\033[m\n\n";
+  for ( const bool ecn : { false, true } ) {
+    Router router;
+    add_interfaces( router, 2 );
+    const uint32_t prefix = ip( "10.3.0.0" );
+    router.add_route( prefix, 16, Address::from_ipv4_numeric( neighbour_ip( 1 ) ), 1 );
+
+    // 12 Mbit/s: one full-size datagram a ms
+    AsyncNetworkInterface::Shaper::Config config { .limit = { 12'000'000, 0 }, .classes = { {} } };
+    config.queue.ecn = ecn;
+    router.interface( 1 ).set_shaper( config );
+
+    const auto full_size = [&]( const uint32_t dst ) {
+      InternetDatagram dgram = make_datagram( neighbour_ip( 0 ), dst );
+      dgram.header.tos = ecn ? 0x02 : 0; // ECN-capable (ECT(0))
+      dgram.payload = { string( 1500 - IPv4Header::LENGTH, 'x' ) };
+      dgram.header.len = 1500;
+      dgram.header.compute_checksum();
+      return frame_to_router( 0, dgram );
+    };
+
+    // 400 ms of backlog from a bulk flow
+    constexpr size_t BULK = 400;
+    for ( size_t i = 0; i < BULK; i++ ) {
+      router.interface( 0 ).recv_frame( full_size( prefix | 1 ) );
+    }
+    router.route();
+
+    size_t sent = 0;
+    vector<EthernetFrame> frames;
+    const auto tick = [&] {
+      frames.clear();
+      router.interface( 1 ).tick( 1 );
+      router.interface( 1 ).drain_frames( frames );
+      sent += frames.size();
+    };
+    for ( size_t ms = 0; ms < 50; ms++ ) {
+      tick();
+    }
+
+    // A datagram of another flow is sent next, not after the backlog
+    router.interface( 0 ).recv_frame( full_size( prefix | 2 ) );
+    router.route();
+    tick();
+    InternetDatagram next;
+    expect( frames.size() == 1 and parse( next, frames.front().payload ) and next.header.dst == ( prefix | 2 ),
+            "a new flow waited behind a shaped backlog" );
+
+    for ( size_t ms = 0; ms < BULK; ms++ ) {
+      tick();
+    }
+    const auto stats = router.interface( 1 ).shaper()->stats( 0 );
+    expect( stats.queued == 0 and sent + stats.dropped_codel == BULK + 1, "shaped router lost datagrams" );
+    expect( ecn ? stats.marked > 0 and stats.dropped_codel == 0 : stats.dropped_codel > 0,
+            "CoDel did not act on the delay behind a shaper" );
+  }
+}
+
+// The router counts what it routes or drops, on each route, summed over its worker threads (including stopped
+// ones), and the interfaces count what they receive and send
+void counters()
+{
+  cerr << "\033[32;1m\n\nTesting router and interface counters...\033[m\n\n";
+  constexpr size_t INTERFACES = 4;
+  Router router;
+  add_interfaces( router, INTERFACES );
+  for ( size_t i = 0; i < INTERFACES; i++ ) {
+    router.add_route( router_ip( i ) & 0xffffff00, 24, {}, i );
+  }
+  router.set_worker_threads( 2 );
+
+  const auto receive = [&]( const size_t ingress, vector<Buffer> dgram, const EthernetAddress& dst ) {
+    router.interface( ingress ).recv_frame(
+      { { dst, neighbour_ethernet_address( ingress ), EthernetHeader::TYPE_IPv4 }, std::move( dgram ) } );
+  };
+
+  constexpr size_t ROUTED = 1000;
+  for ( size_t i = 0; i < ROUTED; i++ ) {
+    const size_t ingress = i % INTERFACES;
+    receive( ingress,
+             serialize( make_datagram( neighbour_ip( ingress ), neighbour_ip( ( ingress + 1 ) % INTERFACES ) ) ),
+             router_ethernet_address( ingress ) );
+  }
+  for ( size_t i = 0; i < 10; i++ ) {
+    receive( 0, serialize( make_datagram( neighbour_ip( 0 ), neighbour_ip( 1 ), 1 ) ), router_ethernet_address( 0 ) );
+    receive( 0, serialize( make_datagram( neighbour_ip( 0 ), ip( "192.168.0.1" ) ) ), router_ethernet_address( 0 ) );
+  }
+  for ( size_t i = 0; i < 5; i++ ) {
+    // (for another host)
+    receive( 1, serialize( make_datagram( neighbour_ip( 1 ), neighbour_ip( 2 ) ) ), neighbour_ethernet_address( 1 ) );
+  }
+  string corrupt = concat( serialize( make_datagram( neighbour_ip( 1 ), neighbour_ip( 2 ) ) ) );
+  corrupt[10] ^= 1; // header checksum
+  receive( 1, { Buffer { std::move( corrupt ) } }, router_ethernet_address( 1 ) );
+  router.route();
+
+  size_t sent_bytes = 0;
+  for ( size_t i = 0; i < INTERFACES; i++ ) {
+    while ( auto frame = router.interface( i ).maybe_send() ) {
+      sent_bytes += EthernetHeader::LENGTH + concat( frame->payload ).size();
+    }
+  }
+  router.set_worker_threads( 0 );
+
+  const auto snapshot = router.snapshot();
+  const auto& counters = snapshot.counters;
+  expect( counters.routed == ROUTED and counters.dropped_ttl == 10 and counters.dropped_no_route == 10
+            and counters.dropped_too_big == 0,
+          "router counted " + to_string( counters.routed ) + " datagrams routed, " + to_string( counters.dropped_ttl )
+            + " with TTL expired and " + to_string( counters.dropped_no_route ) + " without a route" );
+  expect( snapshot.routes.size() == INTERFACES, "router reported " + to_string( snapshot.routes.size() ) + " routes" );
+  for ( size_t i = 0; i < INTERFACES; i++ ) {
+    expect( snapshot.routes[i].hits == ROUTED / INTERFACES,
+            "router counted " + to_string( snapshot.routes[i].hits ) + " hits on route " + to_string( i ) );
+  }
+
+  uint64_t rx_frames = 0;
+  uint64_t tx_frames = 0;
+  uint64_t tx_bytes = 0;
+  for ( const auto& interface : snapshot.interfaces ) {
+    rx_frames += interface.rx_frames;
+    tx_frames += interface.tx_frames;
+    tx_bytes += interface.tx_bytes;
+    expect( interface.arp_replies_received == 1 and interface.arp_misses == 0, "interface miscounted ARP" );
+  }
+  const auto& ingress = snapshot.interfaces[1];
+  expect( rx_frames == ROUTED + 20 + 1 + INTERFACES and ingress.rx_ignored == 5 and ingress.rx_malformed == 1
+            and tx_frames == ROUTED and tx_bytes == sent_bytes,
+          "interfaces counted " + to_string( rx_frames ) + " frames received and " + to_string( tx_frames )
+            + " sent" );
+}
+
 int main()
 {
   try {
     network_simulator();
+    longest_prefix_match();
+    forwarding_in_place();
+    icmp_errors();
+    multipath_spread();
+    multipath_replaces_single_path();
+    path_mtu_discovery();
+    shaper_rates();
+    shaped_interface();
+    shaped_interface_delay();
+    counters();
   } catch ( const exception& e ) {
     cerr << "\n\n\n";
     cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
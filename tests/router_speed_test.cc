@@ -0,0 +1,294 @@
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "ipv4_datagram.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t INTERFACES = 4;
+constexpr size_t ROUTES = 50'000;
+constexpr size_t FRAMES_PER_INTERFACE = 1024; // frames queued on each interface before each call to route()
+
+EthernetAddress router_ethernet_address( const size_t i )
+{
+  return { 0x02, 0, 0, 0, 0, static_cast<uint8_t>( i ) };
+}
+
+EthernetAddress neighbour_ethernet_address( const size_t i )
+{
+  return { 0x02, 0, 0, 0, 1, static_cast<uint8_t>( i ) };
+}
+
+uint32_t router_ip( const size_t i )
+{
+  return 0x0a000001 + static_cast<uint32_t>( i << 8 ); // 10.0.i.1
+}
+
+uint32_t neighbour_ip( const size_t i )
+{
+  return router_ip( i ) + 1; // 10.0.i.2
+}
+
+EthernetFrame arp_reply_from_neighbour( const size_t i )
+{
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REPLY;
+  arp.sender_ethernet_address = neighbour_ethernet_address( i );
+  arp.sender_ip_address = neighbour_ip( i );
+  arp.target_ethernet_address = router_ethernet_address( i );
+  arp.target_ip_address = router_ip( i );
+
+  EthernetFrame frame;
+  frame.header = { router_ethernet_address( i ), neighbour_ethernet_address( i ), EthernetHeader::TYPE_ARP };
+  frame.payload = serialize( arp );
+  return frame;
+}
+
+// A serialized UDP-in-IPv4 datagram to `dst`, with `payload_size` bytes of payload (at least 4) that start
+// with zero source and destination ports
+string make_datagram( const uint32_t dst, const size_t payload_size )
+{
+  IPv4Datagram dgram;
+  dgram.header.src = 0xc0a80001;
+  dgram.header.dst = dst;
+  dgram.header.ttl = 64;
+  dgram.header.proto = 17;
+  dgram.header.len = IPv4Header::LENGTH + payload_size;
+  string payload( 4, 0 );
+  payload.append( payload_size - 4, 'x' );
+  dgram.payload.emplace_back( payload );
+  dgram.header.compute_checksum();
+
+  string ret;
+  for ( const auto& b : serialize( dgram ) ) {
+    ret.append( b );
+  }
+  return ret;
+}
+
+struct Scenario
+{
+  size_t payload_size;
+  size_t workers;
+  size_t hot_destinations; // if nonzero, every datagram goes to one of this many destinations
+  bool churn;              // add routes from another thread while forwarding
+  bool one_ingress {};     // all datagrams arrive on one interface
+};
+
+struct Setup
+{
+  Router router {};
+  vector<string> datagrams {}; // for each interface in turn
+};
+
+void build( Setup& setup, const Scenario& scenario )
+{
+  // Quiet the interfaces' and routing table's debug output while setting up
+  cerr.setstate( ios::badbit );
+
+  for ( size_t i = 0; i < INTERFACES; i++ ) {
+    setup.router.add_interface( { router_ethernet_address( i ), Address::from_ipv4_numeric( router_ip( i ) ) } );
+    setup.router.interface( i ).recv_frame( arp_reply_from_neighbour( i ) );
+  }
+
+  default_random_engine rd { 789 };
+  vector<uint32_t> prefixes;
+  vector<TableEntry> routes;
+  for ( size_t r = 0; r < ROUTES; r++ ) {
+    const uint32_t prefix = static_cast<uint32_t>( rd() ) & 0xffffff00;
+    const size_t egress = r % INTERFACES;
+    routes.push_back( { prefix, 24, Address::from_ipv4_numeric( neighbour_ip( egress ) ), egress } );
+    prefixes.push_back( prefix );
+  }
+  setup.router.add_routes( routes );
+
+  cerr.clear();
+
+  if ( scenario.hot_destinations ) {
+    prefixes.resize( scenario.hot_destinations );
+  }
+  for ( size_t i = 0; i < INTERFACES * FRAMES_PER_INTERFACE; i++ ) {
+    setup.datagrams.push_back( make_datagram( prefixes[rd() % prefixes.size()] | 0x2a, scenario.payload_size ) );
+  }
+}
+
+// Routes added by a control-plane thread while the router forwards (1000 every 10 ms)
+class RouteChurn
+{
+  Router& router_;
+  atomic<size_t> updates_ {};
+  jthread thread_;
+
+public:
+  explicit RouteChurn( Router& router )
+    : router_( router ), thread_( [this]( const stop_token& stop ) {
+      default_random_engine rd { 1234 };
+      while ( not stop.stop_requested() ) {
+        vector<TableEntry> entries( 1000 );
+        for ( auto& entry : entries ) {
+          const size_t egress = rd() % INTERFACES;
+          entry.route_prefix_ = static_cast<uint32_t>( rd() ) & 0xffffff00;
+          entry.prefix_length_ = 24;
+          entry.next_hop_ = Address::from_ipv4_numeric( neighbour_ip( egress ) );
+          entry.interface_num_ = egress;
+        }
+        router_.add_routes( entries );
+        updates_++;
+        this_thread::sleep_for( milliseconds( 10 ) );
+      }
+    } )
+  {}
+
+  size_t updates() const { return updates_; }
+};
+
+// Forward `rounds` rounds of the scenario's datagrams; returns datagrams forwarded per second
+double speed_test( const Scenario& scenario, const size_t rounds )
+{
+  Setup setup;
+  build( setup, scenario );
+  setup.router.set_worker_threads( scenario.workers );
+  optional<RouteChurn> route_churn;
+  if ( scenario.churn ) {
+    route_churn.emplace( setup.router );
+  }
+
+  size_t forwarded = 0;
+  duration<double> routing_time {};
+  vector<vector<EthernetFrame>> batches( INTERFACES );
+
+  for ( size_t round = 0; round < rounds; round++ ) {
+    // Deliver fresh frames (each owning its buffer, as if just read from a device) to every interface, a batch
+    // at a time
+    for ( size_t i = 0; i < setup.datagrams.size(); i++ ) {
+      const size_t ingress = scenario.one_ingress ? 0 : i / FRAMES_PER_INTERFACE;
+      EthernetFrame frame;
+      frame.header
+        = { router_ethernet_address( ingress ), neighbour_ethernet_address( ingress ), EthernetHeader::TYPE_IPv4 };
+      frame.payload.emplace_back( setup.datagrams[i] );
+      batches[ingress].push_back( std::move( frame ) );
+    }
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      setup.router.interface( i ).recv_frames( batches[i] );
+      batches[i].clear();
+    }
+
+    // (Until the workers have sent everything, as the router's user would wait for them.)
+    const auto start_time = steady_clock::now();
+    setup.router.route();
+    setup.router.finish_routing();
+    routing_time += steady_clock::now() - start_time;
+
+    for ( size_t i = 0; i < INTERFACES; i++ ) {
+      while ( auto frame = setup.router.interface( i ).maybe_send() ) {
+        if ( frame->header.type != EthernetHeader::TYPE_IPv4 ) {
+          throw runtime_error( "router sent an unexpected frame" );
+        }
+        forwarded++;
+      }
+    }
+  }
+
+  if ( forwarded != rounds * setup.datagrams.size() ) {
+    throw runtime_error( "router forwarded " + to_string( forwarded ) + " of "
+                         + to_string( rounds * setup.datagrams.size() ) + " datagrams" );
+  }
+
+  const auto datagrams_per_second = static_cast<double>( forwarded ) / routing_time.count();
+  const auto cache = setup.router.flow_cache_stats();
+  const auto hit_rate = static_cast<double>( cache.hits ) / static_cast<double>( cache.hits + cache.misses );
+
+  stringstream description;
+  description << scenario.payload_size << "-byte payloads, " << scenario.workers << " worker threads";
+  if ( scenario.hot_destinations ) {
+    description << ", " << scenario.hot_destinations << " destinations";
+  }
+  if ( route_churn ) {
+    description << ", " << route_churn->updates() << " route updates of 1000 routes";
+  }
+  if ( scenario.one_ingress ) {
+    description << ", one ingress interface";
+  }
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Router (" << description.str() << ") forwarded " << fixed << setprecision( 2 )
+       << datagrams_per_second / 1e6 << " M datagrams/s, flow cache hit rate " << 100 * hit_rate << "%.\n";
+
+  debug_output << "             Router forwarding (" << description.str() << "): " << fixed << setprecision( 2 )
+               << datagrams_per_second / 1e6 << " M datagrams/s\n";
+
+  if ( datagrams_per_second < 1e5 ) {
+    throw runtime_error( "Router did not meet minimum speed of 0.1 M datagrams/s." );
+  }
+  return datagrams_per_second;
+}
+
+// Run a scenario without workers, then with 1, 2, 4... up to a worker per core, reporting each rate relative to
+// the rate without workers. Given more than one core, the most workers must not forward more slowly than none.
+void scaling_test( Scenario scenario, const size_t rounds )
+{
+  const unsigned cores = thread::hardware_concurrency();
+  scenario.workers = 0;
+  const double base = speed_test( scenario, rounds );
+  double rate = base;
+  for ( scenario.workers = 1; scenario.workers <= max( 1U, cores ); scenario.workers *= 2 ) {
+    rate = speed_test( scenario, rounds );
+    cout << "  " << scenario.workers << " worker threads forwarded " << fixed << setprecision( 2 ) << rate / base
+         << "x the datagrams/s of none.\n";
+  }
+
+  if ( cores > 1 and rate < base ) {
+    throw runtime_error( "Router forwarded more slowly with worker threads than without, on " + to_string( cores )
+                         + " cores." );
+  }
+}
+
+void program_body()
+{
+  for ( const size_t payload_size : { 64, 1480 } ) {
+    scaling_test( { payload_size, 0, 0, false }, 50 );
+  }
+
+  // Traffic from one interface, which the workers share by flow
+  scaling_test( { 64, 0, 0, false, true }, 50 );
+
+  // Traffic concentrated on a few destinations, which the flow cache should absorb
+  speed_test( { 64, 0, 256, false }, 50 );
+
+  // Forwarding must continue, with nothing dropped, while the routing table is being replaced
+  scaling_test( { 64, 0, 256, true }, 50 );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
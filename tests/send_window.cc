@@ -140,6 +140,27 @@ int main()
       test.execute( ExpectMessage {}.with_fin( true ).with_data( "4567" ) );
       test.execute( ExpectNoSegment {} );
     }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      cfg.fixed_isn = isn;
+
+      TCPSenderTestHarness test { "Stale ACK shrinking the window below what is in flight", cfg };
+      test.execute( Push {} );
+      test.execute( ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_seqno( isn ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 10 ) );
+      test.execute( ExpectNoSegment {} );
+      test.execute( Push { "0123456789" } );
+      test.execute( ExpectMessage {}.with_no_flags().with_data( "0123456789" ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 4 ) );
+      test.execute( ExpectSeqnosInFlight { 10 } );
+      test.execute( Push { "abcdefg" } );
+      test.execute( ExpectNoSegment {} ); // window is overfull
+      test.execute( AckReceived { Wrap32 { isn + 11 } }.with_win( 4 ) );
+      test.execute( ExpectMessage {}.with_no_flags().with_data( "abcd" ) );
+      test.execute( ExpectNoSegment {} );
+    }
   } catch ( const exception& e ) {
     cerr << e.what() << endl;
     return 1;
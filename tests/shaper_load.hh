@@ -0,0 +1,38 @@
+#pragma once
+
+#include "token_bucket_shaper.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using TestShaper = TokenBucketShaper<size_t>;
+
+// Offer each class of `shaper` `offered` bits per second (in `item_size`-byte items) for `duration` ms, ticking
+// every ms; returns the rate each class was sent at, in bits per second
+inline std::vector<double> offer_load( TestShaper& shaper,
+                                       const double offered,
+                                       const uint64_t duration,
+                                       const size_t item_size = 1500 )
+{
+  std::vector<uint64_t> bytes( shaper.classes() );
+  std::vector<double> credit( shaper.classes() );
+  const auto send = [&]( const size_t traffic_class ) { bytes[traffic_class] += item_size; };
+
+  for ( uint64_t now = 0; now < duration; now++ ) {
+    for ( size_t c = 0; c < shaper.classes(); c++ ) {
+      for ( credit[c] += offered / 8000 / static_cast<double>( item_size ); credit[c] >= 1; credit[c]-- ) {
+        if ( const auto item = shaper.submit( c, c, item_size ) ) {
+          send( *item );
+        }
+      }
+    }
+    shaper.tick( 1, send );
+  }
+
+  std::vector<double> rates;
+  for ( const uint64_t b : bytes ) {
+    rates.push_back( static_cast<double>( b ) * 8 * 1000 / static_cast<double>( duration ) );
+  }
+  return rates;
+}
@@ -0,0 +1,79 @@
+#include "shaper_load.hh"
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+void check_rate( const string& what, const double rate, const double expected )
+{
+  if ( abs( rate - expected ) > expected * 0.02 ) {
+    throw runtime_error( what + " was shaped to " + to_string( rate / 1e9 ) + " Gbit/s instead of "
+                         + to_string( expected / 1e9 ) );
+  }
+}
+
+// Shape a 10 Gbit/s link offered 20 Gbit/s of full-size datagrams, in four classes
+void speed_test()
+{
+  constexpr uint64_t DURATION = 5'000; // ms
+  TestShaper::Config config { .limit = { 10'000'000'000, 1'000'000 }, .classes = {} };
+  for ( size_t c = 0; c < 4; c++ ) {
+    config.classes.push_back( { .limit = { 5'000'000'000, 64 * 1024 }, .queue_limit = 4096 } );
+  }
+  TestShaper shaper { config };
+
+  const auto start_time = steady_clock::now();
+  const auto rates = offer_load( shaper, 5e9, DURATION );
+  const duration<double> elapsed = steady_clock::now() - start_time;
+
+  double total = 0;
+  for ( const double rate : rates ) {
+    total += rate;
+  }
+  check_rate( "a 10 Gbit/s link", total, 10e9 );
+
+  // Items offered and shaped per second of wall time, as bits of full-size datagrams
+  const auto gigabits_per_second = 2 * total * static_cast<double>( DURATION ) / 1000 / 1e9 / elapsed.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Token-bucket shaper (1500-byte datagrams, 4 classes) achieved " << fixed << setprecision( 2 )
+       << gigabits_per_second << " Gbit/s.\n";
+  debug_output << "                           Token-bucket shaper: " << fixed << setprecision( 2 )
+               << gigabits_per_second << " Gbit/s\n";
+
+  if ( gigabits_per_second < 0.1 ) {
+    throw runtime_error( "Token-bucket shaper did not meet minimum speed of 0.1 Gbit/s." );
+  }
+}
+
+void program_body()
+{
+  speed_test();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,289 @@
+#include "ipv4_header.hh"
+#include "parser.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tcp_segment.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Scenario
+{
+  size_t window;
+  size_t write_size;
+  double loss;
+  double reorder;
+};
+
+struct Result
+{
+  Scenario scenario;
+  size_t bytes;
+  double seconds;
+  uint64_t segments;
+  double latency_p50_us;
+  double latency_p99_us;
+};
+
+// One direction of the "wire": serialized segments, with optional loss and reordering
+class Link
+{
+  IPv4Header ip_header_ {};
+  deque<string> wire_ {};
+  optional<string> held_ {}; // a segment being reordered: it is released after the next one
+  double loss_;
+  double reorder_;
+  default_random_engine rd_;
+  uniform_real_distribution<double> coin_ { 0, 1 };
+  uint64_t segments_ {};
+
+public:
+  Link( const uint32_t src, const uint32_t dst, const double loss, const double reorder, const size_t seed )
+    : loss_( loss ), reorder_( reorder ), rd_( seed )
+  {
+    ip_header_.src = src;
+    ip_header_.dst = dst;
+  }
+
+  void send( TCPSegment& seg )
+  {
+    ++segments_;
+    ip_header_.len = IPv4Header::LENGTH + 20 + seg.sender_message.payload.size();
+    seg.compute_checksum( ip_header_.pseudo_checksum() );
+
+    string wire_segment;
+    for ( const auto& buf : serialize( seg ) ) {
+      wire_segment.append( static_cast<string_view>( buf ) );
+    }
+
+    if ( loss_ > 0 and coin_( rd_ ) < loss_ ) {
+      return;
+    }
+
+    if ( not held_ and reorder_ > 0 and coin_( rd_ ) < reorder_ ) {
+      held_ = move( wire_segment );
+      return;
+    }
+
+    wire_.push_back( move( wire_segment ) );
+    if ( held_ ) {
+      wire_.push_back( move( held_.value() ) );
+      held_.reset();
+    }
+  }
+
+  void deliver( TCPPeer& peer )
+  {
+    while ( not wire_.empty() ) {
+      ip_header_.len = IPv4Header::LENGTH + wire_.front().size();
+      TCPSegment seg;
+      if ( not parse( seg, { move( wire_.front() ) }, ip_header_.pseudo_checksum() ) ) {
+        throw runtime_error( "segment failed to parse" );
+      }
+      wire_.pop_front();
+      peer.receive( move( seg ) );
+    }
+  }
+
+  // A reordered segment with nothing behind it to overtake it is eventually released
+  void flush()
+  {
+    if ( held_ ) {
+      wire_.push_back( move( held_.value() ) );
+      held_.reset();
+    }
+  }
+
+  uint64_t segments() const { return segments_; }
+};
+
+double percentile( vector<double>& samples, const double q )
+{
+  if ( samples.empty() ) {
+    return 0;
+  }
+  const size_t rank = static_cast<size_t>( q * static_cast<double>( samples.size() - 1 ) );
+  nth_element( samples.begin(), samples.begin() + static_cast<ptrdiff_t>( rank ), samples.end() );
+  return samples.at( rank );
+}
+
+Result speed_test( const Scenario& scenario, const size_t input_len, const size_t random_seed )
+{
+  // Generate the data to be written
+  const string data = [&] {
+    default_random_engine rd { random_seed };
+    uniform_int_distribution<char> ud;
+    string ret;
+    for ( size_t i = 0; i < input_len; ++i ) {
+      ret += ud( rd );
+    }
+    return ret;
+  }();
+
+  TCPConfig cfg;
+  cfg.recv_capacity = scenario.window;
+  cfg.send_capacity = scenario.window;
+  cfg.rt_timeout = 50; // in rounds of the loop below (each round advances time by 1 ms)
+
+  TCPPeer client { cfg };
+  TCPPeer server { cfg };
+
+  const uint32_t client_ip = 0x0a000001;
+  const uint32_t server_ip = 0x0a000002;
+  Link client_to_server { client_ip, server_ip, scenario.loss, scenario.reorder, random_seed };
+  Link server_to_client { server_ip, client_ip, scenario.loss, scenario.reorder, random_seed + 1 };
+
+  // (end offset, time written) for each chunk written by the client, to measure delivery latency
+  deque<pair<size_t, steady_clock::time_point>> written_chunks;
+  vector<double> latencies_us;
+  latencies_us.reserve( input_len / scenario.write_size + 1 );
+
+  string output_data;
+  output_data.reserve( data.size() );
+  size_t bytes_written = 0;
+  uint64_t idle_rounds = 0;
+
+  const auto start_time = steady_clock::now();
+  client.push();
+  while ( not server.inbound_reader().is_finished() ) {
+    const size_t bytes_read_before = output_data.size();
+
+    // the client application writes
+    while ( bytes_written < data.size() and client.outbound_writer().available_capacity() > 0 ) {
+      const size_t len = min( { scenario.write_size,
+                                data.size() - bytes_written,
+                                static_cast<size_t>( client.outbound_writer().available_capacity() ) } );
+      client.outbound_writer().push( data.substr( bytes_written, len ) );
+      bytes_written += len;
+      written_chunks.emplace_back( bytes_written, steady_clock::now() );
+    }
+    if ( bytes_written == data.size() and not client.outbound_writer().is_closed() ) {
+      client.outbound_writer().close();
+    }
+
+    // the peers exchange segments
+    while ( auto seg = client.maybe_send() ) {
+      client_to_server.send( seg.value() );
+    }
+    client_to_server.deliver( server );
+    while ( auto seg = server.maybe_send() ) {
+      server_to_client.send( seg.value() );
+    }
+    server_to_client.deliver( client );
+
+    // the server application reads
+    while ( server.inbound_reader().bytes_buffered() ) {
+      const auto peeked = server.inbound_reader().peek();
+      output_data += peeked;
+      server.inbound_reader().pop( peeked.size() );
+    }
+    const auto now = steady_clock::now();
+    while ( not written_chunks.empty() and written_chunks.front().first <= output_data.size() ) {
+      const auto latency = now - written_chunks.front().second;
+      latencies_us.push_back( duration_cast<duration<double, micro>>( latency ).count() );
+      written_chunks.pop_front();
+    }
+
+    if ( output_data.size() == bytes_read_before ) {
+      client_to_server.flush();
+      server_to_client.flush();
+      client.tick( 1 );
+      server.tick( 1 );
+      if ( ++idle_rounds > 1'000'000 ) {
+        throw runtime_error( "TCPPeers stopped making progress" );
+      }
+    }
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( data != output_data ) {
+    throw runtime_error( "Mismatch between data written and read" );
+  }
+
+  return { scenario,
+           input_len,
+           duration_cast<duration<double>>( stop_time - start_time ).count(),
+           client_to_server.segments() + server_to_client.segments(),
+           percentile( latencies_us, 0.5 ),
+           percentile( latencies_us, 0.99 ) };
+}
+
+string to_json( const vector<Result>& results )
+{
+  stringstream ss;
+  ss << fixed << setprecision( 3 );
+  ss << "{\n  \"benchmark\": \"tcp_peer\",\n  \"results\": [";
+  for ( size_t i = 0; i < results.size(); ++i ) {
+    const auto& r = results.at( i );
+    ss << ( i ? "," : "" ) << "\n    { \"window\": " << r.scenario.window
+       << ", \"write_size\": " << r.scenario.write_size << ", \"loss\": " << r.scenario.loss
+       << ", \"reorder\": " << r.scenario.reorder << ", \"bytes\": " << r.bytes << ", \"seconds\": " << r.seconds
+       << ", \"gbit_per_sec\": " << 8 * static_cast<double>( r.bytes ) / r.seconds / 1e9
+       << ", \"segments\": " << r.segments
+       << ", \"segments_per_sec\": " << static_cast<double>( r.segments ) / r.seconds
+       << ", \"latency_p50_us\": " << r.latency_p50_us << ", \"latency_p99_us\": " << r.latency_p99_us << " }";
+  }
+  ss << "\n  ]\n}\n";
+  return ss.str();
+}
+
+void program_body()
+{
+  const vector<Scenario> scenarios = { { 4000, 1500, 0, 0 },
+                                       { 16000, 1500, 0, 0 },
+                                       { 64000, 100, 0, 0 },
+                                       { 64000, 1500, 0, 0 },
+                                       { 64000, 16384, 0, 0 },
+                                       { 64000, 1500, 0.01, 0 },
+                                       { 64000, 1500, 0, 0.01 },
+                                       { 64000, 1500, 0.01, 0.01 } };
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  vector<Result> results;
+  for ( const auto& scenario : scenarios ) {
+    results.push_back( speed_test( scenario, 4e6, 789 ) );
+    const auto& r = results.back();
+    const double gigabits_per_second = 8 * static_cast<double>( r.bytes ) / r.seconds / 1e9;
+    debug_output << "             TCPPeer throughput (window=" << scenario.window
+                 << ", write_size=" << scenario.write_size << ", loss=" << scenario.loss
+                 << ", reorder=" << scenario.reorder << "): " << fixed << setprecision( 2 ) << gigabits_per_second
+                 << " Gbit/s\n";
+
+    if ( gigabits_per_second < 0.01 ) {
+      throw runtime_error( "TCPPeer did not meet minimum speed of 0.01 Gbit/s." );
+    }
+  }
+
+  cout << to_json( results );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
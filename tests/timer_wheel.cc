@@ -0,0 +1,73 @@
+#include "timer_wheel.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Timers must fire exactly at their deadlines (or at the first step after being scheduled, if already due),
+// however far away the deadline is and however far each tick advances the clock
+void timers_fire_on_time( const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  TimerWheel<size_t> wheel;
+  vector<uint64_t> due;
+  multimap<uint64_t, size_t> reference;
+
+  // (The clock moves by shorter jumps than the deadlines, which is quicker, but still goes round the whole
+  // wheel many times.)
+  const auto random_delay = [&]( const int max_magnitude ) {
+    const auto magnitude = uniform_int_distribution<int> { 0, max_magnitude }( rd );
+    return static_cast<uint64_t>( rd() ) % ( uint64_t { 1 } << magnitude );
+  };
+
+  for ( size_t round = 0; round < 5'000; round++ ) {
+    for ( size_t i = rd() % 4; i > 0; i-- ) {
+      const uint64_t deadline = wheel.now() + random_delay( 28 ) - ( rd() % 8 == 0 ? wheel.now() / 2 : 0 );
+      const uint64_t fires_at = max( deadline, wheel.now() + 1 );
+      wheel.schedule( deadline, due.size() );
+      reference.emplace( fires_at, due.size() );
+      due.push_back( fires_at );
+    }
+
+    const uint64_t target = wheel.now() + ( rd() % 4 == 0 ? random_delay( 23 ) : rd() % 64 );
+    uint64_t last = 0;
+    wheel.advance( target, [&]( const size_t id ) {
+      if ( due.at( id ) != wheel.now() or wheel.now() < last ) {
+        throw runtime_error( "TimerWheel fired a timer at the wrong time" );
+      }
+      last = wheel.now();
+      const auto it = reference.find( due[id] );
+      reference.erase( it );
+    } );
+
+    if ( wheel.now() != target or wheel.size() != reference.size()
+         or ( not reference.empty() and reference.begin()->first <= target ) ) {
+      throw runtime_error( "TimerWheel did not fire every timer that was due" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    timers_fire_on_time( 1234 );
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,11 +1,30 @@
 #include "arp_message.hh"
+#include "header_codec.hh"
 
 #include <arpa/inet.h>
+#include <array>
 #include <iomanip>
 #include <sstream>
 
 using namespace std;
 
+namespace {
+
+using namespace header_codec;
+using Codec = HeaderCodec<ARPMessage,
+                          ARPMessage::LENGTH,
+                          Field<0, &ARPMessage::hardware_type>,
+                          Field<2, &ARPMessage::protocol_type>,
+                          Field<4, &ARPMessage::hardware_address_size>,
+                          Field<5, &ARPMessage::protocol_address_size>,
+                          Field<6, &ARPMessage::opcode>,
+                          Field<8, &ARPMessage::sender_ethernet_address>,
+                          Field<14, &ARPMessage::sender_ip_address>,
+                          Field<18, &ARPMessage::target_ethernet_address>,
+                          Field<24, &ARPMessage::target_ip_address>>;
+
+} // namespace
+
 bool ARPMessage::supported() const
 {
   return hardware_type == TYPE_ETHERNET and protocol_type == EthernetHeader::TYPE_IPv4
@@ -32,28 +51,10 @@ string ARPMessage::to_string() const
 
 void ARPMessage::parse( Parser& parser )
 {
-  parser.integer( hardware_type );
-  parser.integer( protocol_type );
-  parser.integer( hardware_address_size );
-  parser.integer( protocol_address_size );
-  parser.integer( opcode );
-
-  if ( not supported() ) {
+  array<char, LENGTH> scratch;
+  if ( Codec::parse( *this, parser, scratch ) and not supported() ) {
     parser.set_error();
-    return;
-  }
-
-  // read sender addresses (Ethernet and IP)
-  for ( auto& b : sender_ethernet_address ) {
-    parser.integer( b );
   }
-  parser.integer( sender_ip_address );
-
-  // read target addresses (Ethernet and IP)
-  for ( auto& b : target_ethernet_address ) {
-    parser.integer( b );
-  }
-  parser.integer( target_ip_address );
 }
 
 void ARPMessage::serialize( Serializer& serializer ) const
@@ -62,21 +63,5 @@ void ARPMessage::serialize( Serializer& serializer ) const
     throw runtime_error( "ARPMessage: unsupported field combination (must be Ethernet/IP, and request or reply)" );
   }
 
-  serializer.integer( hardware_type );
-  serializer.integer( protocol_type );
-  serializer.integer( hardware_address_size );
-  serializer.integer( protocol_address_size );
-  serializer.integer( opcode );
-
-  // read sender addresses (Ethernet and IP)
-  for ( const auto& b : sender_ethernet_address ) {
-    serializer.integer( b );
-  }
-  serializer.integer( sender_ip_address );
-
-  // read target addresses (Ethernet and IP)
-  for ( const auto& b : target_ethernet_address ) {
-    serializer.integer( b );
-  }
-  serializer.integer( target_ip_address );
+  Codec::serialize( *this, serializer );
 }
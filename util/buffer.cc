@@ -0,0 +1,188 @@
+#include "buffer.hh"
+#include "checksum.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+//! Capacities (headroom included) of the pooled block sizes. Larger requests get a block of their own.
+constexpr array<size_t, 3> SIZE_CLASSES { 256, 2048, 32768 };
+constexpr uint8_t UNPOOLED = SIZE_CLASSES.size();
+
+//! Upper bound on the bytes each thread keeps cached per size class
+constexpr size_t MAX_CACHED_BYTES_PER_CLASS = 4 << 20;
+
+//! Set once the calling thread's pool has been destroyed (blocks freed later are returned to the heap)
+thread_local bool pool_destroyed = false;
+
+//! Per-thread cache of free blocks, one free list per size class. A block may be freed on a different thread
+//! than the one that allocated it; it then joins the freeing thread's cache.
+class PacketPool
+{
+  array<vector<Buffer::Block*>, SIZE_CLASSES.size()> free_ {};
+
+  static Buffer::Block* new_block( const uint32_t capacity, const uint8_t size_class )
+  {
+    void* mem = ::operator new( sizeof( Buffer::Block ) + capacity );
+    return new ( mem ) Buffer::Block { { 1 }, { 0 }, capacity, size_class, false, 0, 0, 0 };
+  }
+
+  static void delete_block( Buffer::Block* block )
+  {
+    block->~Block();
+    ::operator delete( block );
+  }
+
+public:
+  PacketPool() = default;
+  PacketPool( const PacketPool& other ) = delete;
+  PacketPool& operator=( const PacketPool& other ) = delete;
+
+  ~PacketPool()
+  {
+    pool_destroyed = true;
+    for ( auto& list : free_ ) {
+      ranges::for_each( list, delete_block );
+    }
+  }
+
+  Buffer::Block* get( const size_t capacity )
+  {
+    const auto it = ranges::lower_bound( SIZE_CLASSES, capacity );
+    if ( it == SIZE_CLASSES.end() ) {
+      if ( capacity > UINT32_MAX ) {
+        throw length_error( "Buffer too large" );
+      }
+      return new_block( capacity, UNPOOLED );
+    }
+
+    const auto size_class = static_cast<uint8_t>( it - SIZE_CLASSES.begin() );
+    auto& list = free_.at( size_class );
+    if ( list.empty() ) {
+      return new_block( *it, size_class );
+    }
+    Buffer::Block* block = list.back();
+    list.pop_back();
+    block->refs.store( 1, memory_order_relaxed );
+    return block;
+  }
+
+  void put( Buffer::Block* block )
+  {
+    if ( block->size_class != UNPOOLED ) {
+      auto& list = free_.at( block->size_class );
+      if ( list.size() < MAX_CACHED_BYTES_PER_CLASS / block->capacity ) {
+        list.push_back( block );
+        return;
+      }
+    }
+    delete_block( block );
+  }
+
+  static PacketPool& local()
+  {
+    thread_local PacketPool pool;
+    return pool;
+  }
+
+  static void release( Buffer::Block* block )
+  {
+    if ( pool_destroyed ) {
+      delete_block( block );
+    } else {
+      local().put( block );
+    }
+  }
+};
+
+} // namespace
+
+Buffer Buffer::allocate( const size_t len, const size_t headroom )
+{
+  Block* block = PacketPool::local().get( headroom + len );
+  const auto offset = static_cast<uint32_t>( headroom );
+  block->frontier.store( offset, memory_order_relaxed );
+  block->has_sum = false;
+  return { block, offset, static_cast<uint32_t>( len ) };
+}
+
+void Buffer::assign( const string_view str, const size_t headroom )
+{
+  if ( str.empty() ) {
+    return;
+  }
+  *this = allocate( str.size(), headroom );
+  memcpy( block_->data() + offset_, str.data(), str.size() );
+}
+
+Buffer Buffer::copy_and_checksum( const string_view str )
+{
+  Buffer ret;
+  ret.assign( str, DEFAULT_HEADROOM );
+  if ( ret.block_ ) {
+    ret.block_->sum = InternetChecksum::sum_of( ret );
+    ret.block_->sum_offset = ret.offset_;
+    ret.block_->sum_length = ret.length_;
+    ret.block_->has_sum = true;
+  }
+  return ret;
+}
+
+void Buffer::recycle( Block* block )
+{
+  PacketPool::release( block );
+}
+
+span<char> Buffer::mutable_data()
+{
+  if ( not block_ ) {
+    return {};
+  }
+  block_->has_sum = false;
+  return { block_->data() + offset_, length_ };
+}
+
+size_t Buffer::headroom() const
+{
+  if ( not block_ or block_->frontier.load( memory_order_relaxed ) != offset_ ) {
+    return 0;
+  }
+  return offset_;
+}
+
+bool Buffer::prepend( const string_view header )
+{
+  if ( not block_ or header.size() > offset_ ) {
+    return false;
+  }
+
+  const auto new_offset = static_cast<uint32_t>( offset_ - header.size() );
+  uint32_t expected = offset_;
+  if ( not block_->frontier.compare_exchange_strong( expected, new_offset, memory_order_relaxed ) ) {
+    return false;
+  }
+
+  offset_ = new_offset;
+  length_ += header.size();
+  memcpy( block_->data() + offset_, header.data(), header.size() );
+  return true;
+}
+
+void Buffer::remove_prefix( const size_t n )
+{
+  const auto len = static_cast<uint32_t>( min( n, size_t { length_ } ) );
+  offset_ += len;
+  length_ -= len;
+}
+
+void Buffer::truncate( const size_t n )
+{
+  length_ = static_cast<uint32_t>( min( n, size_t { length_ } ) );
+}
@@ -1,23 +1,147 @@
 #pragma once
 
-#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 
+//! \brief A refcounted, immutable-once-shared view of packet bytes
+//! \details Bytes live in a block drawn from a per-thread pool of size classes, preceded by free headroom so
+//! that each protocol layer can prepend its header in place instead of allocating a separate header chunk.
+//! Copying a Buffer shares the block (e.g., between the sender's retransmission queue and the wire).
+//! Only the Buffer that begins at the block's headroom frontier may claim more headroom, so two
+//! holders of the same block can never write over each other's bytes.
 class Buffer
 {
-  std::shared_ptr<std::string> buffer_;
+public:
+  //! Headroom reserved in front of new buffers: enough for Ethernet, IPv4 and TCP headers with options
+  static constexpr size_t DEFAULT_HEADROOM = 128;
+
+  //! Header of a pooled block; the block's bytes follow it in memory
+  struct Block
+  {
+    std::atomic<uint32_t> refs;
+    std::atomic<uint32_t> frontier; //!< Offset of the first byte claimed by any Buffer sharing the block
+    uint32_t capacity;
+    uint8_t size_class;
+
+    //! Internet checksum (uncomplemented) of the bytes that were copied in by copy_and_checksum(), if any
+    bool has_sum;
+    uint16_t sum;
+    uint32_t sum_offset;
+    uint32_t sum_length;
+
+    char* data() { return reinterpret_cast<char*>( this + 1 ); }
+  };
+
+private:
+  Block* block_ {};
+  uint32_t offset_ {};
+  uint32_t length_ {};
+
+  Buffer( Block* block, uint32_t offset, uint32_t length ) : block_( block ), offset_( offset ), length_( length )
+  {}
+
+  void assign( std::string_view str, size_t headroom );
+  static void recycle( Block* block ); // return a block whose last reference is gone to the pool
+
+  void release_block()
+  {
+    if ( block_ and block_->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+      recycle( block_ );
+    }
+    block_ = nullptr;
+    offset_ = length_ = 0;
+  }
 
 public:
+  Buffer() = default;
+
   // NOLINTBEGIN(*-explicit-*)
 
-  Buffer( std::string str = {} ) : buffer_( make_shared<std::string>( std::move( str ) ) ) {}
-  operator std::string_view() const { return *buffer_; }
-  operator std::string&() { return *buffer_; }
+  Buffer( const std::string& str ) { assign( str, DEFAULT_HEADROOM ); }
+  Buffer( std::string_view str ) { assign( str, DEFAULT_HEADROOM ); }
+  Buffer( const char* str ) { assign( str, DEFAULT_HEADROOM ); }
+  operator std::string_view() const { return block_ ? std::string_view { block_->data() + offset_, length_ } : ""; }
 
   // NOLINTEND(*-explicit-*)
 
-  std::string&& release() { return std::move( *buffer_ ); }
-  size_t size() const { return buffer_->size(); }
-  size_t length() const { return buffer_->length(); }
-  bool empty() const { return buffer_->empty(); }
+  //! A copy of `str` whose Internet checksum is computed while the copy is still in cache, and remembered by
+  //! the block so that every Buffer sharing it (e.g., a retransmission) can reuse it through checksum()
+  static Buffer copy_and_checksum( std::string_view str );
+
+  //! A buffer of `len` uninitialized bytes (to be filled through mutable_data()) behind `headroom` free bytes
+  static Buffer allocate( size_t len, size_t headroom = DEFAULT_HEADROOM );
+
+  Buffer( const Buffer& other ) : block_( other.block_ ), offset_( other.offset_ ), length_( other.length_ )
+  {
+    if ( block_ ) {
+      block_->refs.fetch_add( 1, std::memory_order_relaxed );
+    }
+  }
+
+  Buffer( Buffer&& other ) noexcept : block_( other.block_ ), offset_( other.offset_ ), length_( other.length_ )
+  {
+    other.block_ = nullptr;
+    other.offset_ = other.length_ = 0;
+  }
+
+  Buffer& operator=( const Buffer& other )
+  {
+    if ( this != &other ) {
+      Buffer copy { other };
+      *this = std::move( copy );
+    }
+    return *this;
+  }
+
+  Buffer& operator=( Buffer&& other ) noexcept
+  {
+    if ( this != &other ) {
+      release_block();
+      std::swap( block_, other.block_ );
+      std::swap( offset_, other.offset_ );
+      std::swap( length_, other.length_ );
+    }
+    return *this;
+  }
+
+  ~Buffer() { release_block(); }
+
+  size_t size() const { return length_; }
+  size_t length() const { return length_; }
+  bool empty() const { return length_ == 0; }
+
+  //! True if no other Buffer shares this one's block, so that its bytes may be written through mutable_data()
+  bool unique() const { return block_ and block_->refs.load( std::memory_order_acquire ) == 1; }
+
+  //! Writable access to the bytes. Only for a buffer that has not yet been shared.
+  std::span<char> mutable_data();
+
+  //! The remembered (uncomplemented) Internet checksum of exactly these bytes, if there is one
+  std::optional<uint16_t> checksum() const
+  {
+    if ( block_ and block_->has_sum and block_->sum_offset == offset_ and block_->sum_length == length_ ) {
+      return block_->sum;
+    }
+    return {};
+  }
+
+  //! Number of bytes in front of this buffer that prepend() could claim
+  size_t headroom() const;
+
+  //! Copy `header` into the headroom so that it becomes the start of this buffer.
+  //! \returns false (and leaves the buffer unchanged) if there is not enough headroom, or if the bytes in
+  //! front of this buffer have already been claimed through another Buffer sharing the block
+  bool prepend( std::string_view header );
+
+  //! Drop the first `n` bytes (no copy; the block is still shared)
+  void remove_prefix( size_t n );
+
+  //! Keep only the first `n` bytes
+  void truncate( size_t n );
 };
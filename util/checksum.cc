@@ -0,0 +1,180 @@
+#include "checksum.hh"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+uint64_t fold_to_32( const uint64_t sum )
+{
+  const uint64_t folded = ( sum >> 32 ) + ( sum & 0xffff'ffff );
+  return ( folded >> 32 ) + ( folded & 0xffff'ffff );
+}
+
+uint16_t fold_to_16( const uint64_t sum )
+{
+  uint64_t ret = fold_to_32( sum );
+  while ( ret > 0xffff ) {
+    ret = ( ret >> 16 ) + ( ret & 0xffff );
+  }
+  return static_cast<uint16_t>( ret );
+}
+
+// Sum the last (fewer than 8) bytes, as whole native-order words plus an odd trailing byte
+uint64_t sum_tail( const uint8_t* data, size_t len )
+{
+  uint64_t sum = 0;
+  for ( ; len >= 2; data += 2, len -= 2 ) {
+    uint16_t word {};
+    memcpy( &word, data, 2 );
+    sum += word;
+  }
+  if ( len ) {
+    array<uint8_t, 2> last { data[0], 0 };
+    uint16_t word {};
+    memcpy( &word, last.data(), 2 );
+    sum += word;
+  }
+  return sum;
+}
+
+// Eight bytes at a time: 32-bit halves of each 64-bit word accumulate in a 64-bit register
+uint64_t sum_words( const uint8_t* data, size_t len )
+{
+  uint64_t sum = 0;
+  for ( ; len >= 8; data += 8, len -= 8 ) {
+    uint64_t word {};
+    memcpy( &word, data, 8 );
+    sum += ( word >> 32 ) + ( word & 0xffff'ffff );
+  }
+  return fold_to_32( sum ) + sum_tail( data, len );
+}
+
+#if defined( __x86_64__ )
+
+// Each iteration widens eight 16-bit words into 32-bit lanes, so a lane grows by at most 2 * 0xffff per
+// iteration and the lanes must be drained into a 64-bit sum before 2^15 iterations.
+constexpr size_t MAX_VECTOR_ITERATIONS = 1 << 14;
+
+__attribute__( ( target( "sse2" ) ) ) uint64_t sum_sse2( const uint8_t* data, size_t len )
+{
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t sum = 0;
+  while ( len >= 16 ) {
+    __m128i acc = _mm_setzero_si128();
+    for ( size_t i = 0; i < MAX_VECTOR_ITERATIONS and len >= 16; ++i, data += 16, len -= 16 ) {
+      const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) );
+      acc = _mm_add_epi32( acc, _mm_unpacklo_epi16( v, zero ) );
+      acc = _mm_add_epi32( acc, _mm_unpackhi_epi16( v, zero ) );
+    }
+    array<uint32_t, 4> lanes {};
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( lanes.data() ), acc );
+    for ( const auto lane : lanes ) {
+      sum += lane;
+    }
+  }
+  return fold_to_32( sum ) + sum_words( data, len );
+}
+
+__attribute__( ( target( "avx2" ) ) ) uint64_t sum_avx2( const uint8_t* data, size_t len )
+{
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t sum = 0;
+  while ( len >= 32 ) {
+    __m256i acc = _mm256_setzero_si256();
+    for ( size_t i = 0; i < MAX_VECTOR_ITERATIONS and len >= 32; ++i, data += 32, len -= 32 ) {
+      const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( data ) );
+      acc = _mm256_add_epi32( acc, _mm256_unpacklo_epi16( v, zero ) );
+      acc = _mm256_add_epi32( acc, _mm256_unpackhi_epi16( v, zero ) );
+    }
+    array<uint32_t, 8> lanes {};
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( lanes.data() ), acc );
+    for ( const auto lane : lanes ) {
+      sum += lane;
+    }
+  }
+  return fold_to_32( sum ) + sum_words( data, len );
+}
+
+#endif
+
+const vector<InternetChecksum::Implementation>& implementations()
+{
+  static const vector<InternetChecksum::Implementation> ret = [] {
+    vector<InternetChecksum::Implementation> impls { { "word", sum_words } };
+#if defined( __x86_64__ )
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "sse2" ) ) {
+      impls.push_back( { "sse2", sum_sse2 } );
+    }
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+      impls.push_back( { "avx2", sum_avx2 } );
+    }
+#endif
+    return impls;
+  }();
+  return ret;
+}
+
+} // namespace
+
+span<const InternetChecksum::Implementation> InternetChecksum::available_implementations()
+{
+  return implementations();
+}
+
+const InternetChecksum::Implementation& InternetChecksum::implementation()
+{
+  static const Implementation& best = implementations().back();
+  return best;
+}
+
+uint16_t InternetChecksum::sum_of( const string_view data )
+{
+  const auto* bytes = reinterpret_cast<const uint8_t*>( data.data() );
+  const uint16_t sum = fold_to_16( implementation().sum( bytes, data.size() ) );
+  if constexpr ( endian::native == endian::little ) {
+    return __builtin_bswap16( sum );
+  }
+  return sum;
+}
+
+void InternetChecksum::add_sum( const uint16_t sum, const size_t length )
+{
+  // data that starts in the middle of a word contributes its sum byte-swapped (RFC 1071, section 2(B))
+  sum_ = fold_to_16( uint64_t { sum_ } + ( parity_ ? __builtin_bswap16( sum ) : sum ) );
+  parity_ ^= length % 2;
+}
+
+void InternetChecksum::add( const string_view data )
+{
+  if ( data.empty() ) {
+    return;
+  }
+
+  // finish the word started by the previous call
+  if ( parity_ ) {
+    sum_ += static_cast<uint8_t>( data.front() );
+    parity_ = false;
+    add_sum( sum_of( data.substr( 1 ) ), data.size() - 1 );
+    return;
+  }
+
+  add_sum( sum_of( data ), data.size() );
+}
+
+void InternetChecksum::add( const Buffer& data )
+{
+  if ( const auto sum = data.checksum() ) {
+    add_sum( sum.value(), data.size() );
+  } else {
+    add( static_cast<string_view>( data ) );
+  }
+}
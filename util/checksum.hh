@@ -2,30 +2,48 @@
 
 #include "buffer.hh"
 
+#include <cstddef>
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
 
 //! The internet checksum algorithm
 class InternetChecksum
 {
+public:
+  //! \brief One way of summing a block of data
+  //! \details `sum` returns the one's-complement sum of the 16-bit words of `data`, read in native byte order
+  //! (RFC 1071 shows this differs from the network-order sum only by a final byte swap). An odd trailing byte
+  //! is summed as the first byte of a word whose second byte is zero. The result is not folded.
+  struct Implementation
+  {
+    const char* name;
+    uint64_t ( *sum )( const uint8_t* data, size_t len );
+  };
+
+  //! The implementations that the running CPU supports, slowest first
+  static std::span<const Implementation> available_implementations();
+
+  //! The implementation used by add(), chosen on first use
+  static const Implementation& implementation();
+
 private:
   uint32_t sum_;
   bool parity_ {};
 
 public:
   explicit InternetChecksum( const uint32_t sum = 0 ) : sum_( sum ) {}
-  void add( std::string_view data )
-  {
-    for ( const uint8_t i : data ) {
-      uint16_t val = i;
-      if ( not parity_ ) {
-        val <<= 8;
-      }
-      sum_ += val;
-      parity_ = !parity_;
-    }
-  }
+  void add( std::string_view data );
+
+  //! Add a Buffer, reusing its remembered checksum (Buffer::checksum) when it has one
+  void add( const Buffer& data );
+
+  //! Add a sum previously returned by sum_of() for `length` bytes, as if those bytes were added here
+  void add_sum( uint16_t sum, size_t length );
+
+  //! The folded, uncomplemented checksum of `data` on its own
+  static uint16_t sum_of( std::string_view data );
 
   uint16_t value() const
   {
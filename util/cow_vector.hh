@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+//! A vector whose copies share its elements, in chunks of `ChunkSize`, until they are changed.
+//! Copying costs one pointer per chunk; changing an element of a chunk that is shared with another copy first
+//! copies that chunk (copy-on-write), so a copy that differs in a few elements still shares all the others.
+//! Reading an element costs one more dependent load than in a std::vector. Copies that share chunks must not be
+//! changed, copied or destroyed concurrently.
+template<typename T, size_t ChunkSize = 1024>
+class CowVector
+{
+  static_assert( std::has_single_bit( ChunkSize ), "chunk size must be a power of two" );
+
+  using Chunk = std::array<T, ChunkSize>;
+
+  std::vector<std::shared_ptr<Chunk>> chunks_ {};
+  size_t size_ {};
+
+  // Chunk `c`, copied first if another copy of the vector shares it
+  Chunk& writable( const size_t c )
+  {
+    auto& chunk = chunks_[c];
+    if ( chunk.use_count() > 1 ) {
+      chunk = std::make_shared<Chunk>( *chunk );
+    } else {
+      // (so that writes follow any reads made through copies that have since let go of the chunk)
+      std::atomic_thread_fence( std::memory_order_acquire );
+    }
+    return *chunk;
+  }
+
+public:
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[]( const size_t i ) const { return ( *chunks_[i / ChunkSize] )[i % ChunkSize]; }
+
+  //! Writable access to element `i` (copying its chunk, if it is shared)
+  T& mutable_at( const size_t i ) { return writable( i / ChunkSize )[i % ChunkSize]; }
+
+  void push_back( T value )
+  {
+    if ( size_ % ChunkSize == 0 ) {
+      chunks_.push_back( std::make_shared<Chunk>() );
+    }
+    writable( chunks_.size() - 1 )[size_ % ChunkSize] = std::move( value );
+    ++size_;
+  }
+
+  //! Bytes used by this copy's chunks (including those it shares with other copies)
+  size_t memory_usage() const { return chunks_.capacity() * sizeof( chunks_[0] ) + chunks_.size() * sizeof( Chunk ); }
+};
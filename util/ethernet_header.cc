@@ -1,10 +1,23 @@
 #include "ethernet_header.hh"
+#include "header_codec.hh"
 
+#include <array>
 #include <iomanip>
 #include <sstream>
 
 using namespace std;
 
+namespace {
+
+using namespace header_codec;
+using Codec = HeaderCodec<EthernetHeader,
+                          EthernetHeader::LENGTH,
+                          Field<0, &EthernetHeader::dst>,    // destination address
+                          Field<6, &EthernetHeader::src>,    // source address
+                          Field<12, &EthernetHeader::type>>; // frame type (e.g. IPv4, ARP, or something else)
+
+} // namespace
+
 //! \returns A string with a textual representation of an Ethernet address
 string to_string( const EthernetAddress address )
 {
@@ -43,32 +56,11 @@ string EthernetHeader::to_string() const
 
 void EthernetHeader::parse( Parser& parser )
 {
-  // read destination address
-  for ( auto& b : dst ) {
-    parser.integer( b );
-  }
-
-  // read source address
-  for ( auto& b : src ) {
-    parser.integer( b );
-  }
-
-  // read frame type (e.g. IPv4, ARP, or something else)
-  parser.integer( type );
+  array<char, LENGTH> scratch;
+  Codec::parse( *this, parser, scratch );
 }
 
 void EthernetHeader::serialize( Serializer& serializer ) const
 {
-  // write destination address
-  for ( const auto& b : dst ) {
-    serializer.integer( b );
-  }
-
-  // write source address
-  for ( const auto& b : src ) {
-    serializer.integer( b );
-  }
-
-  // write frame type (e.g. IPv4, ARP, or something else)
-  serializer.integer( type );
+  Codec::serialize( *this, serializer );
 }
@@ -2,11 +2,101 @@
 #include "exception.hh"
 #include "socket.hh"
 
+#include <bit>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+uint64_t nanoseconds_between( const steady_clock::time_point start, const steady_clock::time_point end )
+{
+  return duration_cast<nanoseconds>( end - start ).count();
+}
+
+// Charges the time spent in one call to wait_next_event (minus the time spent in poll) as busy time.
+class BusyTimer
+{
+  EventLoop::LoopStats& stats_;
+  steady_clock::time_point start_ { steady_clock::now() };
+  uint64_t poll_ns_ {};
+
+public:
+  explicit BusyTimer( EventLoop::LoopStats& stats ) : stats_( stats ) { ++stats_.iterations; }
+
+  void add_poll_time( const uint64_t ns )
+  {
+    poll_ns_ += ns;
+    stats_.poll_wait_ns += ns;
+    ++stats_.polls;
+  }
+
+  ~BusyTimer() { stats_.busy_ns += nanoseconds_between( start_, steady_clock::now() ) - poll_ns_; }
+
+  BusyTimer( const BusyTimer& other ) = delete;
+  BusyTimer& operator=( const BusyTimer& other ) = delete;
+  BusyTimer( BusyTimer&& other ) = delete;
+  BusyTimer& operator=( BusyTimer&& other ) = delete;
+};
+
+} // namespace
+
+void EventLoop::CategoryStats::record( const uint64_t ns )
+{
+  ++invocations;
+  total_ns += ns;
+  max_ns = max( max_ns, ns );
+  ++histogram.at( min( static_cast<size_t>( bit_width( ns ) ), HISTOGRAM_BUCKETS - 1 ) );
+}
+
+uint64_t EventLoop::CategoryStats::quantile_ns( const double q ) const
+{
+  if ( invocations == 0 ) {
+    return 0;
+  }
+
+  const auto rank = static_cast<uint64_t>( q * static_cast<double>( invocations - 1 ) );
+  uint64_t seen = 0;
+  for ( size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket ) {
+    seen += histogram.at( bucket );
+    if ( seen > rank ) {
+      return min( max_ns, bucket == 0 ? 0 : ( uint64_t { 1 } << bucket ) - 1 );
+    }
+  }
+  return max_ns;
+}
+
+void EventLoop::run_callback( const BasicRule& rule )
+{
+  const auto start = steady_clock::now();
+  rule.callback();
+  _rule_categories.at( rule.category_id ).record( nanoseconds_between( start, steady_clock::now() ) );
+}
+
+void EventLoop::summary( ostream& out ) const
+{
+  const auto ms = []( const uint64_t ns ) { return static_cast<double>( ns ) / 1e6; };
+  const auto us = []( const uint64_t ns ) { return static_cast<double>( ns ) / 1e3; };
+
+  // format into a string first, so that summaries from concurrent loops are not interleaved
+  stringstream ss {};
+  ss << fixed << setprecision( 3 );
+  ss << "EventLoop: " << _loop_stats.iterations << " iterations, " << _loop_stats.polls << " polls, "
+     << ms( _loop_stats.poll_wait_ns ) << " ms waiting in poll, " << ms( _loop_stats.busy_ns ) << " ms busy\n";
+  for ( const auto& cat : _rule_categories ) {
+    if ( cat.invocations == 0 ) {
+      continue;
+    }
+    ss << "  " << cat.name << ": " << cat.invocations << " calls, " << ms( cat.total_ns ) << " ms total, "
+       << us( cat.total_ns / cat.invocations ) << " us mean, " << us( cat.quantile_ns( 0.99 ) ) << " us p99, "
+       << us( cat.max_ns ) << " us max\n";
+  }
+  out << ss.str();
+}
 
 unsigned int EventLoop::FDRule::service_count() const
 {
@@ -19,7 +109,9 @@ size_t EventLoop::add_category( const string& name )
     throw runtime_error( "maximum categories reached" );
   }
 
-  _rule_categories.push_back( { name } );
+  CategoryStats category;
+  category.name = name;
+  _rule_categories.push_back( move( category ) );
   return _rule_categories.size() - 1;
 }
 
@@ -32,7 +124,7 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
                            Direction s_direction,
                            CallbackT s_cancel,
                            InterestT s_recover )
-  : BasicRule( base )
+  : BasicRule( move( base ) )
   , fd( move( s_fd ) )
   , direction( s_direction )
   , cancel( move( s_cancel ) )
@@ -51,10 +143,10 @@ EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
     throw out_of_range( "bad category_id" );
   }
 
-  _fd_rules.emplace_back( make_shared<FDRule>(
-    BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, recover ) );
+  const auto key = _fd_rules.emplace(
+    BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, recover );
 
-  return RuleHandle { _fd_rules.back() };
+  return RuleHandle { *this, true, key };
 }
 
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
@@ -65,16 +157,16 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
     throw out_of_range( "bad category_id" );
   }
 
-  _non_fd_rules.emplace_back( make_shared<BasicRule>( category_id, interest, callback ) );
+  const auto key = _non_fd_rules.emplace( category_id, interest, callback );
 
-  return RuleHandle { _non_fd_rules.back() };
+  return RuleHandle { *this, false, key };
 }
 
 void EventLoop::RuleHandle::cancel()
 {
-  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
-  if ( rule_shared_ptr ) {
-    rule_shared_ptr->cancel_requested = true;
+  BasicRule* const rule = fd_rule_ ? loop_->_fd_rules.find( key_ ) : loop_->_non_fd_rules.find( key_ );
+  if ( rule ) {
+    rule->cancel_requested = true;
   }
 }
 
@@ -82,74 +174,80 @@ void EventLoop::RuleHandle::cancel()
 // NOLINTBEGIN(*-signed-bitwise)
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
+  BusyTimer busy_timer { _loop_stats };
+
   // first, handle the non-file-descriptor-related rules
-  {
-    for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
-      auto& this_rule = **it;
-      bool rule_fired = false;
+  for ( size_t idx = 0; idx < _non_fd_rules.slot_count(); ++idx ) {
+    if ( not _non_fd_rules.occupied( idx ) ) {
+      continue;
+    }
 
-      if ( this_rule.cancel_requested ) {
-        it = _non_fd_rules.erase( it );
-        continue;
-      }
+    auto& this_rule = _non_fd_rules.at( idx );
+    bool rule_fired = false;
 
-      uint8_t iterations = 0;
-      while ( this_rule.interest() ) {
-        if ( iterations++ >= 128 ) {
-          throw runtime_error( "EventLoop: busy wait detected: rule \""
-                               + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
-                               + to_string( iterations ) + " iterations" );
-        }
+    if ( this_rule.cancel_requested ) {
+      _non_fd_rules.erase( idx );
+      continue;
+    }
 
-        rule_fired = true;
-        this_rule.callback();
+    uint8_t iterations = 0;
+    while ( this_rule.interest() ) {
+      if ( iterations++ >= 128 ) {
+        throw runtime_error( "EventLoop: busy wait detected: rule \""
+                             + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
+                             + to_string( iterations ) + " iterations" );
       }
 
-      if ( rule_fired ) {
-        return Result::Success; /* only serve one rule on each iteration */
-      }
+      rule_fired = true;
+      run_callback( this_rule );
+    }
 
-      ++it;
+    if ( rule_fired ) {
+      return Result::Success; /* only serve one rule on each iteration */
     }
   }
 
   // now the file-descriptor-related rules. poll any "interested" file descriptors
-  vector<pollfd> pollfds {};
-  pollfds.reserve( _fd_rules.size() );
+  _pollfds.clear();
+  _polled_rules.clear();
   bool something_to_poll = false;
 
   // set up the pollfd for each rule
-  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
-    auto& this_rule = **it;
+  for ( size_t idx = 0; idx < _fd_rules.slot_count(); ++idx ) {
+    if ( not _fd_rules.occupied( idx ) ) {
+      continue;
+    }
+
+    auto& this_rule = _fd_rules.at( idx );
 
     if ( this_rule.cancel_requested ) {
       //      this_rule.cancel();
       //      if rule is cancelled externally, no need to call the cancellation callback
       //      this makes it easier to cancel rules and delete captured objects right away
-      it = _fd_rules.erase( it );
+      _fd_rules.erase( idx );
       continue;
     }
 
     if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
       // no more reading on this rule, it's reached eof
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      _fd_rules.erase( idx );
       continue;
     }
 
     if ( this_rule.fd.closed() ) {
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      _fd_rules.erase( idx );
       continue;
     }
 
     if ( this_rule.interest() ) {
-      pollfds.push_back( { this_rule.fd.fd_num(), static_cast<int16_t>( this_rule.direction ), 0 } );
+      _pollfds.push_back( { this_rule.fd.fd_num(), static_cast<int16_t>( this_rule.direction ), 0 } );
       something_to_poll = true;
     } else {
-      pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
+      _pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
     }
-    ++it;
+    _polled_rules.push_back( idx );
   }
 
   // quit if there is nothing left to poll
@@ -158,21 +256,24 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
+  const auto poll_start = steady_clock::now();
+  const int ready = CheckSystemCall( "poll", ::poll( _pollfds.data(), _pollfds.size(), timeout_ms ) );
+  busy_timer.add_poll_time( nanoseconds_between( poll_start, steady_clock::now() ) );
+  if ( ready == 0 ) {
     return Result::Timeout;
   }
 
   // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
-    const auto& this_pollfd = pollfds.at( idx );
-    auto& this_rule = **it;
+  for ( size_t poll_idx = 0; poll_idx < _pollfds.size(); ++poll_idx ) {
+    const auto& this_pollfd = _pollfds.at( poll_idx );
+    const uint32_t idx = _polled_rules.at( poll_idx );
+    auto& this_rule = _fd_rules.at( idx );
 
     const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
     if ( poll_error ) {
       /* recoverable error? */
       if ( not static_cast<bool>( this_pollfd.revents & POLLNVAL ) ) {
         if ( this_rule.recover() ) {
-          ++it;
           continue;
         }
       }
@@ -194,7 +295,7 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       }
 
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      _fd_rules.erase( idx );
       continue;
     }
 
@@ -206,14 +307,14 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       //   - if it was POLLOUT, it will not be writable again
       // additionally, consider FD defunct if rule will only query for Direction::Out
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      _fd_rules.erase( idx );
       continue;
     }
 
     if ( poll_ready ) {
       // we only want to call callback if revents includes the event we asked for
       const auto count_before = this_rule.service_count();
-      this_rule.callback();
+      run_callback( this_rule );
 
       if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
         throw runtime_error( "EventLoop: busy wait detected: rule \""
@@ -223,8 +324,6 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 
       return Result::Success; /* only serve one rule on each iteration */
     }
-
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
   }
 
   return Result::Success;
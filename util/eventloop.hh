@@ -1,13 +1,16 @@
 #pragma once
 
-#include <functional>
-#include <list>
-#include <memory>
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <ostream>
 #include <poll.h>
 #include <string_view>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "inplace_function.hh"
+#include "slot_map.hh"
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop
@@ -20,15 +23,45 @@ public:
     Out = POLLOUT //!< Callback will be triggered when Rule::fd is writable.
   };
 
-private:
-  using CallbackT = std::function<void( void )>;
-  using InterestT = std::function<bool( void )>;
+  //! Timing statistics for the callbacks of one rule category.
+  struct CategoryStats
+  {
+    //! Bucket `i` of the histogram counts callbacks that took [2^(i-1), 2^i) ns (bucket 0 counts 0 ns).
+    static constexpr size_t HISTOGRAM_BUCKETS = 40;
+
+    std::string name {};
+    uint64_t invocations {};
+    uint64_t total_ns {};
+    uint64_t max_ns {};
+    std::array<uint64_t, HISTOGRAM_BUCKETS> histogram {};
+
+    //! Account for one callback that ran for `ns` nanoseconds.
+    void record( uint64_t ns );
+
+    //! Approximate `q`-quantile (0 <= q <= 1) of callback latency, as the upper bound of its histogram bucket.
+    uint64_t quantile_ns( double q ) const;
+  };
 
-  struct RuleCategory
+  //! Time spent by the loop as a whole.
+  struct LoopStats
   {
-    std::string name;
+    uint64_t iterations {};   //!< Calls to EventLoop::wait_next_event
+    uint64_t polls {};        //!< Calls to [poll(2)](\ref man2::poll)
+    uint64_t poll_wait_ns {}; //!< Time spent blocked in poll
+    uint64_t busy_ns {};      //!< Time spent in wait_next_event outside poll (setup and callbacks)
   };
 
+  //! A copy of the loop-wide and per-category statistics.
+  struct Stats
+  {
+    LoopStats loop {};
+    std::vector<CategoryStats> categories {};
+  };
+
+private:
+  using CallbackT = InplaceFunction<void( void )>;
+  using InterestT = InplaceFunction<bool( void )>;
+
   struct BasicRule
   {
     size_t category_id;
@@ -57,12 +90,28 @@ private:
     unsigned int service_count() const;
   };
 
-  std::vector<RuleCategory> _rule_categories {};
-  std::list<std::shared_ptr<FDRule>> _fd_rules {};
-  std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  static constexpr size_t INITIAL_POLL_CAPACITY = 64;
+
+  std::vector<CategoryStats> _rule_categories {};
+  SlotMap<FDRule> _fd_rules {};
+  SlotMap<BasicRule> _non_fd_rules {};
+
+  //! Scratch space for wait_next_event, kept between calls so that polling does not allocate
+  std::vector<pollfd> _pollfds {};
+  std::vector<uint32_t> _polled_rules {}; //!< Slot index in _fd_rules of the rule behind each entry of _pollfds
+
+  LoopStats _loop_stats {};
+
+  //! Run the rule's callback, charging its running time to the rule's category.
+  void run_callback( const BasicRule& rule );
 
 public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  EventLoop()
+  {
+    _rule_categories.reserve( 64 );
+    _pollfds.reserve( INITIAL_POLL_CAPACITY );
+    _polled_rules.reserve( INITIAL_POLL_CAPACITY );
+  }
 
   //! Returned by each call to EventLoop::wait_next_event.
   enum class Result
@@ -75,13 +124,17 @@ public:
 
   size_t add_category( const std::string& name );
 
+  //! Names a rule so that it can be cancelled later. Cancelling a rule that has already been removed
+  //! is a no-op. A RuleHandle must not outlive the EventLoop that issued it.
   class RuleHandle
   {
-    std::weak_ptr<BasicRule> rule_weak_ptr_;
+    EventLoop* loop_;
+    bool fd_rule_;
+    SlotKey key_;
 
   public:
-    template<class RuleType>
-    explicit RuleHandle( const std::shared_ptr<RuleType> x ) : rule_weak_ptr_( x )
+    RuleHandle( EventLoop& loop, bool fd_rule, SlotKey key )
+      : loop_( &loop ), fd_rule_( fd_rule ), key_( key )
     {}
 
     void cancel();
@@ -104,6 +157,13 @@ public:
   //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
   Result wait_next_event( int timeout_ms );
 
+  //! Snapshot of the statistics gathered so far.
+  //! \note Not synchronized: call from the thread that runs the loop, or while the loop is idle.
+  Stats stats() const { return { _loop_stats, _rule_categories }; }
+
+  //! Print a human-readable summary of stats() to `out`.
+  void summary( std::ostream& out ) const;
+
   // convenience function to add category and rule at the same time
   template<typename... Targs>
   auto add_rule( const std::string& name, Targs&&... Fargs )
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! A hash table from 32-bit keys (such as IPv4 addresses) to values, using open addressing with linear
+//! probing. The slots live in one array whose size is a power of two, kept at most half full, so a lookup
+//! usually touches one or two adjacent slots. Erasing shifts later entries of the probe run back instead of
+//! leaving tombstones. Inserting may move every value (when the table grows) and erasing may move some, so
+//! pointers returned by find() are valid only until the next insertion or erasure.
+template<typename T>
+class FlatHashMap
+{
+  struct Slot
+  {
+    uint32_t key {};
+    std::optional<T> value {};
+  };
+
+  std::vector<Slot> slots_ { 16 };
+  size_t size_ {};
+  int shift_ { 28 }; // 32 - log2( slots_.size() )
+
+  size_t mask() const { return slots_.size() - 1; }
+
+  // Fibonacci hashing: the high bits of the product depend on every bit of the key
+  size_t home( const uint32_t key ) const { return static_cast<uint32_t>( key * 0x9e3779b9U ) >> shift_; }
+
+  size_t find_slot( const uint32_t key ) const
+  {
+    size_t i = home( key );
+    while ( slots_[i].value.has_value() and slots_[i].key != key ) {
+      i = ( i + 1 ) & mask();
+    }
+    return i;
+  }
+
+  void grow()
+  {
+    std::vector<Slot> old = std::exchange( slots_, std::vector<Slot>( slots_.size() * 2 ) );
+    shift_--;
+    for ( auto& slot : old ) {
+      if ( slot.value.has_value() ) {
+        auto& dest = slots_[find_slot( slot.key )];
+        dest.key = slot.key;
+        dest.value = std::move( slot.value );
+      }
+    }
+  }
+
+public:
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  //! The value for `key`, or nullptr
+  T* find( const uint32_t key )
+  {
+    auto& slot = slots_[find_slot( key )];
+    return slot.value.has_value() ? &*slot.value : nullptr;
+  }
+  const T* find( const uint32_t key ) const
+  {
+    const auto& slot = slots_[find_slot( key )];
+    return slot.value.has_value() ? &*slot.value : nullptr;
+  }
+
+  //! The value for `key`, default-constructed first if absent, and whether it was inserted
+  std::pair<T&, bool> try_emplace( const uint32_t key )
+  {
+    if ( 2 * ( size_ + 1 ) > slots_.size() ) {
+      grow();
+    }
+    auto& slot = slots_[find_slot( key )];
+    if ( slot.value.has_value() ) {
+      return { *slot.value, false };
+    }
+    slot.key = key;
+    slot.value.emplace();
+    size_++;
+    return { *slot.value, true };
+  }
+
+  //! Remove `key`; returns whether it was present
+  bool erase( const uint32_t key )
+  {
+    size_t hole = find_slot( key );
+    if ( not slots_[hole].value.has_value() ) {
+      return false;
+    }
+    slots_[hole].value.reset();
+    size_--;
+
+    // Move back any later entry of the run that may no longer be reachable from its home slot
+    for ( size_t i = ( hole + 1 ) & mask(); slots_[i].value.has_value(); i = ( i + 1 ) & mask() ) {
+      const size_t from_home = ( i - home( slots_[i].key ) ) & mask();
+      if ( from_home >= ( ( i - hole ) & mask() ) ) {
+        slots_[hole].key = slots_[i].key;
+        slots_[hole].value = std::move( slots_[i].value );
+        slots_[i].value.reset();
+        hole = i;
+      }
+    }
+    return true;
+  }
+
+  //! Call f( key, value ) for every entry (which must not insert or erase)
+  template<typename F>
+  void for_each( F&& f )
+  {
+    for ( auto& slot : slots_ ) {
+      if ( slot.value.has_value() ) {
+        f( slot.key, *slot.value );
+      }
+    }
+  }
+};
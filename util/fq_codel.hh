@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! \brief Active queue management for an output queue: FQ-CoDel (RFC 8290)
+//! \details Items are hashed by flow into buckets, which take turns by deficit round robin; a bucket that has
+//! just become active goes first, so sparse (interactive) flows are not stuck behind bulk ones. Each bucket is
+//! managed by CoDel (RFC 8289): once its items have been waiting longer than `target` for at least `interval`,
+//! it drops (or, with ECN, marks) items as they leave, more often the longer the delay persists, until the
+//! delay is back under target. Times are in ms. Items live in one pool, linked into their buckets, so queueing
+//! allocates nothing once the pool has grown to the largest backlog.
+template<typename T>
+class FQCoDel
+{
+public:
+  struct Config
+  {
+    uint64_t target = 5;     //!< acceptable standing delay, in ms
+    uint64_t interval = 100; //!< ms for which the delay must exceed target before dropping starts
+    size_t quantum = 1514;   //!< bytes a bucket may send per round
+    size_t buckets = 1024;
+    size_t limit = 10240; //!< most items queued; beyond it, items are dropped from the longest bucket
+    bool ecn = false;     //!< mark items that allow it (ECN-capable) instead of dropping them
+  };
+
+  struct Stats
+  {
+    size_t backlog_items {}; // queued now
+    size_t backlog_bytes {}; // queued now
+    uint64_t enqueued {};
+    uint64_t dequeued {};
+    uint64_t dropped_overlimit {}; // to stay within the limit
+    uint64_t dropped_codel {};     // for delay
+    uint64_t marked {};            // for delay, with ECN
+  };
+
+private:
+  static constexpr uint32_t NIL = UINT32_MAX;
+
+  struct Node
+  {
+    T item {};
+    uint64_t enqueued_at {};
+    size_t size {};
+    uint32_t next { NIL }; // next item in the bucket, or next free node
+  };
+
+  enum class List : uint8_t
+  {
+    NONE,
+    NEW,
+    OLD
+  };
+
+  struct Bucket
+  {
+    uint32_t head { NIL };
+    uint32_t tail { NIL };
+    size_t bytes {};
+    int64_t deficit {};
+    uint32_t next { NIL }; // next bucket in the same list
+    List list { List::NONE };
+
+    // CoDel state
+    uint64_t first_above_time {}; // when the delay will have been above target for an interval (0: below)
+    uint64_t drop_next {};
+    uint32_t count {}; // items dropped since dropping started
+    uint32_t last_count {};
+    bool dropping {};
+  };
+
+  // A list of buckets with items to send
+  struct BucketList
+  {
+    uint32_t head { NIL };
+    uint32_t tail { NIL };
+  };
+
+  Config config_;
+  std::vector<Node> nodes_ {};
+  uint32_t free_ { NIL };
+  std::vector<Bucket> buckets_;
+  BucketList new_ {};
+  BucketList old_ {};
+  Stats stats_ {};
+
+  void push_back( BucketList& list, const uint32_t b, const List which )
+  {
+    buckets_[b].next = NIL;
+    buckets_[b].list = which;
+    if ( list.tail == NIL ) {
+      list.head = b;
+    } else {
+      buckets_[list.tail].next = b;
+    }
+    list.tail = b;
+  }
+
+  uint32_t pop_front( BucketList& list )
+  {
+    const uint32_t b = list.head;
+    list.head = buckets_[b].next;
+    if ( list.head == NIL ) {
+      list.tail = NIL;
+    }
+    buckets_[b].list = List::NONE;
+    return b;
+  }
+
+  // Unlink the oldest item of bucket `b` (NIL if it is empty)
+  uint32_t take( Bucket& bucket )
+  {
+    const uint32_t n = bucket.head;
+    if ( n != NIL ) {
+      bucket.head = nodes_[n].next;
+      if ( bucket.head == NIL ) {
+        bucket.tail = NIL;
+      }
+      bucket.bytes -= nodes_[n].size;
+      stats_.backlog_items--;
+      stats_.backlog_bytes -= nodes_[n].size;
+    }
+    return n;
+  }
+
+  void release( const uint32_t n )
+  {
+    nodes_[n].item = {};
+    nodes_[n].next = free_;
+    free_ = n;
+  }
+
+  // Take the oldest item of `bucket`, noting whether CoDel may drop it
+  uint32_t codel_take( Bucket& bucket, const uint64_t now, bool& ok_to_drop )
+  {
+    ok_to_drop = false;
+    const uint32_t n = take( bucket );
+    if ( n == NIL ) {
+      bucket.first_above_time = 0;
+      return n;
+    }
+
+    if ( now - nodes_[n].enqueued_at < config_.target or bucket.bytes <= config_.quantum ) {
+      bucket.first_above_time = 0;
+    } else if ( bucket.first_above_time == 0 ) {
+      bucket.first_above_time = now + config_.interval;
+    } else if ( now >= bucket.first_above_time ) {
+      ok_to_drop = true;
+    }
+    return n;
+  }
+
+  // Mark node `n` (true), or drop it
+  template<typename Mark>
+  bool mark_or_drop( const uint32_t n, Mark& mark )
+  {
+    if ( config_.ecn and mark( nodes_[n].item ) ) {
+      stats_.marked++;
+      return true;
+    }
+    release( n );
+    stats_.dropped_codel++;
+    return false;
+  }
+
+  // When to drop next, `count` drops after dropping started
+  uint64_t control_law( const uint64_t t, const uint32_t count ) const
+  {
+    const auto gap = static_cast<uint64_t>( static_cast<double>( config_.interval ) / std::sqrt( count ) );
+    return t + std::max( gap, uint64_t { 1 } );
+  }
+
+  // The next item of `bucket` to send, after any CoDel drops (NIL if none is left)
+  template<typename Mark>
+  uint32_t codel_dequeue( Bucket& bucket, const uint64_t now, Mark& mark )
+  {
+    bool ok_to_drop = false;
+    uint32_t n = codel_take( bucket, now, ok_to_drop );
+    if ( n == NIL ) {
+      bucket.dropping = false;
+      return n;
+    }
+
+    if ( bucket.dropping ) {
+      if ( not ok_to_drop ) {
+        bucket.dropping = false;
+      }
+      while ( bucket.dropping and now >= bucket.drop_next ) {
+        bucket.count++;
+        if ( mark_or_drop( n, mark ) ) {
+          bucket.drop_next = control_law( bucket.drop_next, bucket.count );
+          return n;
+        }
+        n = codel_take( bucket, now, ok_to_drop );
+        if ( n == NIL or not ok_to_drop ) {
+          bucket.dropping = false;
+        } else {
+          bucket.drop_next = control_law( bucket.drop_next, bucket.count );
+        }
+      }
+    } else if ( ok_to_drop ) {
+      if ( not mark_or_drop( n, mark ) ) {
+        n = codel_take( bucket, now, ok_to_drop );
+      }
+      bucket.dropping = true;
+
+      // Resume near the previous drop rate if dropping stopped only recently
+      const uint32_t delta = bucket.count - bucket.last_count;
+      bucket.count = delta > 1 and now - bucket.drop_next < 16 * config_.interval ? delta : 1;
+      bucket.drop_next = control_law( now, bucket.count );
+      bucket.last_count = bucket.count;
+    }
+    return n;
+  }
+
+  void drop_from_longest()
+  {
+    const auto longest = std::ranges::max_element( buckets_, {}, &Bucket::bytes );
+    const uint32_t n = take( *longest );
+    if ( n != NIL ) {
+      release( n );
+      stats_.dropped_overlimit++;
+    }
+  }
+
+public:
+  explicit FQCoDel( const Config& config = {} )
+    : config_( config ), buckets_( std::max( config.buckets, size_t { 1 } ) )
+  {}
+
+  //! Queue `item` of `size` bytes, from the flow with hash `flow_hash`, at time `now`
+  void enqueue( T item, const uint32_t flow_hash, const size_t size, const uint64_t now )
+  {
+    uint32_t n = free_;
+    if ( n == NIL ) {
+      n = static_cast<uint32_t>( nodes_.size() );
+      nodes_.emplace_back();
+    } else {
+      free_ = nodes_[n].next;
+    }
+    nodes_[n] = { std::move( item ), now, size, NIL };
+
+    const auto b = static_cast<uint32_t>( ( uint64_t { flow_hash } * buckets_.size() ) >> 32 );
+    Bucket& bucket = buckets_[b];
+    if ( bucket.tail == NIL ) {
+      bucket.head = n;
+    } else {
+      nodes_[bucket.tail].next = n;
+    }
+    bucket.tail = n;
+    bucket.bytes += size;
+    stats_.backlog_items++;
+    stats_.backlog_bytes += size;
+    stats_.enqueued++;
+
+    if ( bucket.list == List::NONE ) {
+      push_back( new_, b, List::NEW );
+      bucket.deficit = static_cast<int64_t>( config_.quantum );
+    }
+
+    if ( stats_.backlog_items > config_.limit ) {
+      drop_from_longest();
+    }
+  }
+
+  //! The next item to send at time `now`, if any. With ECN, mark( item ) is asked to mark an item that CoDel
+  //! would drop, and returns false if the item does not allow it (it is then dropped).
+  template<typename Mark>
+  std::optional<T> dequeue( const uint64_t now, Mark&& mark )
+  {
+    while ( true ) {
+      BucketList* list = new_.head != NIL ? &new_ : old_.head != NIL ? &old_ : nullptr;
+      if ( list == nullptr ) {
+        return std::nullopt;
+      }
+
+      const uint32_t b = list->head;
+      Bucket& bucket = buckets_[b];
+      if ( bucket.deficit <= 0 ) {
+        bucket.deficit += static_cast<int64_t>( config_.quantum );
+        pop_front( *list );
+        push_back( old_, b, List::OLD );
+        continue;
+      }
+
+      const uint32_t n = codel_dequeue( bucket, now, mark );
+      if ( n == NIL ) {
+        // An emptied new bucket goes to the end of the old list once, so that it cannot starve the others.
+        pop_front( *list );
+        if ( list == &new_ and old_.head != NIL ) {
+          push_back( old_, b, List::OLD );
+        }
+        continue;
+      }
+
+      bucket.deficit -= static_cast<int64_t>( nodes_[n].size );
+      stats_.dequeued++;
+      T item = std::move( nodes_[n].item );
+      release( n );
+      return item;
+    }
+  }
+
+  bool empty() const { return stats_.backlog_items == 0; }
+
+  const Stats& stats() const { return stats_; }
+  const Config& config() const { return config_; }
+};
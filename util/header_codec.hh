@@ -0,0 +1,138 @@
+#pragma once
+
+#include "parser.hh"
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+//! \file
+//! Compile-time descriptions of fixed-layout (network byte order) headers. A layout is a list of fields at
+//! fixed byte offsets; HeaderCodec turns it into an encoder that is a handful of stores into a byte array,
+//! and a decoder that is a handful of loads, with no per-byte bookkeeping.
+
+namespace header_codec {
+
+template<typename T>
+concept ByteArray = std::same_as<T, std::array<uint8_t, sizeof( T )>>;
+
+template<typename T>
+concept WireType = std::unsigned_integral<T> or ByteArray<T>;
+
+template<WireType T>
+inline void store( char* out, const T& val )
+{
+  if constexpr ( std::unsigned_integral<T> ) {
+    const T raw = swap_network_order( val );
+    std::memcpy( out, &raw, sizeof( T ) );
+  } else {
+    std::memcpy( out, val.data(), sizeof( T ) );
+  }
+}
+
+template<WireType T>
+inline T load( const char* in )
+{
+  T val {};
+  if constexpr ( std::unsigned_integral<T> ) {
+    std::memcpy( &val, in, sizeof( T ) );
+    return swap_network_order( val );
+  } else {
+    std::memcpy( val.data(), in, sizeof( T ) );
+    return val;
+  }
+}
+
+//! A data member that is stored as-is (an unsigned integer, or an array of bytes) at byte `Offset`
+template<size_t Offset, auto Member>
+struct Field;
+
+template<size_t Offset, typename H, WireType T, T H::*Member>
+struct Field<Offset, Member>
+{
+  using Header = H;
+  static constexpr size_t OFFSET = Offset;
+  static constexpr size_t SIZE = sizeof( T );
+
+  static void encode( const H& header, char* out ) { store( out + Offset, header.*Member ); }
+  static void decode( H& header, const char* in ) { header.*Member = load<T>( in + Offset ); }
+};
+
+//! A wire field of type `T` at byte `Offset` that is computed from the header (e.g., bit fields and flags).
+//! `Get` produces the wire value; `Set` applies a received wire value to the header. Fields are decoded in
+//! order, so `Set` must not depend on any other field; a header whose fields qualify each other (e.g., the TCP
+//! ackno, which means something only if the ACK flag is set) is better decoded into a struct of raw fields
+//! first, and interpreted afterwards.
+template<size_t Offset, WireType T, auto Get, auto Set>
+struct Computed;
+
+template<size_t Offset, WireType T, typename H, T ( *Get )( const H& ), void ( *Set )( H&, T )>
+struct Computed<Offset, T, Get, Set>
+{
+  using Header = H;
+  static constexpr size_t OFFSET = Offset;
+  static constexpr size_t SIZE = sizeof( T );
+
+  static void encode( const H& header, char* out ) { store( out + Offset, Get( header ) ); }
+  static void decode( H& header, const char* in ) { Set( header, load<T>( in + Offset ) ); }
+};
+
+//! The encoder and decoder for a header of `Length` bytes made of `Fields`, which must be listed in order
+//! and cover every byte exactly once
+template<typename H, size_t Length, typename... Fields>
+class HeaderCodec
+{
+  static constexpr bool fields_tile_header()
+  {
+    size_t next = 0;
+    return ( ( Fields::OFFSET == next and ( next += Fields::SIZE, true ) ) and ... ) and next == Length;
+  }
+
+  static_assert( ( std::is_same_v<typename Fields::Header, H> and ... ), "field belongs to another header" );
+  static_assert( fields_tile_header(), "fields must be in order, must not overlap, and must cover the header" );
+
+public:
+  static constexpr size_t LENGTH = Length;
+
+  static void encode( const H& header, std::span<char, Length> out )
+  {
+    ( Fields::encode( header, out.data() ), ... );
+  }
+
+  static void decode( H& header, std::span<const char, Length> in )
+  {
+    ( Fields::decode( header, in.data() ), ... );
+  }
+
+  static std::array<char, Length> encode( const H& header )
+  {
+    std::array<char, Length> out {};
+    encode( header, out );
+    return out;
+  }
+
+  static void serialize( const H& header, Serializer& serializer )
+  {
+    const auto out = encode( header );
+    serializer.bytes( { out.data(), out.size() } );
+  }
+
+  //! Decode the header from the parser's input, and consume it
+  //! \returns the raw header bytes (in the parser's input, or in `scratch` if the input was split), or nullptr
+  //! if the input was too short
+  static const char* parse( H& header, Parser& parser, std::array<char, Length>& scratch )
+  {
+    const char* in = parser.fixed( scratch );
+    if ( in ) {
+      decode( header, std::span<const char, Length> { in, Length } );
+    }
+    return in;
+  }
+};
+
+} // namespace header_codec
@@ -0,0 +1,95 @@
+#include "icmp_message.hh"
+#include "checksum.hh"
+#include "ipv4_header.hh"
+
+#include <string_view>
+
+using namespace std;
+
+void ICMPMessage::compute_checksum()
+{
+  checksum = 0;
+  InternetChecksum check;
+  check.add( ::serialize( *this ) );
+  checksum = check.value();
+}
+
+void ICMPMessage::parse( Parser& parser )
+{
+  parser.integer( type );
+  parser.integer( code );
+  parser.integer( checksum );
+  parser.integer( unused );
+  parser.integer( next_hop_mtu );
+
+  Buffer rest;
+  parser.all_remaining( rest );
+  original = string { string_view { rest } };
+
+  if ( not parser.has_error() ) {
+    InternetChecksum check;
+    check.add( ::serialize( *this ) );
+    if ( check.value() != 0 ) {
+      parser.set_error();
+    }
+  }
+}
+
+void ICMPMessage::serialize( Serializer& serializer ) const
+{
+  serializer.integer( type );
+  serializer.integer( code );
+  serializer.integer( checksum );
+  serializer.integer( unused );
+  serializer.integer( next_hop_mtu );
+  serializer.bytes( original );
+}
+
+bool may_report_icmp_error( const RawIPv4Datagram& dgram )
+{
+  if ( dgram.fragment_offset() != 0 ) {
+    return false;
+  }
+  if ( dgram.proto() != IPv4Header::PROTO_ICMP ) {
+    return true;
+  }
+
+  // Only queries (echo, timestamp and the like) may be answered with an error, not errors.
+  const size_t header_length = dgram.header_length();
+  const string_view first { dgram.buffers.front() };
+  if ( first.size() <= header_length ) {
+    return false;
+  }
+  const auto type = static_cast<uint8_t>( first[header_length] );
+  return type == 0 or type == 8 or type == 13 or type == 14 or type == 15 or type == 16;
+}
+
+RawIPv4Datagram make_fragmentation_needed( const RawIPv4Datagram& dropped,
+                                           const uint32_t src,
+                                           const uint16_t next_hop_mtu )
+{
+  ICMPMessage icmp;
+  icmp.type = ICMPMessage::TYPE_DESTINATION_UNREACHABLE;
+  icmp.code = ICMPMessage::CODE_FRAGMENTATION_NEEDED;
+  icmp.next_hop_mtu = next_hop_mtu;
+  const size_t quoted = dropped.header_length() + ICMPMessage::QUOTED_PAYLOAD_LENGTH;
+  for ( const auto& b : dropped.buffers ) {
+    icmp.original.append( string_view { b }.substr( 0, quoted - icmp.original.size() ) );
+    if ( icmp.original.size() == quoted ) {
+      break;
+    }
+  }
+  icmp.compute_checksum();
+
+  IPv4Datagram dgram;
+  dgram.header.proto = IPv4Header::PROTO_ICMP;
+  dgram.header.ttl = IPv4Header::DEFAULT_TTL;
+  dgram.header.df = false;
+  dgram.header.src = src;
+  dgram.header.dst = dropped.src();
+  dgram.payload = serialize( icmp );
+  dgram.header.len = IPv4Header::LENGTH + ICMPMessage::HEADER_LENGTH + icmp.original.size();
+  dgram.header.compute_checksum();
+
+  return RawIPv4Datagram::from( serialize( dgram ) ).value();
+}
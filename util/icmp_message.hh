@@ -0,0 +1,45 @@
+#pragma once
+
+#include "buffer.hh"
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// [ICMP](\ref rfc::rfc792) error message: a type and code, four bytes whose meaning depends on them, and the
+// start of the datagram that caused the error (its header and the first 8 bytes of its payload)
+struct ICMPMessage
+{
+  static constexpr size_t HEADER_LENGTH = 8;
+  static constexpr size_t QUOTED_PAYLOAD_LENGTH = 8; // payload bytes of the original datagram that are quoted
+  static constexpr uint8_t TYPE_DESTINATION_UNREACHABLE = 3;
+  static constexpr uint8_t CODE_FRAGMENTATION_NEEDED = 4;
+
+  uint8_t type {};
+  uint8_t code {};
+  uint16_t checksum {};
+  uint16_t unused {};
+  uint16_t next_hop_mtu {}; // of a "fragmentation needed" message (RFC 1191)
+  std::string original {};  // the start of the datagram that caused the error
+
+  // Is this a "fragmentation needed and DF set" message?
+  bool fragmentation_needed() const
+  {
+    return type == TYPE_DESTINATION_UNREACHABLE and code == CODE_FRAGMENTATION_NEEDED;
+  }
+
+  void compute_checksum();
+
+  void parse( Parser& parser );
+  void serialize( Serializer& serializer ) const;
+};
+
+// Whether a router that cannot forward `dgram` may say so with an ICMP error: not if it is itself an ICMP error,
+// or a fragment other than the first (RFC 1122, section 3.2.2)
+bool may_report_icmp_error( const RawIPv4Datagram& dgram );
+
+// An IPv4 datagram from `src` to the source of `dropped`, carrying a "fragmentation needed" message that quotes
+// it and gives the MTU of the link it did not fit
+RawIPv4Datagram make_fragmentation_needed( const RawIPv4Datagram& dropped, uint32_t src, uint16_t next_hop_mtu );
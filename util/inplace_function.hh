@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+//! A std::function-like wrapper that always stores its callable inline (it never allocates).
+//! Callables that do not fit in `Capacity` bytes are rejected at compile time.
+template<typename Signature, size_t Capacity = 64>
+class InplaceFunction;
+
+template<typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R( Args... ), Capacity>
+{
+  struct Operations
+  {
+    R ( *invoke )( void*, Args&&... );
+    void ( *copy )( void* dst, const void* src );
+    void ( *move )( void* dst, void* src );
+    void ( *destroy )( void* obj );
+  };
+
+  template<typename F>
+  static constexpr Operations operations_for {
+    []( void* obj, Args&&... args ) -> R {
+      return std::invoke( *static_cast<F*>( obj ), std::forward<Args>( args )... );
+    },
+    []( void* dst, const void* src ) { new ( dst ) F( *static_cast<const F*>( src ) ); },
+    []( void* dst, void* src ) { new ( dst ) F( std::move( *static_cast<F*>( src ) ) ); },
+    []( void* obj ) { static_cast<F*>( obj )->~F(); } };
+
+  alignas( std::max_align_t ) mutable std::array<std::byte, Capacity> storage_ {};
+  const Operations* ops_ {};
+
+  void reset()
+  {
+    if ( ops_ ) {
+      ops_->destroy( storage_.data() );
+      ops_ = nullptr;
+    }
+  }
+
+public:
+  InplaceFunction() = default;
+
+  // NOLINTBEGIN(*-explicit-*)
+
+  template<typename F>
+    requires( not std::is_same_v<std::remove_cvref_t<F>, InplaceFunction> )
+            and std::is_invocable_r_v<R, std::decay_t<F>&, Args...>
+  InplaceFunction( F&& f )
+  {
+    using StoredT = std::decay_t<F>;
+    static_assert( sizeof( StoredT ) <= Capacity, "InplaceFunction: callable is too large to store inline" );
+    static_assert( alignof( StoredT ) <= alignof( std::max_align_t ), "InplaceFunction: callable is over-aligned" );
+    static_assert( std::is_nothrow_move_constructible_v<StoredT>,
+                   "InplaceFunction: callable must be nothrow movable" );
+
+    new ( storage_.data() ) StoredT( std::forward<F>( f ) );
+    ops_ = &operations_for<StoredT>;
+  }
+
+  // NOLINTEND(*-explicit-*)
+
+  InplaceFunction( const InplaceFunction& other ) : ops_( other.ops_ )
+  {
+    if ( ops_ ) {
+      ops_->copy( storage_.data(), other.storage_.data() );
+    }
+  }
+
+  InplaceFunction( InplaceFunction&& other ) noexcept : ops_( other.ops_ )
+  {
+    if ( ops_ ) {
+      ops_->move( storage_.data(), other.storage_.data() );
+      other.reset();
+    }
+  }
+
+  InplaceFunction& operator=( const InplaceFunction& other )
+  {
+    if ( this != &other ) {
+      reset();
+      if ( other.ops_ ) {
+        other.ops_->copy( storage_.data(), other.storage_.data() );
+        ops_ = other.ops_;
+      }
+    }
+    return *this;
+  }
+
+  InplaceFunction& operator=( InplaceFunction&& other ) noexcept
+  {
+    if ( this != &other ) {
+      reset();
+      if ( other.ops_ ) {
+        other.ops_->move( storage_.data(), other.storage_.data() );
+        ops_ = other.ops_;
+        other.reset();
+      }
+    }
+    return *this;
+  }
+
+  ~InplaceFunction() { reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  R operator()( Args... args ) const
+  {
+    if ( not ops_ ) {
+      throw std::bad_function_call();
+    }
+    return ops_->invoke( storage_.data(), std::forward<Args>( args )... );
+  }
+};
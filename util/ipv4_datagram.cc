@@ -0,0 +1,233 @@
+#include "ipv4_datagram.hh"
+#include "checksum.hh"
+#include "header_codec.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+using namespace std;
+using header_codec::load;
+using header_codec::store;
+
+namespace {
+
+constexpr size_t TOS_OFFSET = 1;   // type of service: DSCP, then the two ECN bits
+constexpr size_t LEN_OFFSET = 2;   // total length
+constexpr size_t ID_OFFSET = 4;    // identification
+constexpr size_t FLAGS_OFFSET = 6; // flags and fragment offset
+constexpr size_t TTL_OFFSET = 8;   // TTL, followed by the protocol in the same 16-bit word
+constexpr size_t PROTO_OFFSET = 9;
+constexpr size_t CKSUM_OFFSET = 10; // header checksum
+constexpr size_t SRC_OFFSET = 12;   // source address
+constexpr size_t DST_OFFSET = 16;   // destination address
+
+constexpr uint8_t PROTO_UDP = 17;
+
+// ECN codepoints (RFC 3168)
+constexpr uint8_t ECN_MASK = 0x03;
+constexpr uint8_t ECN_NOT_ECT = 0x00;
+constexpr uint8_t ECN_CE = 0x03;
+
+// Make sure the first `len` bytes are in the first buffer, copying just those bytes if they are not.
+// Returns false if there are fewer than `len` bytes.
+bool make_contiguous( vector<Buffer>& buffers, const size_t len )
+{
+  if ( not buffers.empty() and buffers.front().size() >= len ) {
+    return true;
+  }
+
+  size_t total = 0;
+  for ( const auto& b : buffers ) {
+    total += b.size();
+  }
+  if ( total < len ) {
+    return false;
+  }
+
+  Buffer prefix = Buffer::allocate( len );
+  auto next = prefix.mutable_data().begin();
+  auto it = buffers.begin();
+  for ( size_t remaining = len; remaining > 0; ) {
+    const string_view view = string_view { *it }.substr( 0, remaining );
+    next = copy( view.begin(), view.end(), next );
+    remaining -= view.size();
+    it->remove_prefix( view.size() );
+    if ( it->empty() ) {
+      ++it;
+    }
+  }
+  buffers.erase( buffers.begin(), it );
+  buffers.insert( buffers.begin(), std::move( prefix ) );
+  return true;
+}
+
+// The header at the start of `buffers`, made writable: rewritten in place if no other Buffer shares it, and
+// otherwise copied (the payload is never touched)
+char* writable_header( vector<Buffer>& buffers, const size_t len )
+{
+  if ( not buffers.front().unique() ) {
+    Buffer copy = Buffer::allocate( len );
+    memcpy( copy.mutable_data().data(), string_view { buffers.front() }.data(), len );
+    buffers.front().remove_prefix( len );
+    if ( buffers.front().empty() ) {
+      buffers.front() = std::move( copy );
+    } else {
+      buffers.insert( buffers.begin(), std::move( copy ) );
+    }
+  }
+  return buffers.front().mutable_data().data();
+}
+
+// Replace the 16-bit word at `offset` in a header, updating its checksum incrementally:
+// HC' = ~(~HC + ~m + m'), where m is the old word and m' the new one (RFC 1624, eqn. 3)
+void replace_word( char* raw, const size_t offset, const uint16_t new_word )
+{
+  uint32_t sum = static_cast<uint16_t>( ~load<uint16_t>( raw + CKSUM_OFFSET ) );
+  sum += static_cast<uint16_t>( ~load<uint16_t>( raw + offset ) );
+  sum += new_word;
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + ( sum & 0xffff );
+  }
+
+  store( raw + offset, new_word );
+  store( raw + CKSUM_OFFSET, static_cast<uint16_t>( ~sum ) );
+}
+
+} // namespace
+
+optional<RawIPv4Datagram> RawIPv4Datagram::from( vector<Buffer> buffers )
+{
+  if ( not make_contiguous( buffers, IPv4Header::LENGTH ) ) {
+    return {};
+  }
+
+  RawIPv4Datagram dgram { std::move( buffers ) };
+  const uint8_t first_byte = string_view { dgram.buffers.front() }.front();
+  if ( first_byte >> 4 != 4 or dgram.header_length() < IPv4Header::LENGTH ) {
+    return {};
+  }
+  if ( not make_contiguous( dgram.buffers, dgram.header_length() ) ) {
+    return {};
+  }
+
+  InternetChecksum check;
+  check.add( dgram.header() );
+  if ( check.value() ) {
+    return {};
+  }
+
+  return dgram;
+}
+
+uint8_t RawIPv4Datagram::tos() const
+{
+  return header()[TOS_OFFSET];
+}
+
+uint8_t RawIPv4Datagram::ttl() const
+{
+  return header()[TTL_OFFSET];
+}
+
+uint8_t RawIPv4Datagram::proto() const
+{
+  return header()[PROTO_OFFSET];
+}
+
+uint32_t RawIPv4Datagram::src() const
+{
+  return load<uint32_t>( header().data() + SRC_OFFSET );
+}
+
+uint32_t RawIPv4Datagram::dst() const
+{
+  return load<uint32_t>( header().data() + DST_OFFSET );
+}
+
+uint16_t RawIPv4Datagram::total_length() const
+{
+  return load<uint16_t>( header().data() + LEN_OFFSET );
+}
+
+uint16_t RawIPv4Datagram::id() const
+{
+  return load<uint16_t>( header().data() + ID_OFFSET );
+}
+
+bool RawIPv4Datagram::dont_fragment() const
+{
+  return load<uint16_t>( header().data() + FLAGS_OFFSET ) & 0x4000;
+}
+
+bool RawIPv4Datagram::more_fragments() const
+{
+  return load<uint16_t>( header().data() + FLAGS_OFFSET ) & 0x2000;
+}
+
+size_t RawIPv4Datagram::fragment_offset() const
+{
+  return size_t { load<uint16_t>( header().data() + FLAGS_OFFSET ) & 0x1fffU } * 8;
+}
+
+size_t RawIPv4Datagram::size() const
+{
+  size_t ret = 0;
+  for ( const auto& b : buffers ) {
+    ret += b.size();
+  }
+  return ret;
+}
+
+uint32_t RawIPv4Datagram::flow_hash() const
+{
+  const char* raw = header().data();
+  const uint8_t proto = raw[PROTO_OFFSET];
+  const bool fragment = load<uint16_t>( raw + FLAGS_OFFSET ) & 0x3fff; // more fragments, or a nonzero offset
+
+  // Source and destination ports (the first four bytes of a TCP or UDP header), wherever they are
+  uint32_t ports = 0;
+  if ( ( proto == IPv4Header::PROTO_TCP or proto == PROTO_UDP ) and not fragment ) {
+    array<char, 4> bytes {};
+    size_t skip = header_length();
+    size_t copied = 0;
+    for ( const auto& b : buffers ) {
+      const string_view view = string_view { b }.substr( min( skip, b.size() ) );
+      skip -= min( skip, b.size() );
+      const size_t n = min( view.size(), bytes.size() - copied );
+      memcpy( bytes.data() + copied, view.data(), n );
+      copied += n;
+      if ( copied == bytes.size() ) {
+        ports = load<uint32_t>( bytes.data() );
+        break;
+      }
+    }
+  }
+
+  // Mix with the splitmix64 finalizer
+  uint64_t h = ( uint64_t { load<uint32_t>( raw + SRC_OFFSET ) } << 32 | load<uint32_t>( raw + DST_OFFSET ) )
+               ^ ( ( uint64_t { ports } << 8 | proto ) * 0x9e3779b97f4a7c15ULL );
+  h = ( h ^ ( h >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  h = ( h ^ ( h >> 27 ) ) * 0x94d049bb133111ebULL;
+  return static_cast<uint32_t>( h ^ ( h >> 31 ) );
+}
+
+void RawIPv4Datagram::decrement_ttl()
+{
+  char* raw = writable_header( buffers, header_length() );
+  const uint16_t old_word = load<uint16_t>( raw + TTL_OFFSET );
+  replace_word( raw, TTL_OFFSET, static_cast<uint16_t>( old_word - 0x0100 ) );
+}
+
+bool RawIPv4Datagram::mark_congestion_experienced()
+{
+  const auto ecn = static_cast<uint8_t>( tos() & ECN_MASK );
+  if ( ecn == ECN_NOT_ECT ) {
+    return false;
+  }
+  if ( ecn != ECN_CE ) {
+    char* raw = writable_header( buffers, header_length() );
+    replace_word( raw, 0, load<uint16_t>( raw ) | ECN_CE );
+  }
+  return true;
+}
@@ -4,7 +4,9 @@
 #include "parser.hh"
 
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 //! \brief [IPv4](\ref rfc::rfc791) Internet datagram
@@ -29,3 +31,47 @@ struct IPv4Datagram
 };
 
 using InternetDatagram = IPv4Datagram;
+
+//! \brief An IPv4 datagram kept as the buffers it arrived in, for forwarding without parsing or re-serializing it
+//! \details The header (with its options) is always contiguous at the start of the first buffer, so reading a
+//! field or rewriting the TTL costs the same whatever the size of the payload.
+struct RawIPv4Datagram
+{
+  std::vector<Buffer> buffers {};
+
+  //! Take `buffers` if they begin with a well-formed IPv4 header whose checksum is correct (a header that is
+  //! split across buffers is first copied into a buffer of its own)
+  static std::optional<RawIPv4Datagram> from( std::vector<Buffer> buffers );
+
+  std::string_view header() const { return std::string_view { buffers.front() }.substr( 0, header_length() ); }
+  size_t header_length() const { return ( std::string_view { buffers.front() }.front() & 0x0fU ) * size_t { 4 }; }
+
+  uint8_t tos() const; //!< type of service: DSCP (upper six bits) and ECN
+  uint8_t ttl() const;
+  uint8_t proto() const;
+  uint32_t src() const;
+  uint32_t dst() const;
+  uint16_t total_length() const;
+  uint16_t id() const;
+  bool dont_fragment() const;
+  bool more_fragments() const;
+  size_t fragment_offset() const; //!< in bytes
+
+  //! Whether this is a fragment of a larger datagram (more fragments follow, or it does not start at 0)
+  bool is_fragment() const { return more_fragments() or fragment_offset() != 0; }
+
+  //! Sum of the sizes of the buffers (the total length field may be smaller, if the link layer padded)
+  size_t size() const;
+
+  //! A stable hash of the flow's 5-tuple (addresses, protocol, and TCP or UDP ports). Fragments hash on
+  //! addresses and protocol only, so that all the fragments of a datagram hash alike.
+  uint32_t flow_hash() const;
+
+  //! Decrement the TTL and update the header checksum incrementally (RFC 1624). The header
+  //! is rewritten in place if no other Buffer shares it, and otherwise copied; the payload is never touched.
+  void decrement_ttl();
+
+  //! Mark the datagram Congestion Experienced in the ECN bits of the type of service (RFC 3168), updating the
+  //! checksum as decrement_ttl() does. Returns false, leaving the datagram alone, if it is not ECN-capable.
+  bool mark_congestion_experienced();
+};
@@ -0,0 +1,299 @@
+#include "ipv4_fragments.hh"
+#include "checksum.hh"
+#include "header_codec.hh"
+#include "ipv4_header.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using namespace std;
+using header_codec::store;
+
+namespace {
+
+constexpr size_t LEN_OFFSET = 2;    // total length
+constexpr size_t FLAGS_OFFSET = 6;  // flags and fragment offset
+constexpr size_t CKSUM_OFFSET = 10; // header checksum
+
+constexpr uint16_t DF = 0x4000;
+constexpr uint16_t MF = 0x2000;
+
+// The largest total length of an IPv4 datagram
+constexpr size_t MAX_LENGTH = 65535;
+
+// A writable copy of `header`, with a new total length, flags and fragment offset, and a correct checksum
+Buffer make_header( const string_view header, const size_t total_length, const uint16_t flags_and_offset )
+{
+  Buffer ret = Buffer::allocate( header.size() );
+  char* raw = ret.mutable_data().data();
+  memcpy( raw, header.data(), header.size() );
+  store( raw + LEN_OFFSET, static_cast<uint16_t>( total_length ) );
+  store( raw + FLAGS_OFFSET, flags_and_offset );
+  store( raw + CKSUM_OFFSET, uint16_t { 0 } );
+  InternetChecksum check;
+  check.add( string_view { raw, header.size() } );
+  store( raw + CKSUM_OFFSET, check.value() );
+  return ret;
+}
+
+// The header for fragments after the first: the fixed header and the options whose "copied" flag is set,
+// padded with end-of-options
+string later_fragment_header( const string_view header )
+{
+  string ret { header.substr( 0, IPv4Header::LENGTH ) };
+  for ( size_t i = IPv4Header::LENGTH; i < header.size(); ) {
+    const auto type = static_cast<uint8_t>( header[i] );
+    if ( type == 0 ) { // end of option list
+      break;
+    }
+    if ( type == 1 ) { // no-operation
+      i++;
+      continue;
+    }
+    if ( i + 1 >= header.size() ) {
+      break;
+    }
+    const auto length = static_cast<uint8_t>( header[i + 1] );
+    if ( length < 2 or i + length > header.size() ) {
+      break;
+    }
+    if ( type & 0x80 ) {
+      ret.append( header.substr( i, length ) );
+    }
+    i += length;
+  }
+  ret.resize( ( ret.size() + 3 ) / 4 * 4, 0 );
+  ret[0] = static_cast<char>( 0x40 | ret.size() / 4 );
+  return ret;
+}
+
+// Call f( buffer ) for each piece of the `n` bytes that start `skip` bytes into `buffers` (sharing, not copying)
+template<typename F>
+void for_each_slice( const vector<Buffer>& buffers, size_t skip, size_t n, F&& f )
+{
+  for ( const auto& b : buffers ) {
+    if ( n == 0 ) {
+      break;
+    }
+    if ( skip >= b.size() ) {
+      skip -= b.size();
+      continue;
+    }
+    Buffer piece = b;
+    piece.remove_prefix( skip );
+    skip = 0;
+    if ( piece.size() > n ) {
+      piece.truncate( n );
+    }
+    n -= piece.size();
+    f( std::move( piece ) );
+  }
+}
+
+} // namespace
+
+bool fragment_ipv4( RawIPv4Datagram dgram, const size_t mtu, vector<RawIPv4Datagram>& out )
+{
+  const size_t total = dgram.total_length();
+  if ( total <= mtu ) {
+    out.push_back( std::move( dgram ) );
+    return true;
+  }
+
+  const size_t header_length = dgram.header_length();
+  if ( dgram.dont_fragment() or total < header_length or dgram.size() < total ) {
+    return false;
+  }
+  const string later_header = later_fragment_header( dgram.header() );
+  if ( mtu < max( header_length, later_header.size() ) + 8 ) {
+    return false;
+  }
+
+  // A datagram that is itself a fragment is split into fragments of the original
+  const size_t payload_length = total - header_length;
+  const size_t base = dgram.fragment_offset();
+  const bool more = dgram.more_fragments();
+
+  for ( size_t pos = 0; pos < payload_length; ) {
+    const string_view header = pos == 0 ? dgram.header() : string_view { later_header };
+    const size_t n = min( payload_length - pos, ( mtu - header.size() ) & ~size_t { 7 } );
+    const bool last = pos + n == payload_length;
+
+    RawIPv4Datagram fragment;
+    fragment.buffers.push_back( make_header(
+      header, header.size() + n, static_cast<uint16_t>( ( last and not more ? 0 : MF ) | ( base + pos ) / 8 ) ) );
+    for_each_slice( dgram.buffers, header_length + pos, n, [&]( Buffer b ) {
+      fragment.buffers.push_back( std::move( b ) );
+    } );
+    out.push_back( std::move( fragment ) );
+    pos += n;
+  }
+  return true;
+}
+
+void IPv4Reassembler::remove( const size_t index )
+{
+  stats_.pending_bytes -= partials_[index].bytes;
+  if ( index + 1 != partials_.size() ) {
+    partials_[index] = std::move( partials_.back() );
+  }
+  partials_.pop_back();
+  stats_.pending_datagrams = partials_.size();
+}
+
+void IPv4Reassembler::evict_oldest( const size_t keep )
+{
+  size_t oldest = partials_.size();
+  for ( size_t i = 0; i < partials_.size(); i++ ) {
+    if ( i != keep and ( oldest == partials_.size() or partials_[i].deadline < partials_[oldest].deadline ) ) {
+      oldest = i;
+    }
+  }
+  if ( oldest != partials_.size() ) {
+    remove( oldest );
+    stats_.evicted++;
+  }
+}
+
+optional<RawIPv4Datagram> IPv4Reassembler::add( const RawIPv4Datagram& fragment )
+{
+  const size_t header_length = fragment.header_length();
+  const size_t total = fragment.total_length();
+  const size_t first = fragment.fragment_offset();
+  const bool more = fragment.more_fragments();
+  const size_t length = total > header_length ? total - header_length : 0;
+  // (The reassembled datagram must fit in 64 KiB with its header, as well as its payload.)
+  if ( length == 0 or fragment.size() < total or header_length + first + length > MAX_LENGTH
+       or ( more and length % 8 != 0 ) ) {
+    stats_.malformed++;
+    return {};
+  }
+  const size_t last = first + length - 1;
+
+  const Key key { fragment.src(), fragment.dst(), fragment.id(), fragment.proto() };
+  auto index = static_cast<size_t>(
+    ranges::find_if( partials_, [&]( const Partial& p ) { return p.key == key; } ) - partials_.begin() );
+  if ( index == partials_.size() ) {
+    if ( partials_.size() == MAX_DATAGRAMS ) {
+      evict_oldest( partials_.size() );
+    }
+    partials_.push_back( { key, now_ + TIMEOUT, { { 0, SIZE_MAX } } } );
+    index = partials_.size() - 1;
+    stats_.pending_datagrams = partials_.size();
+  }
+  Partial& partial = partials_[index];
+
+  // A fragment that contradicts the end of the datagram spoils the whole datagram
+  if ( ( partial.end.has_value() and ( last >= *partial.end or ( not more and last + 1 != *partial.end ) ) )
+       or ( not more and partial.received_end > last + 1 ) ) {
+    stats_.malformed++;
+    remove( index );
+    return {};
+  }
+
+  // Fill the holes that the fragment overlaps (RFC 815), keeping only the bytes that fill them
+  scratch_holes_.clear();
+  size_t added = 0;
+  for ( const Hole& hole : partial.holes ) {
+    if ( not more and hole.first > last ) { // beyond the end of the datagram
+      continue;
+    }
+    if ( first > hole.last or last < hole.first ) {
+      scratch_holes_.push_back( hole );
+      continue;
+    }
+    size_t at = max( first, hole.first );
+    const size_t to = min( last, hole.last );
+    for_each_slice( fragment.buffers, header_length + at - first, to - at + 1, [&]( Buffer b ) {
+      added += b.size();
+      const size_t offset = at;
+      at += b.size();
+      partial.pieces.push_back( { offset, std::move( b ) } );
+    } );
+    if ( first > hole.first ) {
+      scratch_holes_.push_back( { hole.first, first - 1 } );
+    }
+    if ( last < hole.last and more ) {
+      scratch_holes_.push_back( { last + 1, hole.last } );
+    }
+  }
+  swap( partial.holes, scratch_holes_ );
+
+  if ( first == 0 ) {
+    partial.first_header = fragment.buffers.front();
+    partial.first_header.truncate( header_length );
+  }
+  if ( not more ) {
+    partial.end = last + 1;
+  }
+  partial.received_end = max( partial.received_end, last + 1 );
+  partial.bytes += added;
+  stats_.pending_bytes += added;
+
+  // The reassembled datagram takes the first fragment's header, which may be longer than this fragment's
+  if ( max( header_length, partial.first_header.size() ) + partial.end.value_or( partial.received_end )
+       > MAX_LENGTH ) {
+    stats_.malformed++;
+    remove( index );
+    return {};
+  }
+
+  if ( partial.holes.empty() ) {
+    auto whole = assemble( partial );
+    remove( index );
+    if ( not whole.has_value() ) {
+      stats_.malformed++;
+      return {};
+    }
+    stats_.reassembled++;
+    return whole;
+  }
+
+  // Make room by giving up the oldest other datagrams (or this one, if it alone is too big)
+  while ( stats_.pending_bytes > MAX_BYTES and partials_.size() > 1 ) {
+    evict_oldest( index );
+    index = static_cast<size_t>(
+      ranges::find_if( partials_, [&]( const Partial& p ) { return p.key == key; } ) - partials_.begin() );
+  }
+  if ( stats_.pending_bytes > MAX_BYTES ) {
+    remove( index );
+    stats_.evicted++;
+  }
+  return {};
+}
+
+optional<RawIPv4Datagram> IPv4Reassembler::assemble( Partial& partial )
+{
+  // The first fragment's header (with all its options), describing the whole datagram
+  const string_view header { partial.first_header };
+  if ( header.size() + *partial.end > MAX_LENGTH ) {
+    return {};
+  }
+
+  ranges::sort( partial.pieces, {}, &Piece::offset );
+  const auto df = static_cast<uint16_t>( ( static_cast<uint8_t>( header[FLAGS_OFFSET] ) << 8 ) & DF );
+
+  RawIPv4Datagram whole;
+  whole.buffers.reserve( partial.pieces.size() + 1 );
+  whole.buffers.push_back( make_header( header, header.size() + *partial.end, df ) );
+  for ( auto& piece : partial.pieces ) {
+    whole.buffers.push_back( std::move( piece.data ) );
+  }
+  return whole;
+}
+
+void IPv4Reassembler::tick( const size_t ms_since_last_tick )
+{
+  now_ += ms_since_last_tick;
+  for ( size_t i = 0; i < partials_.size(); ) {
+    if ( partials_[i].deadline <= now_ ) {
+      remove( i );
+      stats_.timed_out++;
+    } else {
+      i++;
+    }
+  }
+}
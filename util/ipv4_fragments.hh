@@ -0,0 +1,95 @@
+#pragma once
+
+#include "buffer.hh"
+#include "ipv4_datagram.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+//! Split `dgram` into fragments of at most `mtu` bytes each (headers included), appending them to `out`; a
+//! datagram that fits is appended as it is. The payload is shared with `dgram`, not copied. Only the first
+//! fragment carries every IP option; the others carry those marked to be copied (RFC 791). Returns false, and
+//! appends nothing, if the datagram needs fragmenting but has the don't-fragment flag, is shorter than its
+//! total length, or the MTU leaves no room for 8 bytes of payload.
+bool fragment_ipv4( RawIPv4Datagram dgram, size_t mtu, std::vector<RawIPv4Datagram>& out );
+
+//! \brief Puts fragmented IPv4 datagrams back together
+//! \details Each datagram being reassembled keeps the list of holes still missing from its payload (RFC 815),
+//! and the fragments' payloads as they arrived (shared, not copied), trimmed to the holes they fill, so
+//! overlapping or duplicate fragments cost nothing extra. Memory is bounded: at most MAX_DATAGRAMS datagrams
+//! and MAX_BYTES of payload are held, the oldest datagrams being given up first to make room, and a datagram
+//! that is still incomplete TIMEOUT ms after its first fragment arrived is given up.
+class IPv4Reassembler
+{
+public:
+  static constexpr size_t MAX_DATAGRAMS = 64;
+  static constexpr size_t MAX_BYTES = 1024 * 1024;
+  static constexpr uint64_t TIMEOUT = 30000;
+
+  struct Stats
+  {
+    size_t pending_datagrams {}; // being reassembled now
+    size_t pending_bytes {};     // payload held now
+    uint64_t reassembled {};     // datagrams completed
+    uint64_t timed_out {};       // datagrams given up after TIMEOUT
+    uint64_t evicted {};         // datagrams given up to make room
+    uint64_t malformed {};       // fragments dropped as inconsistent (and the datagrams they belonged to)
+  };
+
+private:
+  struct Key
+  {
+    uint32_t src;
+    uint32_t dst;
+    uint16_t id;
+    uint8_t proto;
+
+    bool operator==( const Key& other ) const = default;
+  };
+
+  // A range of payload bytes not yet received (inclusive)
+  struct Hole
+  {
+    size_t first;
+    size_t last;
+  };
+
+  struct Piece
+  {
+    size_t offset;
+    Buffer data;
+  };
+
+  struct Partial
+  {
+    Key key;
+    uint64_t deadline;
+    std::vector<Hole> holes;
+    std::vector<Piece> pieces {};
+    Buffer first_header {};        // header of the fragment at offset 0, once it has arrived
+    std::optional<size_t> end {};  // payload length, once the last fragment has arrived
+    size_t received_end {};        // end of the furthest fragment received
+    size_t bytes {};
+  };
+
+  uint64_t now_ {};
+  std::vector<Partial> partials_ {};
+  std::vector<Hole> scratch_holes_ {};
+  Stats stats_ {};
+
+  void remove( size_t index );
+  void evict_oldest( size_t keep );
+  std::optional<RawIPv4Datagram> assemble( Partial& partial );
+
+public:
+  //! Add a fragment (a datagram for which is_fragment() is true, with a valid header). Returns the whole
+  //! datagram if this was the last missing piece.
+  std::optional<RawIPv4Datagram> add( const RawIPv4Datagram& fragment );
+
+  //! Advance time, giving up datagrams that have been incomplete for too long
+  void tick( size_t ms_since_last_tick );
+
+  const Stats& stats() const { return stats_; }
+};
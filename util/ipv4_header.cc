@@ -1,5 +1,6 @@
 #include "ipv4_header.hh"
 #include "checksum.hh"
+#include "header_codec.hh"
 
 #include <arpa/inet.h>
 #include <array>
@@ -8,28 +9,55 @@
 
 using namespace std;
 
+namespace {
+
+uint8_t get_version_and_length( const IPv4Header& h )
+{
+  return ( static_cast<uint32_t>( h.ver ) << 4 ) | ( h.hlen & 0xfU );
+}
+
+void set_version_and_length( IPv4Header& h, const uint8_t first_byte )
+{
+  h.ver = first_byte >> 4;    // version
+  h.hlen = first_byte & 0x0f; // header length
+}
+
+uint16_t get_flags_and_offset( const IPv4Header& h )
+{
+  return ( h.df ? 0x4000U : 0 ) | ( h.mf ? 0x2000U : 0 ) | ( h.offset & 0x1fffU );
+}
+
+void set_flags_and_offset( IPv4Header& h, const uint16_t fo_val )
+{
+  h.df = static_cast<bool>( fo_val & 0x4000 ); // don't fragment
+  h.mf = static_cast<bool>( fo_val & 0x2000 ); // more fragments
+  h.offset = fo_val & 0x1fff;                  // offset
+}
+
+using namespace header_codec;
+using Codec = HeaderCodec<IPv4Header,
+                          IPv4Header::LENGTH,
+                          Computed<0, uint8_t, get_version_and_length, set_version_and_length>,
+                          Field<1, &IPv4Header::tos>,
+                          Field<2, &IPv4Header::len>,
+                          Field<4, &IPv4Header::id>,
+                          Computed<6, uint16_t, get_flags_and_offset, set_flags_and_offset>,
+                          Field<8, &IPv4Header::ttl>,
+                          Field<9, &IPv4Header::proto>,
+                          Field<10, &IPv4Header::cksum>,
+                          Field<12, &IPv4Header::src>,
+                          Field<16, &IPv4Header::dst>>;
+
+} // namespace
+
 // Parse from string.
 void IPv4Header::parse( Parser& parser )
 {
-  uint8_t first_byte {};
-  parser.integer( first_byte );
-  ver = first_byte >> 4;    // version
-  hlen = first_byte & 0x0f; // header length
-  parser.integer( tos );    // type of service
-  parser.integer( len );
-  parser.integer( id );
-
-  uint16_t fo_val {};
-  parser.integer( fo_val );
-  df = static_cast<bool>( fo_val & 0x4000 ); // don't fragment
-  mf = static_cast<bool>( fo_val & 0x2000 ); // more fragments
-  offset = fo_val & 0x1fff;                  // offset
-
-  parser.integer( ttl );
-  parser.integer( proto );
-  parser.integer( cksum );
-  parser.integer( src );
-  parser.integer( dst );
+  array<char, LENGTH> scratch;
+  const char* raw = Codec::parse( *this, parser, scratch );
+  if ( not raw ) {
+    return;
+  }
 
   if ( ver != 4 ) {
     parser.set_error();
@@ -45,10 +73,10 @@ void IPv4Header::parse( Parser& parser )
 
   parser.remove_prefix( static_cast<uint64_t>( hlen ) * 4 - IPv4Header::LENGTH );
 
-  // Verify checksum
-  const uint16_t given_cksum = cksum;
-  compute_checksum();
-  if ( cksum != given_cksum ) {
+  // Verify checksum (over the header as received, which must sum to zero)
+  InternetChecksum check;
+  check.add( string_view { raw, LENGTH } );
+  if ( check.value() ) {
     parser.set_error();
   }
 }
@@ -61,22 +89,7 @@ void IPv4Header::serialize( Serializer& serializer ) const
     throw runtime_error( "wrong IP version" );
   }
 
-  const uint8_t first_byte = ( static_cast<uint32_t>( ver ) << 4 ) | ( hlen & 0xfU );
-  serializer.integer( first_byte ); // version and header length
-  serializer.integer( tos );
-  serializer.integer( len );
-  serializer.integer( id );
-
-  const uint16_t fo_val = ( df ? 0x4000U : 0 ) | ( mf ? 0x2000U : 0 ) | ( offset & 0x1fffU );
-  serializer.integer( fo_val );
-
-  serializer.integer( ttl );
-  serializer.integer( proto );
-
-  serializer.integer( cksum );
-
-  serializer.integer( src );
-  serializer.integer( dst );
+  Codec::serialize( *this, serializer );
 }
 
 uint16_t IPv4Header::payload_length() const
@@ -107,12 +120,11 @@ uint32_t IPv4Header::pseudo_checksum() const
 void IPv4Header::compute_checksum()
 {
   cksum = 0;
-  Serializer s;
-  serialize( s );
 
   // calculate checksum -- taken over header only
+  const auto raw = Codec::encode( *this );
   InternetChecksum check;
-  check.add( s.output() );
+  check.add( string_view { raw.data(), raw.size() } );
   cksum = check.value();
 }
 
@@ -11,6 +11,7 @@ struct IPv4Header
 {
   static constexpr size_t LENGTH = 20;        // IPv4 header length, not including options
   static constexpr uint8_t DEFAULT_TTL = 128; // A reasonable default TTL value
+  static constexpr uint8_t PROTO_ICMP = 1;    // Protocol number for ICMP
   static constexpr uint8_t PROTO_TCP = 6;     // Protocol number for TCP
 
   static constexpr uint64_t serialized_length() { return LENGTH; }
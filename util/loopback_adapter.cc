@@ -0,0 +1,75 @@
+#include "loopback_adapter.hh"
+
+#include "exception.hh"
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+
+#include <array>
+#include <bit>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+LoopbackChannel::LoopbackChannel( const size_t capacity )
+  : _queue( capacity )
+  , _ready( CheckSystemCall( "eventfd", ::eventfd( 0, EFD_SEMAPHORE | EFD_CLOEXEC ) ) )
+  , _signal( CheckSystemCall( "dup", ::dup( _ready.fd_num() ) ) )
+{
+  _ready.set_blocking( false );
+}
+
+void LoopbackChannel::send( string&& datagram )
+{
+  if ( not _queue.push( move( datagram ) ) ) {
+    _dropped.fetch_add( 1, memory_order_relaxed );
+    return;
+  }
+
+  const auto one = bit_cast<array<char, sizeof( uint64_t )>>( uint64_t { 1 } );
+  _signal.write( string_view { one.data(), one.size() } );
+}
+
+optional<string> LoopbackChannel::receive()
+{
+  string counter( sizeof( uint64_t ), 0 );
+  _ready.read( counter );
+  return _queue.pop();
+}
+
+pair<TCPOverIPv4OverLoopbackAdapter, TCPOverIPv4OverLoopbackAdapter> TCPOverIPv4OverLoopbackAdapter::make_link(
+  const size_t queue_capacity )
+{
+  auto a_to_b = make_shared<LoopbackChannel>( queue_capacity );
+  auto b_to_a = make_shared<LoopbackChannel>( queue_capacity );
+  return { TCPOverIPv4OverLoopbackAdapter { b_to_a, a_to_b }, TCPOverIPv4OverLoopbackAdapter { a_to_b, b_to_a } };
+}
+
+optional<TCPSegment> TCPOverIPv4OverLoopbackAdapter::read()
+{
+  auto datagram = _rx->receive();
+  if ( not datagram.has_value() ) {
+    return {};
+  }
+
+  InternetDatagram ip_dgram;
+  if ( parse( ip_dgram, { move( datagram.value() ) } ) ) {
+    return unwrap_tcp_in_ip( ip_dgram );
+  }
+  return {};
+}
+
+//! \param[in] seg the TCPSegment to send
+void TCPOverIPv4OverLoopbackAdapter::write( TCPSegment& seg )
+{
+  // The datagram is flattened into one string, as it would be on a wire, so that no Buffer is shared
+  // between the two threads.
+  string datagram;
+  for ( const auto& buf : serialize( wrap_tcp_in_ip( seg ) ) ) {
+    datagram.append( static_cast<string_view>( buf ) );
+  }
+  _tx->send( move( datagram ) );
+}
+
+//! Specialize NetworkEmulatorFdAdapter to TCPOverIPv4OverLoopbackAdapter
+template class NetworkEmulatorFdAdapter<TCPOverIPv4OverLoopbackAdapter>;
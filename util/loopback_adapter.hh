@@ -0,0 +1,77 @@
+#pragma once
+
+#include "file_descriptor.hh"
+#include "network_emulator_fd_adapter.hh"
+#include "spsc_ring.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_segment.hh"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+//! \brief One direction of an in-memory link: a lock-free queue of serialized IPv4 datagrams,
+//! plus an [eventfd](\ref man2::eventfd) (in semaphore mode) that is readable while datagrams are queued
+class LoopbackChannel
+{
+  SPSCRing<std::string> _queue;
+  FileDescriptor _ready;  //!< The eventfd, as seen by the consumer
+  FileDescriptor _signal; //!< The same eventfd, as seen by the producer (keeps separate read/write counts)
+  std::atomic<uint64_t> _dropped { 0 };
+
+public:
+  //! \param[in] capacity is the number of datagrams that can be queued before new ones are dropped
+  explicit LoopbackChannel( size_t capacity );
+
+  //! Producer: queue a serialized datagram and signal the eventfd (drops the datagram if the queue is full)
+  void send( std::string&& datagram );
+
+  //! Consumer: consume one signal from the eventfd and dequeue one datagram, if available
+  std::optional<std::string> receive();
+
+  //! The eventfd that is readable while datagrams are queued
+  FileDescriptor& ready_fd() { return _ready; }
+
+  //! Number of datagrams dropped because the queue was full
+  uint64_t dropped() const { return _dropped.load( std::memory_order_relaxed ); }
+};
+
+//! \brief An FD adapter that carries IPv4 datagrams through memory to a peer adapter in the same process
+//! \details Created in connected pairs by make_link(). Each adapter may be driven by a different thread.
+//! No TUN/TAP device (and no privilege) is needed, so the full TCPPeer + TCPOverIPv4Adapter pipeline can
+//! run at memory speed.
+class TCPOverIPv4OverLoopbackAdapter : public TCPOverIPv4Adapter
+{
+private:
+  std::shared_ptr<LoopbackChannel> _rx; //!< Datagrams sent by the peer to us
+  std::shared_ptr<LoopbackChannel> _tx; //!< Datagrams sent by us to the peer
+
+  TCPOverIPv4OverLoopbackAdapter( std::shared_ptr<LoopbackChannel> rx, std::shared_ptr<LoopbackChannel> tx )
+    : _rx( std::move( rx ) ), _tx( std::move( tx ) )
+  {}
+
+public:
+  static constexpr size_t DEFAULT_QUEUE_CAPACITY = 1024;
+
+  //! Create two adapters connected to each other
+  //! \param[in] queue_capacity is the number of datagrams each direction can hold before dropping
+  static std::pair<TCPOverIPv4OverLoopbackAdapter, TCPOverIPv4OverLoopbackAdapter> make_link(
+    size_t queue_capacity = DEFAULT_QUEUE_CAPACITY );
+
+  //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
+  std::optional<TCPSegment> read();
+
+  //! Creates an IPv4 datagram from a TCP segment and queues it for the peer
+  void write( TCPSegment& seg );
+
+  //! Access underlying file descriptor (readable while datagrams from the peer are queued)
+  FileDescriptor& fd() { return _rx->ready_fd(); }
+
+  //! Number of datagrams sent by this adapter that were dropped because the peer's queue was full
+  uint64_t dropped() const { return _tx->dropped(); }
+};
+
+//! Typedef for a TCPOverIPv4OverLoopbackAdapter behind an emulated, impaired link
+using EmulatedTCPOverIPv4OverLoopbackAdapter = NetworkEmulatorFdAdapter<TCPOverIPv4OverLoopbackAdapter>;
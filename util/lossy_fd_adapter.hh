@@ -65,5 +65,8 @@ public:
   void set_listening( const bool l ) { _adapter.set_listening( l ); } //!< FdAdapterBase::set_listening passthrough
   const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
   FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
+
+  //! TCPOverIPv4Adapter::max_payload_size passthrough
+  size_t max_payload_size() const { return _adapter.max_payload_size(); }
   void tick( const size_t ms_since_last_tick ) { _adapter.tick( ms_since_last_tick ); }
 };
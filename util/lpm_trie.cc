@@ -0,0 +1,91 @@
+#include "lpm_trie.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+LPMTrie::LPMTrie() : root_( ROOT_SIZE, EMPTY ), root_lengths_( ROOT_SIZE, 0 ) {}
+
+void LPMTrie::insert( uint32_t prefix, const uint8_t prefix_length, const uint32_t value )
+{
+  if ( prefix_length > 32 ) {
+    throw runtime_error( "LPMTrie: prefix length longer than 32 bits" );
+  }
+  if ( value > MAX_VALUE ) {
+    throw runtime_error( "LPMTrie: value too large" );
+  }
+
+  prefix = prefix_length == 0 ? 0 : prefix & ( UINT32_MAX << ( 32 - prefix_length ) );
+  const uint32_t stored = value + 1;
+  const uint8_t rank = prefix_length + 1;
+
+  if ( prefix_length <= 16 ) {
+    const size_t first = prefix >> 16;
+    for ( size_t i = 0; i < size_t { 1 } << ( 16 - prefix_length ); ++i ) {
+      fill( true, first + i, stored, rank );
+    }
+  } else {
+    const uint32_t node = child_of( true, prefix >> 16 );
+    size_t first = node * NODE_SIZE + ( ( prefix >> 8 ) & 0xff );
+    size_t count = 0;
+    if ( prefix_length <= 24 ) {
+      count = size_t { 1 } << ( 24 - prefix_length );
+    } else {
+      first = child_of( false, first ) * NODE_SIZE + ( prefix & 0xff );
+      count = size_t { 1 } << ( 32 - prefix_length );
+    }
+    for ( size_t i = 0; i < count; ++i ) {
+      fill( false, first + i, stored, rank );
+    }
+  }
+
+  ++size_;
+}
+
+void LPMTrie::fill( const bool root, const size_t index, const uint32_t stored, const uint8_t rank )
+{
+  const uint32_t slot = root ? root_[index] : nodes_[index];
+  if ( slot & CHILD ) {
+    const size_t first = ( slot & ~CHILD ) * NODE_SIZE;
+    for ( size_t i = 0; i < NODE_SIZE; ++i ) {
+      fill( false, first + i, stored, rank );
+    }
+    return;
+  }
+
+  // (Only slots that change are written, so that nodes shared with copies of the trie are copied only then.)
+  if ( root and root_lengths_[index] < rank ) {
+    root_[index] = stored;
+    root_lengths_[index] = rank;
+  } else if ( not root and node_lengths_[index] < rank ) {
+    nodes_.mutable_at( index ) = stored;
+    node_lengths_.mutable_at( index ) = rank;
+  }
+}
+
+uint32_t LPMTrie::child_of( const bool root, const size_t index )
+{
+  const uint32_t slot = root ? root_[index] : nodes_[index];
+  if ( slot & CHILD ) {
+    return slot & ~CHILD;
+  }
+
+  const auto node = static_cast<uint32_t>( nodes_.size() / NODE_SIZE );
+  if ( node >= CHILD ) {
+    throw runtime_error( "LPMTrie: too many nodes" );
+  }
+  const uint8_t rank = root ? root_lengths_[index] : node_lengths_[index];
+  for ( size_t i = 0; i < NODE_SIZE; ++i ) {
+    nodes_.push_back( slot );
+    node_lengths_.push_back( rank );
+  }
+
+  ( root ? root_[index] : nodes_.mutable_at( index ) ) = CHILD | node;
+  return node;
+}
+
+size_t LPMTrie::memory_usage() const
+{
+  return root_.capacity() * sizeof( uint32_t ) + root_lengths_.capacity() + nodes_.memory_usage()
+         + node_lengths_.memory_usage();
+}
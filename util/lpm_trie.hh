@@ -0,0 +1,76 @@
+#pragma once
+
+#include "cow_vector.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+//! \brief Longest-prefix-match table for IPv4 addresses
+//! \details A multibit trie with strides of 16, 8 and 8 bits, built by controlled prefix expansion: a prefix
+//! that ends inside a stride fills every slot it covers. A lookup is at most three dependent array reads and
+//! does not depend on the number of prefixes. Each slot is one 32-bit word holding either a value or the
+//! index of a child node. When two prefixes of the same length are inserted, the first one is kept.
+//! Copies of a trie share its second- and third-level nodes until an insert changes them (see CowVector), so
+//! copying a trie to change a few prefixes costs about a copy of the first level.
+class LPMTrie
+{
+public:
+  //! Largest value that can be stored
+  static constexpr uint32_t MAX_VALUE = ( 1U << 31 ) - 2;
+
+  LPMTrie();
+
+  //! Map the `prefix_length` high-order bits of `prefix` to `value`
+  void insert( uint32_t prefix, uint8_t prefix_length, uint32_t value );
+
+  //! The value of the longest prefix that matches `address`, if any
+  std::optional<uint32_t> lookup( uint32_t address ) const
+  {
+    uint32_t slot = root_[address >> 16];
+    if ( slot & CHILD ) {
+      slot = nodes_[size_t { slot & ~CHILD } * NODE_SIZE + ( ( address >> 8 ) & 0xff )];
+      if ( slot & CHILD ) {
+        slot = nodes_[size_t { slot & ~CHILD } * NODE_SIZE + ( address & 0xff )];
+      }
+    }
+    if ( slot == EMPTY ) {
+      return {};
+    }
+    return slot - 1;
+  }
+
+  //! Number of prefixes inserted
+  size_t size() const { return size_; }
+
+  //! Bytes used by the lookup structure and the bookkeeping needed to insert
+  size_t memory_usage() const;
+
+private:
+  static constexpr uint32_t CHILD = 1U << 31; //!< Marks a slot that holds a child node index
+  static constexpr uint32_t EMPTY = 0;        //!< A slot with no matching prefix (values are stored plus one)
+  static constexpr size_t ROOT_SIZE = 1 << 16;
+  static constexpr size_t NODE_SIZE = 1 << 8;
+
+  //! Slots of the first level (the top 16 bits of the address)
+  std::vector<uint32_t> root_;
+
+  //! Slots of the second- and third-level nodes, NODE_SIZE per node (one chunk each)
+  CowVector<uint32_t, NODE_SIZE> nodes_ {};
+
+  //! Length plus one of the prefix that set each slot (zero if none), used to resolve overlapping inserts
+  //! (unused for slots that hold a child)
+  std::vector<uint8_t> root_lengths_;
+  CowVector<uint8_t, NODE_SIZE> node_lengths_ {};
+
+  size_t size_ {};
+
+  //! Store `stored` in a slot (of the root, or of `nodes_`) unless a longer prefix already set it; if the
+  //! slot holds a child, push the prefix down into every slot of the child instead
+  void fill( bool root, size_t index, uint32_t stored, uint8_t rank );
+
+  //! Index of the slot's child node, creating one (that inherits the slot's value) if necessary
+  uint32_t child_of( bool root, size_t index );
+};
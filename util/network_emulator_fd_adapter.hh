@@ -0,0 +1,201 @@
+#pragma once
+
+#include "file_descriptor.hh"
+#include "ipv4_header.hh"
+#include "random.hh"
+#include "tcp_config.hh"
+#include "tcp_segment.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <queue>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+//! \brief An adapter class that emulates an impaired link in front of an FD adapter
+//! \details Segments written through the adapter experience (in this order) Gilbert-Elliott burst loss,
+//! duplication, a bandwidth-limited bottleneck queue with tail drop, propagation delay with jitter, and
+//! reordering. Time is virtual: it advances only when tick() is called, and delayed segments are handed
+//! to the underlying adapter from tick() (or write()) once they are due. Like netem, the emulator shapes the
+//! egress direction only; segments that are read are subject only to FdAdapterConfig::loss_rate_dn.
+template<typename AdapterT>
+class NetworkEmulatorFdAdapter
+{
+public:
+  //! Counts of what happened to the segments written through the adapter
+  struct Stats
+  {
+    uint64_t written {};       //!< Segments given to write()
+    uint64_t delivered {};     //!< Segments handed to the underlying adapter
+    uint64_t dropped_loss {};  //!< Segments dropped by the loss model
+    uint64_t dropped_queue {}; //!< Segments dropped because the bottleneck queue was full
+    uint64_t duplicated {};    //!< Extra copies created
+    uint64_t reordered {};     //!< Segments that skipped the propagation delay
+  };
+
+private:
+  //! Size of the IPv4 and TCP headers, charged against the bottleneck for each segment
+  static constexpr uint64_t HEADER_OVERHEAD = IPv4Header::LENGTH + 20;
+
+  struct InFlight
+  {
+    uint64_t deliver_at_us; //!< Virtual time at which the segment leaves the emulated link
+    uint64_t order;         //!< Keeps segments due at the same time in FIFO order
+    TCPSegment seg;
+  };
+
+  struct DeliversLater
+  {
+    bool operator()( const InFlight& a, const InFlight& b ) const
+    {
+      return std::tie( a.deliver_at_us, a.order ) > std::tie( b.deliver_at_us, b.order );
+    }
+  };
+
+  //! Fast RNG used by the impairment models
+  std::default_random_engine _rand { get_random_engine() };
+
+  //! The underlying FD adapter
+  AdapterT _adapter;
+
+  NetworkEmulatorConfig _emulator_config;
+
+  uint64_t _now_us {};          //!< Virtual clock
+  uint64_t _link_free_at_us {}; //!< Virtual time at which the bottleneck finishes sending its backlog
+  bool _bad_state {};           //!< Current state of the Gilbert-Elliott loss model
+  uint64_t _next_order {};
+
+  std::priority_queue<InFlight, std::vector<InFlight>, DeliversLater> _in_flight {};
+
+  Stats _stats {};
+
+  //! Returns `true` with probability `p`
+  bool _chance( const double p )
+  {
+    return p > 0 and std::uniform_real_distribution<double> { 0, 1 }( _rand ) < p;
+  }
+
+  //! Advance the Gilbert-Elliott model by one datagram. Returns `true` if the datagram should be dropped.
+  bool _should_drop_burst()
+  {
+    _bad_state = _bad_state ? not _chance( _emulator_config.bad_to_good ) : _chance( _emulator_config.good_to_bad );
+    return _chance( _bad_state ? _emulator_config.loss_bad : _emulator_config.loss_good );
+  }
+
+  //! Determine whether or not to drop a datagram that was read, using the downlink loss probability
+  bool _should_drop_read()
+  {
+    const uint16_t loss = _adapter.config().loss_rate_dn;
+    return loss != 0 && static_cast<uint16_t>( _rand() ) < loss;
+  }
+
+  //! Put a segment through the bottleneck queue and onto the emulated wire
+  void _enqueue( const TCPSegment& seg )
+  {
+    uint64_t departure_us = _now_us;
+
+    if ( _emulator_config.bandwidth_bps ) {
+      const uint64_t size = HEADER_OVERHEAD + seg.sender_message.payload.size();
+      const uint64_t backlog_us = _link_free_at_us > _now_us ? _link_free_at_us - _now_us : 0;
+      const uint64_t backlog_bytes = backlog_us * _emulator_config.bandwidth_bps / 8'000'000;
+      if ( backlog_bytes + size > _emulator_config.queue_limit_bytes ) {
+        ++_stats.dropped_queue;
+        return;
+      }
+      _link_free_at_us = std::max( _now_us, _link_free_at_us ) + size * 8'000'000 / _emulator_config.bandwidth_bps;
+      departure_us = _link_free_at_us;
+    }
+
+    uint64_t delay_us = uint64_t { _emulator_config.delay_ms } * 1000;
+    if ( _emulator_config.jitter_ms ) {
+      delay_us += std::uniform_int_distribution<uint64_t> { 0, uint64_t { _emulator_config.jitter_ms } * 1000 }(
+        _rand );
+    }
+    if ( _chance( _emulator_config.reorder_prob ) ) {
+      ++_stats.reordered;
+      delay_us = 0;
+    }
+
+    _in_flight.push( { departure_us + delay_us, _next_order++, seg } );
+  }
+
+  //! Hand every segment that is due to the underlying adapter
+  void _release_due()
+  {
+    while ( not _in_flight.empty() and _in_flight.top().deliver_at_us <= _now_us ) {
+      TCPSegment seg = _in_flight.top().seg;
+      _in_flight.pop();
+      ++_stats.delivered;
+      _adapter.write( seg );
+    }
+  }
+
+public:
+  //! Conversion to a FileDescriptor by returning the underlying AdapterT
+  FileDescriptor& fd() { return _adapter.fd(); }
+
+  //! Construct from an adapter and the impairments to apply to segments written through it
+  explicit NetworkEmulatorFdAdapter( AdapterT&& adapter, const NetworkEmulatorConfig& emulator_config = {} )
+    : _adapter( std::move( adapter ) ), _emulator_config( emulator_config )
+  {}
+
+  //! \brief Read from the underlying AdapterT instance, potentially dropping the read datagram
+  //! \returns std::optional<TCPSegment> that is empty if the segment was dropped or if
+  //!          the underlying AdapterT returned an empty value
+  std::optional<TCPSegment> read()
+  {
+    auto ret = _adapter.read();
+    if ( _should_drop_read() ) {
+      return {};
+    }
+    return ret;
+  }
+
+  //! \brief Send a segment across the emulated link
+  //! \param[in] seg is the segment to send (it reaches the underlying adapter once its delay has elapsed)
+  void write( TCPSegment& seg )
+  {
+    ++_stats.written;
+    if ( _should_drop_burst() ) {
+      ++_stats.dropped_loss;
+      return;
+    }
+
+    _enqueue( seg );
+    if ( _chance( _emulator_config.duplicate_prob ) ) {
+      ++_stats.duplicated;
+      _enqueue( seg );
+    }
+
+    _release_due();
+  }
+
+  //! Advance the virtual clock, releasing segments that have become due
+  void tick( const size_t ms_since_last_tick )
+  {
+    _now_us += uint64_t { ms_since_last_tick } * 1000;
+    _release_due();
+    _adapter.tick( ms_since_last_tick );
+  }
+
+  //! Segments written but not yet handed to the underlying adapter
+  size_t segments_in_flight() const { return _in_flight.size(); }
+
+  const Stats& stats() const { return _stats; }
+
+  const NetworkEmulatorConfig& emulator_config() const { return _emulator_config; }
+  NetworkEmulatorConfig& emulator_config_mut() { return _emulator_config; }
+
+  //! \name
+  //! Passthrough functions to the underlying AdapterT instance
+
+  void set_listening( const bool l ) { _adapter.set_listening( l ); } //!< FdAdapterBase::set_listening passthrough
+  const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
+  FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
+
+  //! TCPOverIPv4Adapter::max_payload_size passthrough
+  size_t max_payload_size() const { return _adapter.max_payload_size(); }
+};
@@ -3,10 +3,12 @@
 #include "buffer.hh"
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <concepts>
 #include <cstdint>
 #include <cstring>
-#include <deque>
+#include <iterator>
 #include <numeric>
 #include <span>
 #include <stdexcept>
@@ -16,18 +18,46 @@
 
 class Serializer;
 
+// Convert between host and network (big-endian) byte order
+template<std::unsigned_integral T>
+constexpr T swap_network_order( const T val )
+{
+  if constexpr ( sizeof( T ) == 1 or std::endian::native == std::endian::big ) {
+    return val;
+  } else if constexpr ( sizeof( T ) == 2 ) {
+    return __builtin_bswap16( val );
+  } else if constexpr ( sizeof( T ) == 4 ) {
+    return __builtin_bswap32( val );
+  } else {
+    static_assert( sizeof( T ) == 8 );
+    return __builtin_bswap64( val );
+  }
+}
+
 class Parser
 {
   class BufferList
   {
     uint64_t size_ {};
-    std::deque<Buffer> buffer_ {};
+    std::vector<Buffer> buffer_ {};
+    size_t first_ {}; // index of the first buffer that has not been consumed
     uint64_t skip_ {};
 
+    bool exhausted() const { return first_ == buffer_.size(); }
+    const Buffer& front() const { return buffer_[first_]; }
+
+    // Consumed buffers stay referenced until the BufferList is destroyed, so views into them stay valid
+    void pop_front()
+    {
+      ++first_;
+      skip_ = 0;
+    }
+
   public:
     // NOLINTNEXTLINE(*-explicit-*)
     BufferList( const std::vector<Buffer>& buffers )
     {
+      buffer_.reserve( buffers.size() );
       for ( const auto& x : buffers ) {
         append( x );
       }
@@ -39,22 +69,45 @@ class Parser
 
     std::string_view peek() const
     {
-      if ( buffer_.empty() ) {
+      if ( exhausted() ) {
         throw std::runtime_error( "peek on empty BufferList" );
       }
-      return std::string_view { buffer_.front() }.substr( skip_ );
+      return std::string_view { front() }.substr( skip_ );
+    }
+
+    // Pointer to the next `len` bytes if they are all in the first buffer, otherwise nullptr
+    const char* contiguous( uint64_t len ) const
+    {
+      if ( exhausted() ) {
+        return nullptr;
+      }
+      const std::string_view view = front();
+      return view.size() - skip_ >= len ? view.data() + skip_ : nullptr;
+    }
+
+    // Call `f` on each remaining piece of the input, in order, without consuming it
+    template<typename F>
+    void for_each_piece( F&& f ) const
+    {
+      for ( size_t i = first_; i < buffer_.size(); ++i ) {
+        f( std::string_view { buffer_[i] }.substr( i == first_ ? skip_ : 0 ) );
+      }
     }
 
     void remove_prefix( uint64_t len )
     {
-      while ( len and not buffer_.empty() ) {
+      if ( not exhausted() and skip_ + len < front().size() ) {
+        skip_ += len;
+        size_ -= len;
+        return;
+      }
+      while ( len and not exhausted() ) {
         const uint64_t to_pop_now = std::min( len, peek().size() );
         skip_ += to_pop_now;
         len -= to_pop_now;
         size_ -= to_pop_now;
-        if ( skip_ == buffer_.front().size() ) {
-          buffer_.pop_front();
-          skip_ = 0;
+        if ( skip_ == front().size() ) {
+          pop_front();
         }
       }
     }
@@ -65,34 +118,42 @@ class Parser
       if ( empty() ) {
         return;
       }
-      std::string first_str = std::move( buffer_.front() );
-      if ( skip_ ) {
-        first_str = first_str.substr( skip_ );
-      }
-      out.emplace_back( std::move( first_str ) );
-      buffer_.pop_front();
-      for ( auto&& x : buffer_ ) {
-        out.emplace_back( std::move( x ) );
-      }
+      buffer_[first_].remove_prefix( skip_ );
+      out.assign( std::make_move_iterator( buffer_.begin() + static_cast<ptrdiff_t>( first_ ) ),
+                  std::make_move_iterator( buffer_.end() ) );
+      buffer_.clear();
+      first_ = 0;
+      skip_ = 0;
+      size_ = 0;
     }
 
+    // Slices the input without copying when it is contiguous
     void dump_all( Buffer& out )
     {
       std::vector<Buffer> concat;
       dump_all( concat );
-      if ( concat.size() == 1 ) {
-        out = concat.front();
+      if ( concat.size() <= 1 ) {
+        out = concat.empty() ? Buffer {} : std::move( concat.front() );
         return;
       }
 
-      out.release().clear();
+      size_t total_size = 0;
+      for ( const auto& s : concat ) {
+        total_size += s.size();
+      }
+      out = Buffer::allocate( total_size );
+      auto next = out.mutable_data().begin();
       for ( const auto& s : concat ) {
-        out.release().append( s );
+        const std::string_view view = s;
+        next = std::copy( view.begin(), view.end(), next );
       }
     }
 
     void append( Buffer str )
     {
+      if ( str.empty() ) {
+        return;
+      }
       size_ += str.size();
       buffer_.push_back( std::move( str ) );
     }
@@ -125,17 +186,21 @@ public:
       return;
     }
 
-    if constexpr ( sizeof( T ) == 1 ) {
-      out = static_cast<uint8_t>( input_.peek().front() );
-      input_.remove_prefix( 1 );
+    // Fast path: the whole integer is in one buffer
+    if ( const char* data = input_.contiguous( sizeof( T ) ) ) {
+      T raw {};
+      std::memcpy( &raw, data, sizeof( T ) );
+      out = swap_network_order( raw );
+      input_.remove_prefix( sizeof( T ) );
       return;
-    } else {
-      out = static_cast<T>( 0 );
-      for ( size_t i = 0; i < sizeof( T ); i++ ) {
-        out <<= 8;
-        out |= static_cast<uint8_t>( input_.peek().front() );
-        input_.remove_prefix( 1 );
-      }
+    }
+
+    // Slow path: the integer straddles buffers
+    out = static_cast<T>( 0 );
+    for ( size_t i = 0; i < sizeof( T ); i++ ) {
+      out <<= 8;
+      out |= static_cast<uint8_t>( input_.peek().front() );
+      input_.remove_prefix( 1 );
     }
   }
 
@@ -154,6 +219,23 @@ public:
     }
   }
 
+  // Consume the next N bytes. Returns a pointer to them (in the input if they are contiguous, otherwise
+  // copied into `scratch`), or nullptr if the input is too short.
+  template<size_t N>
+  const char* fixed( std::array<char, N>& scratch )
+  {
+    check_size( N );
+    if ( has_error() ) {
+      return nullptr;
+    }
+    if ( const char* data = input_.contiguous( N ) ) {
+      input_.remove_prefix( N );
+      return data;
+    }
+    string( scratch );
+    return scratch.data();
+  }
+
   void all_remaining( std::vector<Buffer>& out ) { input_.dump_all( out ); }
   void all_remaining( Buffer& out ) { input_.dump_all( out ); }
 };
@@ -167,19 +249,28 @@ public:
   Serializer() = default;
   explicit Serializer( std::string&& buffer ) : buffer_( std::move( buffer ) ) {}
 
+  void bytes( std::string_view str ) { buffer_.append( str ); }
+
   template<std::unsigned_integral T>
   void integer( const T& val )
   {
-    constexpr uint64_t len = sizeof( T );
-
-    for ( uint64_t i = 0; i < len; ++i ) {
-      const uint8_t byte_val = val >> ( ( len - i - 1 ) * 8 );
-      buffer_.push_back( byte_val );
-    }
+    const T raw = swap_network_order( val );
+    buffer_.append( reinterpret_cast<const char*>( &raw ), sizeof( T ) );
   }
 
+  // Pending header bytes are prepended into the buffer's headroom when possible, so that a header
+  // and its payload (and the headers of the layers below) end up in one contiguous Buffer
   void buffer( const Buffer& buf )
   {
+    if ( buf.empty() ) {
+      return;
+    }
+    Buffer with_header = buf;
+    if ( with_header.prepend( buffer_ ) ) {
+      buffer_.clear();
+      output_.push_back( std::move( with_header ) );
+      return;
+    }
     flush();
     output_.push_back( buf );
   }
@@ -193,8 +284,10 @@ public:
 
   void flush()
   {
-    output_.emplace_back( std::move( buffer_ ) );
-    buffer_.clear();
+    if ( not buffer_.empty() ) {
+      output_.emplace_back( buffer_ );
+      buffer_.clear();
+    }
   }
 
   std::vector<Buffer> output()
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+//! A pointer to an immutable value that readers follow without locks while writers replace it
+//! (read-copy-update). A replaced value is reclaimed once no reader can still be using it, using epochs:
+//! each reader announces the epoch in which it started reading, and a value retired in epoch E is freed
+//! once every reader is either idle or started in a later epoch. Retired values are freed by the next update,
+//! or by a reader as it finishes a read (unless a writer is busy), so they do not pile up between updates.
+//! Readers must first register for one of MAX_READERS slots; a slot holds one read at a time.
+template<typename T>
+class RCUPointer
+{
+public:
+  static constexpr size_t MAX_READERS = 64;
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+  static constexpr uint64_t IDLE = 0;
+
+  struct alignas( CACHE_LINE ) ReaderSlot
+  {
+    std::atomic<uint64_t> epoch { IDLE }; // epoch in which the current read started, or IDLE
+    std::atomic<bool> taken { false };
+  };
+
+  struct Retired
+  {
+    std::unique_ptr<const T> value;
+    uint64_t epoch;
+  };
+
+  std::array<ReaderSlot, MAX_READERS> readers_ {};
+  std::atomic<uint64_t> epoch_ { 1 };
+  std::atomic<const T*> current_;
+
+  std::mutex writer_mutex_ {};
+  std::unique_ptr<const T> owned_;   // the value current_ points to (guarded by writer_mutex_)
+  std::vector<Retired> retired_ {}; // replaced values that readers might still use (guarded by writer_mutex_)
+  std::atomic<bool> has_retired_ {}; // whether retired_ is not empty (for readers to check without the lock)
+
+  // Free every retired value that no reader can still be using (writer_mutex_ must be held)
+  void reclaim()
+  {
+    uint64_t oldest = UINT64_MAX;
+    for ( const auto& reader : readers_ ) {
+      const uint64_t e = reader.epoch.load();
+      if ( e != IDLE and e < oldest ) {
+        oldest = e;
+      }
+    }
+    std::erase_if( retired_, [&]( const Retired& r ) { return r.epoch < oldest; } );
+    has_retired_.store( not retired_.empty(), std::memory_order_relaxed );
+  }
+
+  // Called by a reader that has finished a read: free what can be freed, unless a writer holds the lock
+  void reclaim_if_idle()
+  {
+    if ( has_retired_.load( std::memory_order_relaxed ) ) {
+      const std::unique_lock lock { writer_mutex_, std::try_to_lock };
+      if ( lock.owns_lock() ) {
+        reclaim();
+      }
+    }
+  }
+
+public:
+  explicit RCUPointer( std::unique_ptr<const T> initial )
+    : current_( initial.get() ), owned_( std::move( initial ) )
+  {}
+
+  RCUPointer( const RCUPointer& other ) = delete;
+  RCUPointer& operator=( const RCUPointer& other ) = delete;
+
+  //! Claim a reader slot; returns its index
+  size_t register_reader()
+  {
+    for ( size_t i = 0; i < readers_.size(); ++i ) {
+      bool expected = false;
+      if ( readers_[i].taken.compare_exchange_strong( expected, true ) ) {
+        return i;
+      }
+    }
+    throw std::runtime_error( "RCUPointer: too many readers" );
+  }
+
+  //! Give up a reader slot (which must not be reading)
+  void unregister_reader( const size_t reader ) { readers_.at( reader ).taken.store( false ); }
+
+  //! \brief A value as of the start of a read, valid until the ReadGuard is destroyed
+  class ReadGuard
+  {
+    RCUPointer* owner_;
+    std::atomic<uint64_t>* slot_;
+    const T* value_;
+
+  public:
+    ReadGuard( RCUPointer& owner, std::atomic<uint64_t>& slot, const T* value )
+      : owner_( &owner ), slot_( &slot ), value_( value )
+    {}
+    ReadGuard( const ReadGuard& other ) = delete;
+    ReadGuard& operator=( const ReadGuard& other ) = delete;
+    ~ReadGuard()
+    {
+      slot_->store( IDLE, std::memory_order_release );
+      owner_->reclaim_if_idle();
+    }
+
+    const T& operator*() const { return *value_; }
+    const T* operator->() const { return value_; }
+  };
+
+  //! Start reading on reader slot `reader` (no locks; the epoch is announced before the pointer is loaded)
+  ReadGuard read( const size_t reader )
+  {
+    auto& slot = readers_[reader].epoch;
+    slot.store( epoch_.load() );
+    return { *this, slot, current_.load() };
+  }
+
+  //! Replace the value with `make_next( current )`. Writers are serialized, so no update is lost.
+  template<typename F>
+  void update( F&& make_next )
+  {
+    const std::lock_guard lock { writer_mutex_ };
+    std::unique_ptr<const T> next = make_next( *owned_ );
+    current_.store( next.get() );
+    retired_.push_back( { std::exchange( owned_, std::move( next ) ), epoch_.fetch_add( 1 ) } );
+    reclaim();
+  }
+
+  //! Number of replaced values not yet freed
+  size_t retired_count()
+  {
+    const std::lock_guard lock { writer_mutex_ };
+    reclaim();
+    return retired_.size();
+  }
+};
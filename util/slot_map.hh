@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+//! Names an object stored in a SlotMap
+struct SlotKey
+{
+  uint32_t index {};
+  uint32_t generation {};
+};
+
+//! Storage for objects addressed by generation-checked keys.
+//! Objects live in fixed-size contiguous chunks and never move once inserted, so references stay
+//! valid until the object is erased (even while other objects are inserted). Erased slots are
+//! recycled through a free list: once the high-water mark is reached, inserting and erasing never
+//! allocate. A key to an erased object is detected as stale (its generation no longer matches),
+//! even if the slot has since been reused.
+template<typename T, size_t SlotsPerChunk = 64>
+class SlotMap
+{
+public:
+  using Key = SlotKey;
+
+private:
+  static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+  struct Slot
+  {
+    std::optional<T> value {};
+    uint32_t generation {};
+    uint32_t next_free { NO_SLOT };
+  };
+
+  using Chunk = std::array<Slot, SlotsPerChunk>;
+
+  std::vector<std::unique_ptr<Chunk>> chunks_ {};
+  size_t slot_count_ {};
+  uint32_t first_free_ { NO_SLOT };
+  size_t size_ {};
+
+  Slot& slot( const size_t index ) { return ( *chunks_[index / SlotsPerChunk] )[index % SlotsPerChunk]; }
+  const Slot& slot( const size_t index ) const
+  {
+    return ( *chunks_[index / SlotsPerChunk] )[index % SlotsPerChunk];
+  }
+
+public:
+  //! Store a new object and return its key
+  template<typename... Targs>
+  Key emplace( Targs&&... Fargs )
+  {
+    uint32_t index = first_free_;
+    if ( index == NO_SLOT ) {
+      if ( slot_count_ >= NO_SLOT ) {
+        throw std::length_error( "SlotMap: too many slots" );
+      }
+      if ( slot_count_ == chunks_.size() * SlotsPerChunk ) {
+        chunks_.push_back( std::make_unique<Chunk>() );
+      }
+      index = slot_count_++;
+    } else {
+      first_free_ = slot( index ).next_free;
+    }
+
+    Slot& s = slot( index );
+    s.value.emplace( std::forward<Targs>( Fargs )... );
+    s.next_free = NO_SLOT;
+    ++size_;
+    return { index, s.generation };
+  }
+
+  //! Destroy the object in slot `index` (which must be occupied) and recycle the slot
+  void erase( const uint32_t index )
+  {
+    if ( index >= slot_count_ or not occupied( index ) ) {
+      throw std::out_of_range( "SlotMap: erase of empty slot" );
+    }
+    Slot& s = slot( index );
+    s.value.reset();
+    ++s.generation;
+    s.next_free = first_free_;
+    first_free_ = index;
+    --size_;
+  }
+
+  //! The object named by `key`, or nullptr if it has been erased
+  T* find( const Key key )
+  {
+    if ( key.index >= slot_count_ ) {
+      return nullptr;
+    }
+    Slot& s = slot( key.index );
+    if ( s.generation != key.generation or not s.value.has_value() ) {
+      return nullptr;
+    }
+    return &s.value.value();
+  }
+
+  //! Number of slots (occupied or free); valid indices for occupied() and at() are [0, slot_count())
+  size_t slot_count() const { return slot_count_; }
+
+  bool occupied( const size_t index ) const { return slot( index ).value.has_value(); }
+
+  T& at( const size_t index ) { return slot( index ).value.value(); }
+  const T& at( const size_t index ) const { return slot( index ).value.value(); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+};
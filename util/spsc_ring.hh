@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! A bounded, lock-free queue for exactly one producer thread and one consumer thread.
+//! The capacity is rounded up to a power of two. push() fails (returns false) when the ring is full.
+//! A consumer with nothing to pop may block in wait() instead of polling.
+template<typename T>
+class SPSCRing
+{
+  static constexpr size_t CACHE_LINE = 64;
+
+  std::vector<std::optional<T>> slots_;
+  size_t mask_;
+
+  alignas( CACHE_LINE ) std::atomic<size_t> head_ { 0 }; // next slot to pop (written by the consumer)
+  alignas( CACHE_LINE ) size_t cached_tail_ { 0 };       // consumer's last view of tail_
+
+  alignas( CACHE_LINE ) std::atomic<size_t> tail_ { 0 }; // next slot to push (written by the producer)
+  alignas( CACHE_LINE ) size_t cached_head_ { 0 };       // producer's last view of head_
+
+  // Bumped after every push and by wake(), for a consumer blocked in wait() (an event count)
+  alignas( CACHE_LINE ) std::atomic<uint32_t> signals_ { 0 };
+
+public:
+  explicit SPSCRing( const size_t capacity )
+    : slots_( std::bit_ceil( std::max( capacity, size_t { 1 } ) ) ), mask_( slots_.size() - 1 )
+  {}
+
+  size_t capacity() const { return slots_.size(); }
+
+  //! Producer: enqueue `value`. Returns false (and leaves `value` untouched) if the ring is full.
+  bool push( T&& value )
+  {
+    const size_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - cached_head_ == slots_.size() ) {
+      cached_head_ = head_.load( std::memory_order_acquire );
+      if ( tail - cached_head_ == slots_.size() ) {
+        return false;
+      }
+    }
+    slots_[tail & mask_].emplace( std::move( value ) );
+    tail_.store( tail + 1, std::memory_order_release );
+    wake();
+    return true;
+  }
+
+  //! Consumer: dequeue the oldest element, if any
+  std::optional<T> pop()
+  {
+    const size_t head = head_.load( std::memory_order_relaxed );
+    if ( head == cached_tail_ ) {
+      cached_tail_ = tail_.load( std::memory_order_acquire );
+      if ( head == cached_tail_ ) {
+        return {};
+      }
+    }
+    auto& slot = slots_[head & mask_];
+    std::optional<T> ret { std::move( slot ) };
+    slot.reset();
+    head_.store( head + 1, std::memory_order_release );
+    return ret;
+  }
+
+  //! Consumer: to block until there is something to pop, take a ticket, check for anything else that should
+  //! end the wait (e.g., a stop request, which must be followed by wake()), then call wait( ticket )
+  uint32_t ticket() const { return signals_.load( std::memory_order_acquire ); }
+
+  //! Consumer: block unless there is something to pop, or push() or wake() has been called since `ticket`
+  void wait( const uint32_t ticket ) const
+  {
+    if ( tail_.load( std::memory_order_acquire ) == head_.load( std::memory_order_relaxed ) ) {
+      signals_.wait( ticket, std::memory_order_acquire );
+    }
+  }
+
+  //! Wake the consumer if it is blocked in wait() (a system call only if it is)
+  void wake()
+  {
+    signals_.fetch_add( 1, std::memory_order_release );
+    signals_.notify_one();
+  }
+
+  //! Approximate number of queued elements (exact when called by the producer or consumer while the other is idle)
+  size_t size() const { return tail_.load( std::memory_order_acquire ) - head_.load( std::memory_order_acquire ); }
+  bool empty() const { return size() == 0; }
+};
@@ -32,3 +32,26 @@ public:
   uint16_t loss_rate_dn = 0; //!< Downlink loss rate (for LossyFdAdapter)
   uint16_t loss_rate_up = 0; //!< Uplink loss rate (for LossyFdAdapter)
 };
+
+//! Config for NetworkEmulatorFdAdapter. Impairments apply to the segments written by the adapter;
+//! wrap both endpoints to impair both directions.
+class NetworkEmulatorConfig
+{
+public:
+  uint32_t delay_ms = 0;            //!< One-way propagation delay, in milliseconds
+  uint32_t jitter_ms = 0;           //!< Random extra delay, uniform in [0, jitter_ms] milliseconds
+  uint64_t bandwidth_bps = 0;       //!< Bottleneck rate, in bits per second (0 for unlimited)
+  size_t queue_limit_bytes = 64000; //!< Capacity of the bottleneck queue; arrivals beyond it are dropped
+
+  double reorder_prob = 0;   //!< Probability that a datagram skips the propagation delay (overtaking others)
+  double duplicate_prob = 0; //!< Probability that a datagram is sent twice
+
+  //! \name Gilbert-Elliott burst loss model
+  //! The link alternates between a "good" and a "bad" state; each state has its own loss probability.
+  //!@{
+  double loss_good = 0;   //!< Loss probability in the good state
+  double loss_bad = 0;    //!< Loss probability in the bad state
+  double good_to_bad = 0; //!< Probability, per datagram, of moving from the good to the bad state
+  double bad_to_good = 1; //!< Probability, per datagram, of moving from the bad to the good state
+  //!@}
+};
@@ -6,6 +6,7 @@
 #include "tun.hh"
 
 #include <cstddef>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <stdexcept>
@@ -285,6 +286,22 @@ void TCPMinnowSocket<AdaptT>::listen_and_accept( const TCPConfig& c_tcp, const F
   _tcp_thread = thread( &TCPMinnowSocket::_tcp_main, this );
 }
 
+//! An adapter that emulates link delay (e.g. NetworkEmulatorFdAdapter) may still hold segments, such as
+//! the final ACK, after the TCPPeer has finished. Keep time moving until they have been delivered.
+template<typename AdaptT>
+void TCPMinnowSocket<AdaptT>::_drain_adapter()
+{
+  if constexpr ( requires { _datagram_adapter.segments_in_flight(); } ) {
+    auto base_time = timestamp_ms();
+    while ( _datagram_adapter.segments_in_flight() > 0 and not _abort ) {
+      this_thread::sleep_for( chrono::milliseconds( TCP_TICK_MS ) );
+      const auto next_time = timestamp_ms();
+      _datagram_adapter.tick( next_time - base_time );
+      base_time = next_time;
+    }
+  }
+}
+
 template<typename AdaptT>
 void TCPMinnowSocket<AdaptT>::_tcp_main()
 {
@@ -293,11 +310,15 @@ void TCPMinnowSocket<AdaptT>::_tcp_main()
       throw runtime_error( "no TCP" );
     }
     _tcp_loop( [] { return true; } );
+    _drain_adapter();
     shutdown( SHUT_RDWR );
     if ( not _tcp.value().active() ) {
       cerr << "DEBUG: TCP connection finished "
            << ( _tcp->inbound_reader().has_error() ? "uncleanly.\n" : "cleanly.\n" );
     }
+    if ( getenv( "MINNOW_EVENTLOOP_SUMMARY" ) != nullptr ) {
+      _eventloop.summary( cerr );
+    }
     _tcp.reset();
   } catch ( const exception& e ) {
     cerr << "Exception in TCPConnection runner thread: " << e.what() << "\n";
@@ -312,6 +333,11 @@ void TCPMinnowSocket<AdaptT>::collect_segments()
     return;
   }
 
+  // New segments are sized to the path MTU, as the adapter currently estimates it.
+  if constexpr ( requires { _datagram_adapter.max_payload_size(); } ) {
+    _tcp->set_max_payload_size( _datagram_adapter.max_payload_size() );
+  }
+
   while ( auto seg = _tcp->maybe_send() ) {
     outgoing_segments_.push( move( seg.value() ) );
   }
@@ -326,6 +352,12 @@ template class TCPMinnowSocket<TCPOverIPv4OverEthernetAdapter>;
 //! Specialization of TCPMinnowSocket for LossyTCPOverIPv4OverTunFdAdapter
 template class TCPMinnowSocket<LossyTCPOverIPv4OverTunFdAdapter>;
 
+//! Specialization of TCPMinnowSocket for TCPOverIPv4OverLoopbackAdapter
+template class TCPMinnowSocket<TCPOverIPv4OverLoopbackAdapter>;
+
+//! Specialization of TCPMinnowSocket for EmulatedTCPOverIPv4OverLoopbackAdapter
+template class TCPMinnowSocket<EmulatedTCPOverIPv4OverLoopbackAdapter>;
+
 CS144TCPSocket::CS144TCPSocket() : TCPOverIPv4MinnowSocket( TCPOverIPv4OverTunFdAdapter( TunFD( "tun144" ) ) ) {}
 
 void CS144TCPSocket::connect( const Address& address )
@@ -3,6 +3,7 @@
 #include "byte_stream.hh"
 #include "eventloop.hh"
 #include "file_descriptor.hh"
+#include "loopback_adapter.hh"
 #include "network_interface.hh"
 #include "socket.hh"
 #include "tcp_config.hh"
@@ -43,9 +44,12 @@ private:
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
-  //! Main loop of TCPPeer thread
+  //! Main loop of TCPPeer thread; prints the event loop's summary() at the end if MINNOW_EVENTLOOP_SUMMARY is set
   void _tcp_main();
 
+  //! Give the adapter time to send any segments it is still holding
+  void _drain_adapter();
+
   //! Handle to the TCPPeer thread; owner thread calls join() in the destructor
   std::thread _tcp_thread {};
 
@@ -106,6 +110,9 @@ using TCPOverIPv4OverEthernetMinnowSocket = TCPMinnowSocket<TCPOverIPv4OverEther
 
 using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyTCPOverIPv4OverTunFdAdapter>;
 
+using TCPOverIPv4OverLoopbackMinnowSocket = TCPMinnowSocket<TCPOverIPv4OverLoopbackAdapter>;
+using EmulatedTCPOverIPv4OverLoopbackMinnowSocket = TCPMinnowSocket<EmulatedTCPOverIPv4OverLoopbackAdapter>;
+
 //! \class TCPMinnowSocket
 //! This class involves the simultaneous operation of two threads.
 //!
@@ -1,10 +1,14 @@
 #include "tcp_over_ip.hh"
 
+#include "header_codec.hh"
+#include "icmp_message.hh"
 #include "ipv4_datagram.hh"
 #include "ipv4_header.hh"
 #include "parser.hh"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <array>
 #include <stdexcept>
 #include <unistd.h>
 #include <utility>
@@ -25,6 +29,12 @@ using namespace std;
 //! \returns a std::optional<TCPSegment> that is empty if the segment was invalid or unrelated
 optional<TCPSegment> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagram& ip_dgram )
 {
+  // is it an ICMP error about a datagram we sent (from whichever router sent it)?
+  if ( ip_dgram.header.proto == IPv4Header::PROTO_ICMP ) {
+    learn_path_mtu( ip_dgram );
+    return {};
+  }
+
   // is the IPv4 datagram for us?
   // Note: it's valid to bind to address "0" (INADDR_ANY) and reply from actual address contacted
   if ( not listening() and ( ip_dgram.header.dst != config().source.ipv4_numeric() ) ) {
@@ -84,8 +94,12 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( TCPSegment& seg )
   InternetDatagram ip_dgram;
   ip_dgram.header.src = config().source.ipv4_numeric();
   ip_dgram.header.dst = config().destination.ipv4_numeric();
+  ip_dgram.header.id = next_id_++;
   ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + seg.sender_message.payload.size();
 
+  // a segment sized before the path MTU estimate was lowered (being retransmitted) may be fragmented on the way
+  ip_dgram.header.df = ip_dgram.header.len <= path_mtu_;
+
   // set payload, calculating TCP checksum using information from IP header
   seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
   ip_dgram.header.compute_checksum();
@@ -93,3 +107,67 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( TCPSegment& seg )
 
   return ip_dgram;
 }
+
+void TCPOverIPv4Adapter::learn_path_mtu( const InternetDatagram& icmp )
+{
+  if ( listening() or icmp.header.dst != config().source.ipv4_numeric() ) {
+    return;
+  }
+
+  ICMPMessage msg;
+  if ( not parse( msg, icmp.payload ) or not msg.fragmentation_needed() ) {
+    return;
+  }
+
+  // does it quote a datagram of this connection?
+  const string_view original { msg.original };
+  if ( original.size() < IPv4Header::LENGTH ) {
+    return;
+  }
+  const size_t header_length = ( original[0] & 0x0fU ) * size_t { 4 };
+  if ( original.size() < header_length + 4 or original[9] != static_cast<char>( IPv4Header::PROTO_TCP )
+       or header_codec::load<uint32_t>( original.data() + 12 ) != config().source.ipv4_numeric()
+       or header_codec::load<uint32_t>( original.data() + 16 ) != config().destination.ipv4_numeric()
+       or header_codec::load<uint16_t>( original.data() + header_length ) != config().source.port()
+       or header_codec::load<uint16_t>( original.data() + header_length + 2 ) != config().destination.port() ) {
+    return;
+  }
+
+  // A router that does not give the MTU (RFC 1191, section 5): guess the next plateau below the datagram's size.
+  size_t mtu = msg.next_hop_mtu;
+  if ( mtu == 0 ) {
+    constexpr array<size_t, 8> plateaus { 32000, 17914, 8166, 4352, 2002, 1492, 1006, 508 };
+    const size_t too_big = header_codec::load<uint16_t>( original.data() + 2 );
+    const auto it = ranges::find_if( plateaus, [&]( const size_t plateau ) { return plateau < too_big; } );
+    mtu = it == plateaus.end() ? MIN_PATH_MTU : *it;
+  }
+
+  mtu = clamp( mtu, min( MIN_PATH_MTU, link_mtu_ ), link_mtu_ );
+  if ( mtu < path_mtu_ ) {
+    path_mtu_ = mtu;
+    path_mtu_age_ = 0;
+  }
+}
+
+void TCPOverIPv4Adapter::set_link_mtu( const size_t mtu )
+{
+  if ( mtu <= IPv4Header::LENGTH + TCP_HEADER_LENGTH ) {
+    throw runtime_error( "TCPOverIPv4Adapter: MTU too small for TCP" );
+  }
+  link_mtu_ = mtu;
+  path_mtu_ = link_mtu_;
+  path_mtu_age_ = 0;
+}
+
+//! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
+void TCPOverIPv4Adapter::tick( const size_t ms_since_last_tick )
+{
+  if ( path_mtu_ == link_mtu_ ) {
+    return;
+  }
+  path_mtu_age_ += ms_since_last_tick;
+  if ( path_mtu_age_ >= PATH_MTU_TIMEOUT ) {
+    path_mtu_ = link_mtu_;
+    path_mtu_age_ = 0;
+  }
+}
@@ -3,15 +3,49 @@
 #include "buffer.hh"
 #include "fd_adapter.hh"
 #include "ipv4_datagram.hh"
+#include "ipv4_header.hh"
 #include "tcp_segment.hh"
 
+#include <cstdint>
 #include <optional>
 
 //! \brief A converter from TCP segments to serialized IPv4 datagrams
+//! \details Datagrams are sent with the don't-fragment flag, for path MTU discovery (RFC 1191): the adapter
+//! starts from the MTU of its link, lowers its estimate of the path MTU when a router answers with an ICMP
+//! "fragmentation needed" message, and tries the link's MTU again after PATH_MTU_TIMEOUT. max_payload_size()
+//! is the largest TCP payload that fits.
 class TCPOverIPv4Adapter : public FdAdapterBase
 {
+public:
+  static constexpr size_t DEFAULT_MTU = 1500;
+  static constexpr size_t MIN_PATH_MTU = 576;           //!< every host can receive datagrams this big
+  static constexpr uint64_t PATH_MTU_TIMEOUT = 600'000; //!< ms for which a lowered estimate is kept
+  static constexpr size_t TCP_HEADER_LENGTH = 20;
+
+private:
+  uint16_t next_id_ {}; //!< identification of the next datagram (so that fragments of different ones differ)
+
+  size_t link_mtu_ { DEFAULT_MTU };
+  size_t path_mtu_ { DEFAULT_MTU }; //!< estimated MTU of the path to the peer
+  uint64_t path_mtu_age_ {};        //!< ms since path_mtu_ was last lowered
+
+  //! Lower the path MTU estimate if `icmp` is a "fragmentation needed" message about a datagram we sent
+  void learn_path_mtu( const InternetDatagram& icmp );
+
 public:
   std::optional<TCPSegment> unwrap_tcp_in_ip( const InternetDatagram& ip_dgram );
 
   InternetDatagram wrap_tcp_in_ip( TCPSegment& seg );
+
+  //! MTU of the link the adapter sends on (also resets the path MTU estimate)
+  void set_link_mtu( size_t mtu );
+  size_t link_mtu() const { return link_mtu_; }
+
+  size_t path_mtu() const { return path_mtu_; }
+
+  //! The largest TCP payload that fits in a datagram of the path MTU
+  size_t max_payload_size() const { return path_mtu_ - IPv4Header::LENGTH - TCP_HEADER_LENGTH; }
+
+  //! Called periodically when time elapses
+  void tick( size_t ms_since_last_tick );
 };
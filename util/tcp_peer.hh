@@ -29,6 +29,9 @@ public:
   void push() { sender_.push( outbound_stream_.reader() ); };
   void tick( uint64_t ms_since_last_tick ) { sender_.tick( ms_since_last_tick ); }
 
+  // Limit the payload of the segments sent from now on (e.g. to what fits the path MTU)
+  void set_max_payload_size( size_t max_payload_size ) { sender_.set_max_payload_size( max_payload_size ); }
+
   bool has_ackno() const { return receiver_.send( inbound_stream_.writer() ).ackno.has_value(); }
 
   bool active() const
@@ -1,95 +1,136 @@
 #include "tcp_segment.hh"
 #include "checksum.hh"
+#include "header_codec.hh"
 #include "wrapping_integers.hh"
 
+#include <array>
 #include <cstddef>
 
 static constexpr uint32_t TCPHeaderMinLen = 5; // 32-bit words
 
 using namespace std;
 
+class Wrap32Serializable : public Wrap32
+{
+public:
+  uint32_t raw_value() const { return raw_value_; }
+};
+
+namespace {
+
+//! The TCP header's fields as they are on the wire, decoded all at once before any of them is interpreted
+//! (the ACK flag decides whether the ackno means anything)
+struct TCPWireHeader
+{
+  uint16_t src_port {};
+  uint16_t dst_port {};
+  uint32_t seqno {};
+  uint32_t ackno {};
+  uint8_t data_offset {}; // in the top four bits
+  uint8_t flags {};
+  uint16_t window_size {};
+  uint16_t cksum {};
+  uint16_t urgent_pointer {};
+};
+
+constexpr uint8_t FLAG_ACK = 0b0001'0000;
+constexpr uint8_t FLAG_RST = 0b0000'0100;
+constexpr uint8_t FLAG_SYN = 0b0000'0010;
+constexpr uint8_t FLAG_FIN = 0b0000'0001;
+
+using namespace header_codec;
+using Codec = HeaderCodec<TCPWireHeader,
+                          TCPHeaderMinLen * 4,
+                          Field<0, &TCPWireHeader::src_port>,
+                          Field<2, &TCPWireHeader::dst_port>,
+                          Field<4, &TCPWireHeader::seqno>,
+                          Field<8, &TCPWireHeader::ackno>,
+                          Field<12, &TCPWireHeader::data_offset>,
+                          Field<13, &TCPWireHeader::flags>,
+                          Field<14, &TCPWireHeader::window_size>,
+                          Field<16, &TCPWireHeader::cksum>,
+                          Field<18, &TCPWireHeader::urgent_pointer>>;
+
+TCPWireHeader to_wire( const TCPSegment& seg )
+{
+  const auto& ackno = seg.receiver_message.ackno;
+  return { .src_port = seg.udinfo.src_port,
+           .dst_port = seg.udinfo.dst_port,
+           .seqno = Wrap32Serializable { seg.sender_message.seqno }.raw_value(),
+           .ackno = Wrap32Serializable { ackno.value_or( Wrap32 { 0 } ) }.raw_value(),
+           .data_offset = TCPHeaderMinLen << 4,
+           .flags = static_cast<uint8_t>( ( ackno.has_value() ? FLAG_ACK : 0 ) | ( seg.reset ? FLAG_RST : 0 )
+                                          | ( seg.sender_message.SYN ? FLAG_SYN : 0 )
+                                          | ( seg.sender_message.FIN ? FLAG_FIN : 0 ) ),
+           .window_size = seg.receiver_message.window_size,
+           .cksum = seg.udinfo.cksum,
+           .urgent_pointer = 0 };
+}
+
+void from_wire( TCPSegment& seg, const TCPWireHeader& wire )
+{
+  seg.udinfo.src_port = wire.src_port;
+  seg.udinfo.dst_port = wire.dst_port;
+  seg.udinfo.cksum = wire.cksum;
+  seg.sender_message.seqno = Wrap32 { wire.seqno };
+  seg.sender_message.SYN = wire.flags & FLAG_SYN;
+  seg.sender_message.FIN = wire.flags & FLAG_FIN;
+  seg.reset = wire.flags & FLAG_RST;
+  seg.receiver_message.ackno.reset();
+  if ( wire.flags & FLAG_ACK ) {
+    seg.receiver_message.ackno = Wrap32 { wire.ackno };
+  }
+  seg.receiver_message.window_size = wire.window_size;
+  // (the urgent pointer is ignored)
+}
+
+} // namespace
+
 void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum )
 {
   {
-    /* verify checksum */
-    Parser parser2 = parser;
-    Buffer all_remaining;
-    parser2.all_remaining( all_remaining );
+    /* verify checksum, reading the received buffers in place */
     InternetChecksum check { datagram_layer_pseudo_checksum };
-    check.add( all_remaining );
+    parser.input().for_each_piece( [&check]( const string_view piece ) { check.add( piece ); } );
     if ( check.value() ) {
       parser.set_error();
       return;
     }
   }
 
-  uint32_t raw32 {};
-  uint16_t raw16 {};
-  uint8_t octet {};
-
-  parser.integer( udinfo.src_port );
-  parser.integer( udinfo.dst_port );
-
-  parser.integer( raw32 );
-  sender_message.seqno = Wrap32 { raw32 };
-
-  parser.integer( raw32 );
-  receiver_message.ackno = Wrap32 { raw32 };
-
-  parser.integer( octet );
-  const uint8_t data_offset = octet >> 4;
-
-  parser.integer( octet ); // flags
-  if ( not( octet & 0b0001'0000 ) ) {
-    receiver_message.ackno.reset(); // no ACK
+  array<char, Codec::LENGTH> scratch;
+  TCPWireHeader wire;
+  if ( not Codec::parse( wire, parser, scratch ) ) {
+    return;
   }
-
-  reset = octet & 0b0000'0100;
-  sender_message.SYN = octet & 0b0000'0010;
-  sender_message.FIN = octet & 0b0000'0001;
-
-  parser.integer( receiver_message.window_size );
-  parser.integer( udinfo.cksum );
-  parser.integer( raw16 ); // urgent pointer
+  from_wire( *this, wire );
 
   // skip any options or anything extra in the header
+  const uint8_t data_offset = wire.data_offset >> 4;
   if ( data_offset < TCPHeaderMinLen ) {
     parser.set_error();
+    return;
   }
   parser.remove_prefix( data_offset * 4 - TCPHeaderMinLen * 4 );
 
   parser.all_remaining( sender_message.payload );
 }
 
-class Wrap32Serializable : public Wrap32
-{
-public:
-  uint32_t raw_value() const { return raw_value_; }
-};
-
 void TCPSegment::serialize( Serializer& serializer ) const
 {
-  serializer.integer( udinfo.src_port );
-  serializer.integer( udinfo.dst_port );
-  serializer.integer( Wrap32Serializable { sender_message.seqno }.raw_value() );
-  serializer.integer( Wrap32Serializable { receiver_message.ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
-  serializer.integer( uint8_t { TCPHeaderMinLen << 4 } ); // data offset
-  const uint8_t flags = ( receiver_message.ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
-                        | ( sender_message.SYN ? 0b0000'0010U : 0 ) | ( sender_message.FIN ? 0b0000'0001U : 0 );
-  serializer.integer( flags );
-  serializer.integer( receiver_message.window_size );
-  serializer.integer( udinfo.cksum );
-  serializer.integer( uint16_t { 0 } ); // urgent pointer
+  Codec::serialize( to_wire( *this ), serializer );
   serializer.buffer( sender_message.payload );
 }
 
+//! \details The payload contributes the checksum it was created with (Buffer::copy_and_checksum) when it
+//! has one, so only the 20-byte header is summed here.
 void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
 {
   udinfo.cksum = 0;
-  Serializer s;
-  serialize( s );
+  const auto header = Codec::encode( to_wire( *this ) );
 
   InternetChecksum check { datagram_layer_pseudo_checksum };
-  check.add( s.output() );
+  check.add( string_view { header.data(), header.size() } );
+  check.add( sender_message.payload );
   udinfo.cksum = check.value();
 }
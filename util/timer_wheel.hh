@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//! Timers, each carrying a value of type T, that fire once the clock reaches their deadline (in ms).
+//! A hierarchical timing wheel: timers due within 256 ms sit in one slot per millisecond; later timers sit
+//! in coarser slots (256 ms, 16 s and 17 min wide) and move down a level as their slot comes up. Scheduling
+//! is O(1), and advancing the clock costs O(timers fired) plus one step per 256 ms of elapsed time (empty
+//! millisecond slots are skipped). There is no cancellation: the owner of a timer that is no longer wanted
+//! ignores or re-schedules it when it fires.
+template<typename T>
+class TimerWheel
+{
+  static constexpr unsigned NEAR_BITS = 8;
+  static constexpr unsigned FAR_BITS = 6;
+  static constexpr size_t FAR_LEVELS = 3;
+  static constexpr size_t NEAR_SLOTS = size_t { 1 } << NEAR_BITS;
+  static constexpr size_t FAR_SLOTS = size_t { 1 } << FAR_BITS;
+  static constexpr uint64_t MAX_DELAY = uint64_t { 1 } << ( NEAR_BITS + FAR_LEVELS * FAR_BITS );
+
+  struct Timer
+  {
+    uint64_t deadline;
+    T value;
+  };
+
+  uint64_t now_ {};
+  size_t size_ {};
+  std::array<std::vector<Timer>, NEAR_SLOTS> near_ {};
+  std::array<uint64_t, NEAR_SLOTS / 64> near_occupied_ {}; // bitmap of nonempty near_ slots
+  std::array<std::array<std::vector<Timer>, FAR_SLOTS>, FAR_LEVELS> far_ {};
+  std::vector<Timer> scratch_ {};
+
+  // Granularity (in ms) of the slots of far level `level`
+  static unsigned far_shift( const size_t level ) { return NEAR_BITS + level * FAR_BITS; }
+
+  // File a timer with deadline >= now_ (a deadline of now_ fires in the current step)
+  void place( Timer&& timer )
+  {
+    const uint64_t delay = timer.deadline - now_;
+    if ( delay < NEAR_SLOTS ) {
+      const size_t slot = timer.deadline % NEAR_SLOTS;
+      near_[slot].push_back( std::move( timer ) );
+      near_occupied_[slot / 64] |= uint64_t { 1 } << ( slot % 64 );
+      return;
+    }
+    for ( size_t level = 0; level < FAR_LEVELS; level++ ) {
+      if ( delay < uint64_t { 1 } << far_shift( level + 1 ) or level + 1 == FAR_LEVELS ) {
+        // Timers beyond the wheel's range wait in the last slot, and are filed again when it comes up
+        const uint64_t when = std::min( timer.deadline, now_ + MAX_DELAY - 1 );
+        far_[level][( when >> far_shift( level ) ) % FAR_SLOTS].push_back( std::move( timer ) );
+        return;
+      }
+    }
+  }
+
+  // Move the timers of each far slot that starts now down to finer slots (coarsest level first, so that
+  // timers can move down several levels at once)
+  void cascade()
+  {
+    for ( size_t level = FAR_LEVELS; level-- > 0; ) {
+      if ( now_ % ( uint64_t { 1 } << far_shift( level ) ) == 0 ) {
+        std::swap( scratch_, far_[level][( now_ >> far_shift( level ) ) % FAR_SLOTS] );
+        for ( auto& timer : scratch_ ) {
+          place( std::move( timer ) );
+        }
+        scratch_.clear();
+      }
+    }
+  }
+
+  // The first time after now_, and no later than the next multiple of NEAR_SLOTS, with a nonempty near slot
+  // (or that next multiple)
+  uint64_t next_step() const
+  {
+    const uint64_t next = now_ + 1;
+    const uint64_t rotation_end = ( next | ( NEAR_SLOTS - 1 ) ) + 1;
+    if ( next % NEAR_SLOTS == 0 ) {
+      return next;
+    }
+    for ( size_t slot = next % NEAR_SLOTS; slot < NEAR_SLOTS; slot = ( slot | 63 ) + 1 ) {
+      const uint64_t bits = near_occupied_[slot / 64] >> ( slot % 64 );
+      if ( bits ) {
+        return next - next % NEAR_SLOTS + slot + std::countr_zero( bits );
+      }
+    }
+    return rotation_end;
+  }
+
+public:
+  //! The current time
+  uint64_t now() const { return now_; }
+
+  //! Number of pending timers
+  size_t size() const { return size_; }
+
+  //! Schedule `value` to fire at `deadline` (or at the next step, if the deadline has passed)
+  void schedule( const uint64_t deadline, T value )
+  {
+    place( { std::max( deadline, now_ + 1 ), std::move( value ) } );
+    size_++;
+  }
+
+  //! Advance the clock to `now`, calling fire( value ) for each timer that comes due, in deadline order.
+  //! fire() may schedule new timers.
+  template<typename F>
+  void advance( const uint64_t now, F&& fire )
+  {
+    while ( now_ < now ) {
+      if ( size_ == 0 ) {
+        now_ = now;
+        return;
+      }
+
+      const uint64_t step = next_step();
+      if ( step > now ) {
+        now_ = now;
+        return;
+      }
+      now_ = step;
+      if ( now_ % NEAR_SLOTS == 0 ) {
+        cascade();
+      }
+
+      const size_t slot = now_ % NEAR_SLOTS;
+      std::swap( scratch_, near_[slot] );
+      near_occupied_[slot / 64] &= ~( uint64_t { 1 } << ( slot % 64 ) );
+      size_ -= scratch_.size();
+      for ( auto& timer : scratch_ ) {
+        fire( std::move( timer.value ) );
+      }
+      scratch_.clear();
+    }
+  }
+};
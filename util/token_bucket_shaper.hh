@@ -0,0 +1,239 @@
+#pragma once
+
+#include "fq_codel.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! \brief Traffic shaping by token buckets, in two levels: classes, each limited by its own bucket, share the
+//! bucket that limits the whole link
+//! \details An item may go once neither its class's bucket nor the link's is in debt, and takes its size from both
+//! (so an item larger than a burst still goes, and the rate holds exactly over time). Other items wait in their
+//! class's queue until tick() refills the buckets; the classes then take turns. Each class's queue is managed by
+//! FQ-CoDel, so that the flows in a class take turns too, and items that wait too long are dropped (or marked)
+//! where the delay builds up. Buckets are refilled before releasing and only then capped at their bursts, so that
+//! the rate does not depend on how often tick() is called.
+template<typename T>
+class TokenBucketShaper
+{
+public:
+  static constexpr size_t MAX_CLASSES = 64;
+
+  struct Bucket
+  {
+    uint64_t rate {};  //!< bits per second (zero for no limit)
+    uint64_t burst {}; //!< bytes that may be sent at once after a pause
+  };
+
+  struct ClassConfig
+  {
+    Bucket limit {};
+    //! Most items waiting; beyond it, items are dropped. Buckets are refilled only by tick(), so to keep up with
+    //! its rate the queue should hold a tick's worth of the class's traffic.
+    size_t queue_limit = 1024;
+  };
+
+  struct Entry
+  {
+    T item {};
+    size_t size {};
+  };
+
+  using Queue = FQCoDel<Entry>;
+
+  struct Config
+  {
+    Bucket limit {};                         //!< the whole link
+    std::vector<ClassConfig> classes { {} }; //!< at least one
+    std::array<uint8_t, 64> dscp_classes {}; //!< class of items with each DSCP (by default, class 0)
+    typename Queue::Config queue {};         //!< each class's queue (its limit is the class's queue_limit)
+  };
+
+  struct ClassStats
+  {
+    size_t queued {};          // waiting now
+    uint64_t passed {};        // sent without waiting
+    uint64_t delayed {};       // sent after waiting
+    uint64_t bytes {};         // sent
+    uint64_t dropped {};       // for lack of room in the queue
+    uint64_t dropped_bytes {};
+    uint64_t dropped_codel {}; // for waiting too long
+    uint64_t marked {};        // for waiting too long, with ECN
+  };
+
+private:
+  // Tokens are counted in 1/8000 byte, so that a rate in bits per second adds rate tokens per ms
+  static constexpr int64_t TOKENS_PER_BYTE = 8000;
+
+  struct TokenBucket
+  {
+    Bucket config;
+    int64_t tokens;
+
+    explicit TokenBucket( const Bucket& bucket )
+      : config( bucket ), tokens( static_cast<int64_t>( bucket.burst ) * TOKENS_PER_BYTE )
+    {}
+
+    bool conforms() const { return config.rate == 0 or tokens >= 0; }
+    void take( const size_t size ) { tokens -= config.rate == 0 ? 0 : static_cast<int64_t>( size ) * TOKENS_PER_BYTE; }
+    void refill( const uint64_t ms ) { tokens += static_cast<int64_t>( config.rate * ms ); }
+    void cap() { tokens = std::min( tokens, static_cast<int64_t>( config.burst ) * TOKENS_PER_BYTE ); }
+  };
+
+  // A class: its bucket, and its queue of waiting items
+  struct Class
+  {
+    TokenBucket bucket;
+    Queue queue;
+    ClassStats stats {};
+
+    Class( const Bucket& limit, const typename Queue::Config& queue_config ) : bucket( limit ), queue( queue_config ) {}
+  };
+
+  TokenBucket link_;
+  std::vector<Class> classes_ {};
+  std::array<uint8_t, 64> dscp_classes_;
+  size_t next_class_ {}; // the class whose turn is first in the next release
+  uint64_t now_ {};      // ms ticked
+
+  // The next item of class `c` (if CoDel has not dropped them all), taking its size from the buckets
+  template<typename Mark>
+  std::optional<T> pop( Class& c, Mark& mark )
+  {
+    auto entry = c.queue.dequeue( now_, [&]( Entry& e ) { return mark( e.item ); } );
+    if ( not entry.has_value() ) {
+      return std::nullopt;
+    }
+    c.stats.delayed++;
+    c.stats.bytes += entry->size;
+    c.bucket.take( entry->size );
+    link_.take( entry->size );
+    return std::move( entry->item );
+  }
+
+  static bool never_mark( T& /* item */ ) { return false; }
+
+public:
+  explicit TokenBucketShaper( const Config& config )
+    : link_( config.limit ), dscp_classes_( config.dscp_classes )
+  {
+    if ( config.classes.empty() or config.classes.size() > MAX_CLASSES ) {
+      throw std::runtime_error( "TokenBucketShaper: needs from 1 to " + std::to_string( MAX_CLASSES )
+                                + " classes" );
+    }
+    if ( std::ranges::any_of( dscp_classes_, [&]( uint8_t c ) { return c >= config.classes.size(); } ) ) {
+      throw std::runtime_error( "TokenBucketShaper: DSCP mapped to a class that does not exist" );
+    }
+    classes_.reserve( config.classes.size() );
+    for ( const auto& c : config.classes ) {
+      auto queue_config = config.queue;
+      queue_config.limit = c.queue_limit;
+      classes_.emplace_back( c.limit, queue_config );
+    }
+  }
+
+  //! The class of an item with differentiated services code point `dscp`
+  size_t classify( const uint8_t dscp ) const { return dscp_classes_[dscp & 0x3f]; }
+
+  //! Offer `item` of `size` bytes, from the flow with hash `flow_hash`, in class `traffic_class` (class 0 if there
+  //! is no such class). Returns the item if it may go now; otherwise it waits to be released by tick(), or is
+  //! dropped if its class's queue is full.
+  std::optional<T> submit( T item, size_t traffic_class, const size_t size, const uint32_t flow_hash = 0 )
+  {
+    Class& c = classes_[traffic_class < classes_.size() ? traffic_class : 0];
+    if ( c.queue.empty() and c.bucket.conforms() and link_.conforms() ) {
+      c.bucket.take( size );
+      link_.take( size );
+      c.stats.passed++;
+      c.stats.bytes += size;
+      return item;
+    }
+
+    // (Full is checked here, so that a full queue costs no more than a drop: FQ-CoDel's own limit makes it look
+    // for the longest flow.)
+    if ( c.queue.stats().backlog_items >= c.queue.config().limit ) {
+      c.stats.dropped++;
+      c.stats.dropped_bytes += size;
+      return std::nullopt;
+    }
+    c.queue.enqueue( { std::move( item ), size }, flow_hash, size, now_ );
+    return std::nullopt;
+  }
+
+  //! Let `ms` milliseconds pass, refilling the buckets, and call send( item ) for each waiting item they now allow.
+  //! If the queues use ECN, mark( item ) is asked to mark an item that CoDel would drop (false if it cannot).
+  template<typename Send, typename Mark>
+  void tick( const uint64_t ms, Send&& send, Mark&& mark )
+  {
+    now_ += ms;
+    link_.refill( ms );
+    for ( auto& c : classes_ ) {
+      c.bucket.refill( ms );
+    }
+
+    // The classes take turns, one item at a time, while the link allows
+    for ( bool progress = true; progress and link_.conforms(); ) {
+      progress = false;
+      for ( size_t i = 0; i < classes_.size() and link_.conforms(); i++ ) {
+        Class& c = classes_[next_class_];
+        next_class_ = next_class_ + 1 == classes_.size() ? 0 : next_class_ + 1;
+        if ( not c.queue.empty() and c.bucket.conforms() ) {
+          if ( auto item = pop( c, mark ) ) {
+            send( std::move( *item ) );
+          }
+          progress = true;
+        }
+      }
+    }
+
+    link_.cap();
+    for ( auto& c : classes_ ) {
+      c.bucket.cap();
+    }
+  }
+
+  template<typename Send>
+  void tick( const uint64_t ms, Send&& send )
+  {
+    tick( ms, send, never_mark );
+  }
+
+  //! Call send( item ) for every waiting item, regardless of the buckets (but not of CoDel)
+  template<typename Send, typename Mark>
+  void drain( Send&& send, Mark&& mark )
+  {
+    for ( auto& c : classes_ ) {
+      while ( not c.queue.empty() ) {
+        if ( auto item = pop( c, mark ) ) {
+          send( std::move( *item ) );
+        }
+      }
+    }
+  }
+
+  template<typename Send>
+  void drain( Send&& send )
+  {
+    drain( send, never_mark );
+  }
+
+  size_t classes() const { return classes_.size(); }
+
+  ClassStats stats( const size_t traffic_class ) const
+  {
+    const Class& c = classes_.at( traffic_class );
+    const auto& queue = c.queue.stats();
+    ClassStats stats = c.stats;
+    stats.queued = queue.backlog_items;
+    stats.dropped_codel = queue.dropped_codel;
+    stats.marked = queue.marked;
+    return stats;
+  }
+};
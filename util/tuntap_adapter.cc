@@ -64,10 +64,18 @@ optional<TCPSegment> TCPOverIPv4OverEthernetAdapter::read()
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
 void TCPOverIPv4OverEthernetAdapter::tick( const size_t ms_since_last_tick )
 {
+  TCPOverIPv4Adapter::tick( ms_since_last_tick );
   _interface.tick( ms_since_last_tick );
   send_pending();
 }
 
+//! \param[in] mtu the MTU of the link, from NetworkInterface::MIN_MTU to NetworkInterface::JUMBO_MTU
+void TCPOverIPv4OverEthernetAdapter::set_mtu( const size_t mtu )
+{
+  _interface.set_mtu( mtu );
+  set_link_mtu( mtu );
+}
+
 //! \param[in] seg the TCPSegment to send
 void TCPOverIPv4OverEthernetAdapter::write( TCPSegment& seg )
 {
@@ -77,9 +85,11 @@ void TCPOverIPv4OverEthernetAdapter::write( TCPSegment& seg )
 
 void TCPOverIPv4OverEthernetAdapter::send_pending()
 {
-  while ( auto frame = _interface.maybe_send() ) {
-    _tap.write( serialize( frame.value() ) );
+  _interface.drain_frames( _frames_out );
+  for ( const auto& frame : _frames_out ) {
+    _tap.write( serialize( frame ) );
   }
+  _frames_out.clear();
 }
 
 //! Specialize LossyFdAdapter to TCPOverIPv4OverTunFdAdapter
@@ -9,6 +9,7 @@
 #include <optional>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 //! \brief A FD adapter for IPv4 datagrams read from and written to a TUN device
 class TCPOverIPv4OverTunFdAdapter : public TCPOverIPv4Adapter
@@ -49,6 +50,8 @@ private:
 
   Address _next_hop; //!< IP address of the next hop
 
+  std::vector<EthernetFrame> _frames_out {}; //!< Frames drained from the NIC, reused between sends
+
   void send_pending(); //!< Sends any pending Ethernet frames
 
 public:
@@ -66,6 +69,9 @@ public:
   //! Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
+  //! Set the MTU of the link (the NetworkInterface's, and the adapter's starting estimate of the path MTU)
+  void set_mtu( size_t mtu );
+
   //! Access the underlying raw Ethernet connection
   explicit operator TapFD&() { return _tap; }
 